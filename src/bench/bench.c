@@ -0,0 +1,976 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <log.h>
+#include <timing.h>
+#include <mem/ps1system.h>
+#include <mem/addresses.h>
+#include <mem/bus.h>
+#include <mem/state.h>
+#include <mem/delta.h>
+#include <mem/rewind.h>
+#include <lz.h>
+#include <cpu/cpu.h>
+#include <cpu/disassemble.h>
+#include <gpu/gpu.h>
+#include <hle/hle.h>
+#include <cdrom/cdz.h>
+
+// Returned when a benchmark can't run in this environment, see SKIP_RETURN_CODE in CMakeLists.txt
+#define BENCH_SKIPPED 77
+
+#define BENCH_BIOS_PATH "SCPH1001.BIN"
+
+typedef struct bench {
+    const char* name;
+    // Runs `iterations` operations and returns a value derived from the results, so the work isn't optimized out
+    u64 (*run)(u64 iterations);
+    u64 iterations;
+    // Generous ceiling, only meant to catch large regressions. 0 = no limit.
+    double max_ns_per_op;
+} bench_t;
+
+static volatile u64 bench_sink;
+
+static u8 fake_bios[0x80000];
+
+static void bench_reset_system() {
+    ps1_system_reset();
+    PS1SYS.mem.bios = fake_bios;
+    PS1SYS.mem.bios_size = sizeof(fake_bios);
+    PS1SYS.dma.dpcr = 0x07654321 | (8 << (2 * 4)) | (8 << (6 * 4)); // Enable DMA2 and DMA6
+    cpu_set_pc(0xBFC00000);
+}
+
+// A mix of the instructions the BIOS spends most of its time on
+static const u32 decode_mix[] = {
+        0x3C081F80, // lui t0, 0x1F80
+        0x25080010, // addiu t0, t0, 0x10
+        0xAD090000, // sw t1, 0(t0)
+        0x8D0A0000, // lw t2, 0(t0)
+        0x00000000, // nop
+        0x01095021, // addu t2, t0, t1
+        0x01095025, // or t2, t0, t1
+        0x00084080, // sll t0, t0, 2
+        0x1509FFFC, // bne t0, t1, -4
+        0x0BF00000, // j 0xBFC00000
+        0x03E00008, // jr ra
+        0x40806000, // mtc0 zero, SR
+        0x40086000, // mfc0 t0, SR
+        0x0C000000, // jal 0
+        0x31080FFF, // andi t0, t0, 0xFFF
+        0x90880000, // lbu t0, 0(a0)
+};
+#define DECODE_MIX_SIZE (sizeof(decode_mix) / sizeof(decode_mix[0]))
+
+static u64 bench_decode(u64 iterations) {
+    u64 sum = 0;
+    for (u64 i = 0; i < iterations; i++) {
+        mips_instruction_t instr = { .raw = decode_mix[i % DECODE_MIX_SIZE] };
+        sum += (uintptr_t)r3000a_instruction_decode(0xBFC00000 + i * 4, instr);
+    }
+    return sum;
+}
+
+static u64 bench_disassemble(u64 iterations) {
+    char buf[64];
+    u64 sum = 0;
+    for (u64 i = 0; i < iterations; i++) {
+        disassemble(0xBFC00000 + i * 4, decode_mix[i % DECODE_MIX_SIZE], buf, sizeof(buf));
+        sum += buf[0];
+    }
+    return sum;
+}
+
+static u64 bench_virt_to_phys(u64 iterations) {
+    static const u32 bases[] = { 0x00000000, 0x80000000, 0xA0000000, 0xBFC00000 };
+    u64 sum = 0;
+    for (u64 i = 0; i < iterations; i++) {
+        sum += virt_to_phys(bases[i & 3] + ((i * 4) & 0xFFFF));
+    }
+    return sum;
+}
+
+static u64 bench_read32(u32 base, u32 mask, u64 iterations) {
+    u64 sum = 0;
+    for (u64 i = 0; i < iterations; i++) {
+        sum += ps1_read32(base + ((i * 4) & mask));
+    }
+    return sum;
+}
+
+static u64 bench_read32_ram(u64 iterations)     { return bench_read32(0x80000000, 0x1FFFFC, iterations); }
+static u64 bench_read32_bios(u64 iterations)    { return bench_read32(0xBFC00000, 0x7FFFC, iterations); }
+static u64 bench_read32_i_stat(u64 iterations)  { return bench_read32(0xA0000000 | INTC_I_STAT, 0, iterations); }
+static u64 bench_read32_gpustat(u64 iterations) { return bench_read32(0xA0000000 | GPU_GPUSTAT, 0, iterations); }
+static u64 bench_read32_dma(u64 iterations)     { return bench_read32(0xA0000000 | DMA_DPCR, 0, iterations); }
+
+static u64 bench_write32_ram(u64 iterations) {
+    for (u64 i = 0; i < iterations; i++) {
+        ps1_write32(0x80000000 + ((i * 4) & 0x1FFFFC), i);
+    }
+    return PS1SYS.mem.ram[0];
+}
+
+static u64 bench_write32_i_mask(u64 iterations) {
+    for (u64 i = 0; i < iterations; i++) {
+        ps1_write32(0xA0000000 | INTC_I_MASK, i);
+    }
+    return PS1SYS.i_mask;
+}
+
+// Full screen CPU to VRAM copy through GP0, one operation = one word
+static u64 bench_gp0_vram_copy(u64 iterations) {
+    const u32 words_per_copy = VRAM_WIDTH * VRAM_HEIGHT / 2;
+    for (u64 i = 0; i < iterations; i++) {
+        if (i % words_per_copy == 0) {
+            gpu_gp0_write(0xA0000000);
+            gpu_gp0_write(0x00000000);
+            gpu_gp0_write((VRAM_HEIGHT << 16) | VRAM_WIDTH);
+        }
+        gpu_gp0_write(i);
+    }
+    PS1GPU.gp0_state = READY;
+    return PS1GPU.vram[0];
+}
+
+// One operation = one word cleared by DMA6 (ordering table clear)
+static u64 bench_dma_otc(u64 iterations) {
+    const u32 words_per_transfer = 0x4000;
+    for (u64 i = 0; i < iterations; i += words_per_transfer) {
+        ps1_write32(0xA0000000 | DMA6_BASE_ADDR, 0x001FFFFC);
+        ps1_write32(0xA0000000 | DMA6_BLOCK_CTRL, words_per_transfer);
+        ps1_write32(0xA0000000 | DMA6_CHANNEL_CTRL, 0x11000002);
+    }
+    return PS1SYS.mem.ram[0x1FFFFC];
+}
+
+// One operation = one word sent to GP0 by DMA2 in request mode, as a CPU to VRAM copy
+static u64 bench_dma_gpu(u64 iterations) {
+    const u32 block_size = 0x10;
+    const u32 blocks = 0x800;
+    const u32 words_per_transfer = block_size * blocks;
+    for (u64 i = 0; i < iterations; i += words_per_transfer) {
+        gpu_gp0_write(0xA0000000);
+        gpu_gp0_write(0x00000000);
+        gpu_gp0_write((0x40 << 16) | 0x400); // 1024x64, exactly one transfer's worth of pixels
+        ps1_write32(0xA0000000 | DMA2_BASE_ADDR, 0x00000000);
+        ps1_write32(0xA0000000 | DMA2_BLOCK_CTRL, (blocks << 16) | block_size);
+        ps1_write32(0xA0000000 | DMA2_CHANNEL_CTRL, 0x01000201);
+    }
+    return PS1GPU.vram[0];
+}
+
+/*
+ * One operation = one DMA2 linked list transfer of a list that loops back on itself, which has to stop on its own and
+ * then raise the channel's DICR flag and IRQ3. Writing back what was read has to clear the flag.
+ */
+static u64 bench_dma_gpu_list(u64 iterations) {
+    const u32 node = 0x1000;
+    PS1SYS.dma.dpcr |= 8 << (2 * 4); // Enable DMA2
+    for (u64 i = 0; i < iterations; i++) {
+        ps1_write32(0xA0000000 | node, node); // No words, the next node is itself
+        ps1_write32(0xA0000000 | DMA_DICR, (1 << 23) | (1 << (16 + 2)));
+        PS1SYS.i_stat = 0;
+        ps1_write32(0xA0000000 | DMA2_BASE_ADDR, node);
+        ps1_write32(0xA0000000 | DMA2_CHANNEL_CTRL, 0x01000401);
+
+        u32 dicr = ps1_read32(0xA0000000 | DMA_DICR);
+        if (!(dicr & (1 << (24 + 2))) || !(dicr & (1u << 31)) || !(PS1SYS.i_stat & (1 << 3))) {
+            logfatal("DMA2 finished without its DICR flag and IRQ3, DICR %08X I_STAT %08X", dicr, PS1SYS.i_stat);
+        }
+        ps1_write32(0xA0000000 | DMA_DICR, dicr);
+        dicr = ps1_read32(0xA0000000 | DMA_DICR);
+        if (dicr != ((1 << 23) | (1 << (16 + 2)))) {
+            logfatal("Writing the DICR flags back didn't clear them, %08X", dicr);
+        }
+    }
+    return PS1SYS.dma.dicr;
+}
+
+static const char* bench_state_path() {
+    static char path[256];
+    const char* tmp = getenv("TMPDIR");
+    snprintf(path, sizeof(path), "%s/ps1_bench_%d.state", tmp != NULL ? tmp : "/tmp", getpid());
+    return path;
+}
+
+static u64 bench_save_state(u64 iterations) {
+    for (u64 i = 0; i < iterations; i++) {
+        PS1SYS.mem.ram[0] = i;
+        if (!state_save(bench_state_path())) {
+            logfatal("Save state failed");
+        }
+    }
+    unlink(bench_state_path());
+    return PS1SYS.mem.ram[0];
+}
+
+// Each load has to undo a change made since the save
+static u64 bench_load_state(u64 iterations) {
+    u64 saved_hash = state_hash();
+    if (!state_save(bench_state_path())) {
+        logfatal("Save state failed");
+    }
+    for (u64 i = 0; i < iterations; i++) {
+        PS1SYS.mem.ram[0] = i + 1;
+        PS1CPU.pc = i;
+        if (!state_load(bench_state_path())) {
+            logfatal("Load state failed");
+        }
+    }
+    unlink(bench_state_path());
+    if (state_hash() != saved_hash) {
+        logfatal("Loading a save state didn't restore the machine");
+    }
+    return PS1CPU.pc;
+}
+
+// A frame's worth of scattered RAM writes and a small VRAM upload between each delta
+static u64 bench_delta_save(u64 iterations) {
+    for (u64 i = 0; i < iterations; i++) {
+        for (u32 j = 0; j < 16; j++) {
+            ps1_write32(0x80000000 + (((i * 16 + j) * 0x3004) & 0x1FFFFC), i);
+        }
+        gpu_gp0_write(0xA0000000);
+        gpu_gp0_write(0x00000000);
+        gpu_gp0_write((16 << 16) | 16);
+        for (u32 j = 0; j < 16 * 16 / 2; j++) {
+            gpu_gp0_write(i);
+        }
+        if (!delta_save(bench_state_path())) {
+            logfatal("Delta save failed");
+        }
+    }
+    unlink(bench_state_path());
+    return PS1SYS.mem.ram[0];
+}
+
+// XOR delta of two frames: mostly zeros with scattered changed words. One operation = one byte.
+#define LZ_BENCH_SIZE (64 * 1024)
+static u8 lz_bench_input[LZ_BENCH_SIZE];
+static u8 lz_bench_output[LZ_COMPRESS_BOUND(LZ_BENCH_SIZE)];
+static u8 lz_bench_decoded[LZ_BENCH_SIZE];
+
+static void lz_bench_fill() {
+    memset(lz_bench_input, 0x00, sizeof(lz_bench_input));
+    for (u32 i = 0; i < LZ_BENCH_SIZE; i += 61) {
+        lz_bench_input[i] = i * 7;
+    }
+}
+
+static u64 bench_lz_compress(u64 iterations) {
+    lz_bench_fill();
+    u64 size = 0;
+    for (u64 i = 0; i < iterations; i += LZ_BENCH_SIZE) {
+        size += lz_compress(lz_bench_input, LZ_BENCH_SIZE, lz_bench_output);
+    }
+    return size;
+}
+
+static u64 bench_lz_decompress(u64 iterations) {
+    lz_bench_fill();
+    size_t compressed = lz_compress(lz_bench_input, LZ_BENCH_SIZE, lz_bench_output);
+    u64 size = 0;
+    for (u64 i = 0; i < iterations; i += LZ_BENCH_SIZE) {
+        size += lz_decompress(lz_bench_output, compressed, lz_bench_decoded, LZ_BENCH_SIZE);
+    }
+    if (memcmp(lz_bench_input, lz_bench_decoded, LZ_BENCH_SIZE) != 0) {
+        logfatal("lz round trip mismatch");
+    }
+    return size;
+}
+
+// One operation = one frame captured with a handful of changed RAM pages
+static u64 bench_rewind_capture(u64 iterations) {
+    if (!rewind_enabled) {
+        rewind_init(16 << 20);
+    }
+    for (u64 i = 0; i < iterations; i++) {
+        for (u32 j = 0; j < 16; j++) {
+            ps1_write32(0x80000000 + (((i * 16 + j) * 0x3004) & 0x1FFFFC), i);
+        }
+        rewind_capture();
+    }
+    return rewind_frames_available();
+}
+
+// Capture, change a RAM page, capture, snapshot (so nothing is dirty), step back. The machine must hash as it did at the
+// first capture and the page must be dirty again for the next delta. One operation = one such round.
+static u64 bench_rewind_step_back(u64 iterations) {
+    if (!rewind_enabled) {
+        rewind_init(16 << 20);
+    }
+    for (u64 i = 0; i < iterations; i++) {
+        u32 address = (i * 0x3004) & 0x1FFFFC;
+        rewind_capture();
+        u64 hash = state_hash();
+        ps1_write32(0x80000000 + address, ~ps1_read32(0x80000000 + address));
+        rewind_capture();
+        dirty_reset(PS1SYS.cycles);
+        if (!rewind_step_back()) {
+            logfatal("No rewind history to step back into");
+        }
+        if (state_hash() != hash) {
+            logfatal("Stepping back didn't restore the previous frame");
+        }
+        if (!dirty_page_test(dirty_pages.ram, address >> DIRTY_PAGE_SHIFT)) {
+            logfatal("Stepping back didn't mark the restored page dirty");
+        }
+    }
+    return rewind_frames_available();
+}
+
+// Guest program for the frame benchmarks, run from the start of the BIOS: keeps storing a counter across RAM
+static const u32 store_loop_program[] = {
+        0x3C088000, // lui t0, 0x8000
+        0x00095080, // sll t2, t1, 2
+        0x010A4021, // addu t0, t0, t2
+        0xAD090000, // sw t1, 0(t0)
+        0x25290001, // addiu t1, t1, 1
+        0x3129FFFF, // andi t1, t1, 0xFFFF
+        0x0BF00000, // j 0xBFC00000
+        0x00000000, // nop
+};
+
+static void bench_run_frames(int frames) {
+    for (int i = 0; i < frames; i++) {
+        ps1_system_run_frame();
+    }
+}
+
+// 3 frames, save, 2 more, load and 1 more must end where 4 frames straight through do. One operation = one such check.
+static u64 bench_state_resume(u64 iterations) {
+    memcpy(fake_bios, store_loop_program, sizeof(store_loop_program));
+    u64 hash = 0;
+    for (u64 i = 0; i < iterations; i++) {
+        bench_reset_system();
+        bench_run_frames(4);
+        hash = state_hash();
+
+        bench_reset_system();
+        bench_run_frames(3);
+        if (!state_save(bench_state_path())) {
+            logfatal("Save state failed");
+        }
+        bench_run_frames(2);
+        if (!state_load(bench_state_path())) {
+            logfatal("Load state failed");
+        }
+        bench_run_frames(1);
+        if (state_hash() != hash) {
+            logfatal("Resuming from a save state diverged: %016" PRIx64 " != %016" PRIx64, state_hash(), hash);
+        }
+    }
+    unlink(bench_state_path());
+    return hash;
+}
+
+// One operation = one presented frame with two frames of run-ahead, over a loop that keeps storing to RAM. Rolling
+// back has to be exact: the run must end on the same state as the same number of plain frames.
+static u64 bench_run_ahead(u64 iterations) {
+    memcpy(fake_bios, store_loop_program, sizeof(store_loop_program));
+    for (u64 i = 0; i < iterations; i++) {
+        ps1_system_run_frame_ahead(2);
+    }
+    if (PS1SYS.stats.frames != iterations) {
+        logfatal("%" PRIu64 " frames of run-ahead counted as %" PRIu64, iterations, PS1SYS.stats.frames);
+    }
+    u64 hash = state_hash();
+    bench_reset_system();
+    bench_run_frames(iterations);
+    if (state_hash() != hash) {
+        logfatal("Run-ahead diverged from plain frames: %016" PRIx64 " != %016" PRIx64, hash, state_hash());
+    }
+    return PS1CPU.pc;
+}
+
+// Two instances running the same program, switching every frame. One operation = one frame. They must end identical.
+static u64 bench_instances(u64 iterations) {
+    ps1_instance_t* previous = ps1_instance_current();
+    ps1_instance_t* instances[2];
+    for (int i = 0; i < 2; i++) {
+        instances[i] = ps1_instance_create();
+        ps1_instance_select(instances[i]);
+        bench_reset_system();
+        PS1SYS.mem.bios = (const u8*)store_loop_program;
+        PS1SYS.mem.bios_size = sizeof(store_loop_program);
+    }
+    for (u64 i = 0; i < iterations; i++) {
+        ps1_instance_select(instances[i & 1]);
+        ps1_system_run_frame();
+    }
+    if (iterations % 2 == 0 && (memcmp(instances[0]->system.mem.ram, instances[1]->system.mem.ram, PS1_RAM_SIZE) != 0
+            || memcmp(&instances[0]->cpu, &instances[1]->cpu, sizeof(r3000a_t)) != 0)) {
+        logfatal("Instances diverged");
+    }
+    u64 result = instances[0]->cpu.gpr[9];
+    ps1_instance_select(previous);
+    ps1_instance_destroy(instances[0]);
+    ps1_instance_destroy(instances[1]);
+    return result;
+}
+
+/*
+ * Synthetic disc for the CD-ROM and HLE benchmarks: mode 2 form 1 sectors whose data is derived from the LBA so reads
+ * can be checked, with an ISO9660 filesystem holding one file, BENCH_DISC_FILE.
+ */
+#define BENCH_DISC_SECTORS 64
+#define BENCH_DISC_ROOT_LBA 22
+#define BENCH_DISC_FILE "HELLO.TXT;1"
+#define BENCH_DISC_FILE_LBA 24
+#define BENCH_DISC_FILE_SIZE 3000
+
+static u8 bench_disc_byte(u32 lba, u32 offset) {
+    return lba * 13 + offset * 7 + (offset >> 8);
+}
+
+static u8 bcd(u32 value) {
+    return (value / 10) << 4 | value % 10;
+}
+
+static void put_u32_both(u8* out, u32 value) {
+    for (int i = 0; i < 4; i++) {
+        out[i] = value >> (i * 8);
+        out[7 - i] = value >> (i * 8);
+    }
+}
+
+static u32 bench_dir_record(u8* record, u32 lba, u32 size, bool directory, const char* id, u32 id_length) {
+    u32 length = 33 + id_length + (id_length % 2 == 0);
+    record[0] = length;
+    put_u32_both(record + 2, lba);
+    put_u32_both(record + 10, size);
+    record[25] = directory ? 2 : 0;
+    record[32] = id_length;
+    memcpy(record + 33, id, id_length);
+    return length;
+}
+
+static void bench_disc_sector(u32 lba, u8* sector) {
+    memset(sector, 0x00, DISC_SECTOR_SIZE);
+    memset(sector + 1, 0xFF, 10);
+    u32 msf = lba + DISC_LEAD_IN_SECTORS;
+    sector[12] = bcd(msf / 75 / 60);
+    sector[13] = bcd(msf / 75 % 60);
+    sector[14] = bcd(msf % 75);
+    sector[15] = 2;
+    sector[18] = sector[22] = 0x08; // Form 1 data, EDC/ECC are left zero since nothing checks them
+    u8* data = sector + 24;
+    if (lba == 16) {
+        data[0] = 1; // Primary volume descriptor
+        memcpy(data + 1, "CD001", 5);
+        data[6] = 1;
+        bench_dir_record(data + 156, BENCH_DISC_ROOT_LBA, 0x800, true, "\0", 1);
+    } else if (lba == 17) {
+        data[0] = 0xFF; // Terminator
+        memcpy(data + 1, "CD001", 5);
+        data[6] = 1;
+    } else if (lba == BENCH_DISC_ROOT_LBA) {
+        u32 offset = bench_dir_record(data, BENCH_DISC_ROOT_LBA, 0x800, true, "\0", 1);
+        offset += bench_dir_record(data + offset, BENCH_DISC_ROOT_LBA, 0x800, true, "\1", 1);
+        bench_dir_record(data + offset, BENCH_DISC_FILE_LBA, BENCH_DISC_FILE_SIZE, false, BENCH_DISC_FILE, strlen(BENCH_DISC_FILE));
+    } else {
+        for (u32 i = 0; i < 0x800; i++) {
+            data[i] = bench_disc_byte(lba, i);
+        }
+    }
+}
+
+static const char* bench_disc_path() {
+    static char path[256];
+    const char* tmp = getenv("TMPDIR");
+    snprintf(path, sizeof(path), "%s/ps1_bench_%d.bin", tmp != NULL ? tmp : "/tmp", getpid());
+    return path;
+}
+
+static void bench_write_disc() {
+    FILE* fp = fopen(bench_disc_path(), "wb");
+    if (fp == NULL) {
+        logfatal("Unable to create %s", bench_disc_path());
+    }
+    u8 sector[DISC_SECTOR_SIZE];
+    for (u32 lba = 0; lba < BENCH_DISC_SECTORS; lba++) {
+        bench_disc_sector(lba, sector);
+        fwrite(sector, sizeof(sector), 1, fp);
+    }
+    fclose(fp);
+}
+
+#define CDROM_REG(reg) (0xA0000000 | (reg))
+#define CDROM_READ_LBA 40 // Past the filesystem, so every byte follows bench_disc_byte
+#define CDROM_READ_SECTORS 3
+#define CDROM_READ_BUFFER 0x80100000
+#define CDROM_MAX_INTERRUPTS 16
+
+static u8 cdrom_interrupts[CDROM_MAX_INTERRUPTS];
+static int cdrom_num_interrupts;
+
+// Runs the CPU until the controller raises an interrupt, returns its number and the first response byte
+static u8 cdrom_wait_interrupt(u8* response) {
+    ps1_write8(CDROM_REG(CDROM_INDEX_STATUS), 1);
+    for (u64 deadline = PS1SYS.cycles + 10 * CPU_CYCLES_PER_FRAME; PS1SYS.cycles < deadline;) {
+        u8 interrupt = ps1_read8(CDROM_REG(CDROM_INTERRUPT)) & 7;
+        if (interrupt != 0) {
+            if (!(PS1SYS.i_stat & (1 << 2))) {
+                logfatal("CD-ROM INT%d without IRQ2", interrupt);
+            }
+            *response = ps1_read8(CDROM_REG(CDROM_RESPONSE_FIFO));
+            if (cdrom_num_interrupts < CDROM_MAX_INTERRUPTS) {
+                cdrom_interrupts[cdrom_num_interrupts++] = interrupt;
+            }
+            return interrupt;
+        }
+        ps1_system_step();
+    }
+    logfatal("No CD-ROM interrupt within 10 frames");
+}
+
+static void cdrom_acknowledge() {
+    ps1_write8(CDROM_REG(CDROM_INDEX_STATUS), 1);
+    ps1_write8(CDROM_REG(CDROM_INTERRUPT), 0x1F);
+    PS1SYS.i_stat &= ~(1 << 2);
+}
+
+static void cdrom_command(u8 command, const u8* parameters, int num_parameters) {
+    ps1_write8(CDROM_REG(CDROM_INDEX_STATUS), 0);
+    for (int i = 0; i < num_parameters; i++) {
+        ps1_write8(CDROM_REG(CDROM_DATA_FIFO), parameters[i]);
+    }
+    ps1_write8(CDROM_REG(CDROM_RESPONSE_FIFO), command);
+}
+
+/*
+ * Drives the controller through its registers the way a game's CD library does: Setloc, ReadN, a DMA3 of each sector
+ * as it arrives, then Pause. Checks the interrupt sequence and the bytes that land in RAM. One operation = one read.
+ */
+static u64 bench_cdrom_read(u64 iterations) {
+    bench_write_disc();
+    memcpy(fake_bios, store_loop_program, sizeof(store_loop_program)); // Stays clear of CDROM_READ_BUFFER
+    static const u8 expected[] = { 3, 3, 1, 1, 1, 3, 2 };
+    for (u64 i = 0; i < iterations; i++) {
+        bench_reset_system();
+        PS1SYS.dma.dpcr |= 8 << (3 * 4); // Enable DMA3
+        ps1_system_insert_disc(bench_disc_path());
+        cdrom_num_interrupts = 0;
+        u8 status;
+
+        ps1_write8(CDROM_REG(CDROM_INDEX_STATUS), 1);
+        ps1_write8(CDROM_REG(CDROM_DATA_FIFO), 0x1F); // Interrupt enable
+        u32 msf = CDROM_READ_LBA + DISC_LEAD_IN_SECTORS;
+        const u8 setloc[] = { bcd(msf / 75 / 60), bcd(msf / 75 % 60), bcd(msf % 75) };
+        cdrom_command(0x02, setloc, sizeof(setloc)); // Setloc
+        cdrom_wait_interrupt(&status);
+        cdrom_acknowledge();
+        cdrom_command(0x06, NULL, 0); // ReadN
+        cdrom_wait_interrupt(&status);
+        cdrom_acknowledge();
+
+        for (u32 sector = 0; sector < CDROM_READ_SECTORS; sector++) {
+            if (cdrom_wait_interrupt(&status) == 1 && !(status & 0x20)) {
+                logfatal("CD-ROM INT1 without the reading bit in the status, %02X", status);
+            }
+            ps1_write8(CDROM_REG(CDROM_INDEX_STATUS), 0);
+            ps1_write8(CDROM_REG(CDROM_INTERRUPT), 0x80); // Want data
+            ps1_write32(CDROM_REG(DMA3_BASE_ADDR), CDROM_READ_BUFFER + sector * 0x800);
+            ps1_write32(CDROM_REG(DMA3_BLOCK_CTRL), 0x800 / 4);
+            ps1_write32(CDROM_REG(DMA3_CHANNEL_CTRL), 0x11000000);
+            cdrom_acknowledge();
+        }
+
+        cdrom_command(0x09, NULL, 0); // Pause
+        cdrom_wait_interrupt(&status);
+        cdrom_acknowledge();
+        cdrom_wait_interrupt(&status);
+        cdrom_acknowledge();
+
+        if (cdrom_num_interrupts != sizeof(expected) || memcmp(cdrom_interrupts, expected, sizeof(expected)) != 0) {
+            logfatal("Unexpected CD-ROM interrupt sequence, %d interrupts starting INT%d INT%d INT%d", cdrom_num_interrupts,
+                     cdrom_interrupts[0], cdrom_interrupts[1], cdrom_interrupts[2]);
+        }
+        for (u32 offset = 0; offset < CDROM_READ_SECTORS * 0x800; offset++) {
+            u8 byte = PS1SYS.mem.ram[(CDROM_READ_BUFFER & 0x1FFFFF) + offset];
+            if (byte != bench_disc_byte(CDROM_READ_LBA + offset / 0x800, offset % 0x800)) {
+                logfatal("CD-ROM DMA wrote the wrong byte at offset %u of the read", offset);
+            }
+        }
+    }
+    unlink(bench_disc_path());
+    return PS1SYS.cycles;
+}
+
+static const char* bench_cdz_path(u32 hunk_sectors) {
+    static char path[256];
+    const char* tmp = getenv("TMPDIR");
+    snprintf(path, sizeof(path), "%s/ps1_bench_%d_%u.cdz", tmp != NULL ? tmp : "/tmp", getpid(), hunk_sectors);
+    return path;
+}
+
+static void bench_check_cdz_sector(const disc_t* disc, u32 lba) {
+    u8 expected[DISC_SECTOR_SIZE];
+    bench_disc_sector(lba, expected);
+    const u8* sector = disc_sector(disc, lba);
+    if (memcmp(sector, expected, DISC_SECTOR_SIZE) != 0) {
+        logfatal("Compressed disc read back the wrong data for LBA %u", lba);
+    }
+}
+
+/*
+ * Compresses the synthetic disc with the default hunk size and with one that leaves a short last hunk, then reads
+ * every sector of each back the way the CD-ROM controller does, in order with prefetching, and again in a random
+ * order. Every sector has to match the BIN. One operation = both passes over both images.
+ */
+static u64 bench_cdz_read(u64 iterations) {
+    static const u32 hunk_sizes[] = { CDZ_DEFAULT_HUNK_SECTORS, 3 };
+    bench_write_disc();
+    disc_t* bin = disc_open(bench_disc_path());
+    for (int h = 0; h < sizeof(hunk_sizes) / sizeof(hunk_sizes[0]); h++) {
+        if (!cdz_write(bin, bench_cdz_path(hunk_sizes[h]), hunk_sizes[h])) {
+            logfatal("Unable to write %s", bench_cdz_path(hunk_sizes[h]));
+        }
+    }
+    disc_close(bin);
+    unlink(bench_disc_path());
+
+    u64 result = 0;
+    u32 seed = 1;
+    for (u64 i = 0; i < iterations; i++) {
+        for (int h = 0; h < sizeof(hunk_sizes) / sizeof(hunk_sizes[0]); h++) {
+            disc_t* disc = disc_open(bench_cdz_path(hunk_sizes[h]));
+            if (disc == NULL || disc->num_sectors != BENCH_DISC_SECTORS || disc->num_tracks != 1) {
+                logfatal("Unable to open %s as a one track disc of %d sectors", bench_cdz_path(hunk_sizes[h]), BENCH_DISC_SECTORS);
+            }
+            for (u32 lba = 0; lba < BENCH_DISC_SECTORS; lba++) {
+                disc_prefetch(disc, lba);
+                bench_check_cdz_sector(disc, lba);
+            }
+            for (u32 n = 0; n < BENCH_DISC_SECTORS; n++) {
+                seed = seed * 1103515245 + 12345;
+                bench_check_cdz_sector(disc, (seed >> 16) % BENCH_DISC_SECTORS);
+            }
+            result += disc_sector(disc, BENCH_DISC_SECTORS - 1)[24];
+            disc_close(disc);
+        }
+    }
+    for (int h = 0; h < sizeof(hunk_sizes) / sizeof(hunk_sizes[0]); h++) {
+        unlink(bench_cdz_path(hunk_sizes[h]));
+    }
+    return result;
+}
+
+// Just enough of an assembler to write the HLE benchmark's EXE
+#define HLE_EXE_BASE 0x80010000
+#define HLE_EXE_THREAD (HLE_EXE_BASE + 0xC00)
+#define HLE_EXE_DATA (HLE_EXE_BASE + 0x1000)
+#define HLE_EXE_SIZE 0x1800
+#define HLE_RESULTS 0x80040000
+#define HLE_READ_BUFFER 0x80050000
+#define HLE_READ_OFFSET 100
+
+static u8 hle_exe[HLE_EXE_SIZE];
+static u32 hle_exe_pc;
+static u32 hle_exe_data;
+
+static void asm_word(u32 word) {
+    u32 offset = hle_exe_pc - HLE_EXE_BASE;
+    hle_exe[offset] = word;
+    hle_exe[offset + 1] = word >> 8;
+    hle_exe[offset + 2] = word >> 16;
+    hle_exe[offset + 3] = word >> 24;
+    hle_exe_pc += 4;
+}
+
+static void asm_li(int rt, u32 value) {
+    asm_word(0x3C000000 | rt << 16 | value >> 16); // lui
+    asm_word(0x34000000 | rt << 21 | rt << 16 | (value & 0xFFFF)); // ori
+}
+
+static void asm_move(int rd, int rs) {
+    asm_word(rs << 21 | rd << 11 | 0x25); // or rd, rs, zero
+}
+
+static void asm_sw(int rt, int base, u16 offset) {
+    asm_word(0xAC000000 | base << 21 | rt << 16 | offset);
+}
+
+// jalr to the A0/B0/C0 vector with the function number in t1, as the BIOS call stubs do
+static void asm_call(u32 vector, u32 function) {
+    asm_li(10, vector);
+    asm_word(10 << 21 | 31 << 11 | 0x09);
+    asm_word(0x34090000 | function);
+}
+
+static void asm_store_v0(u16 offset) {
+    asm_li(8, HLE_RESULTS);
+    asm_sw(2, 8, offset);
+}
+
+static u32 asm_string(const char* string) {
+    u32 address = hle_exe_data;
+    strcpy((char*)hle_exe + (address - HLE_EXE_BASE), string);
+    hle_exe_data += (strlen(string) + 4) & ~3;
+    return address;
+}
+
+#define HLE_PRINTF_FORMAT "%s %d %04x|%8s|%f %S %d\n"
+#define HLE_PRINTF_OUTPUT "kernel 42 beef|  kernel|%f %S 7\n"
+
+static void hle_write_exe(const char* path) {
+    memset(hle_exe, 0x00, sizeof(hle_exe));
+    hle_exe_data = HLE_EXE_DATA;
+    hle_exe_pc = HLE_EXE_BASE;
+    // a0-a3 = 4-7, t0 = 8, s0-s3 = 16-19, sp = 29
+    asm_li(4, 0x80100000);
+    asm_li(5, 0x10000);
+    asm_call(0xA0, 0x39); // InitHeap
+    asm_li(4, 64);
+    asm_call(0xA0, 0x33); // malloc
+    asm_move(16, 2);
+    asm_store_v0(0x00);
+    asm_move(4, 16);
+    asm_li(5, asm_string("kernel"));
+    asm_li(6, 7);
+    asm_call(0xA0, 0x2A); // memcpy
+    asm_move(4, 16);
+    asm_call(0xA0, 0x1B); // strlen
+    asm_store_v0(0x04);
+    asm_li(4, asm_string(HLE_PRINTF_FORMAT));
+    asm_move(5, 16);
+    asm_li(6, 42);
+    asm_li(7, 0xBEEF);
+    asm_sw(16, 29, 16);
+    asm_li(8, 7);
+    asm_sw(8, 29, 20);
+    asm_call(0xA0, 0x3F); // printf
+    asm_store_v0(0x08);
+
+    asm_li(4, 0xF2000003); // VBlank
+    asm_li(5, 2);
+    asm_li(6, 0x2000);
+    asm_li(7, 0);
+    asm_call(0xB0, 0x08); // OpenEvent
+    asm_move(17, 2);
+    asm_move(4, 17);
+    asm_call(0xB0, 0x0C); // EnableEvent
+    asm_move(4, 17);
+    asm_call(0xB0, 0x0A); // WaitEvent
+    asm_store_v0(0x0C);
+
+    asm_li(4, HLE_EXE_THREAD);
+    asm_li(5, 0x801F0000);
+    asm_li(6, 0);
+    asm_call(0xB0, 0x0E); // OpenThread
+    asm_move(4, 2);
+    asm_call(0xB0, 0x10); // ChangeThread, comes back when the thread changes back
+    asm_store_v0(0x10);
+
+    asm_li(4, asm_string("cdrom:\\" BENCH_DISC_FILE));
+    asm_li(5, 1);
+    asm_call(0xA0, 0x00); // open
+    asm_move(19, 2);
+    asm_store_v0(0x14);
+    asm_move(4, 19);
+    asm_li(5, HLE_READ_OFFSET);
+    asm_li(6, 0);
+    asm_call(0xA0, 0x01); // lseek
+    asm_store_v0(0x18);
+    asm_move(4, 19);
+    asm_li(5, HLE_READ_BUFFER);
+    asm_li(6, 4000);
+    asm_call(0xA0, 0x02); // read
+    asm_store_v0(0x1C);
+    asm_move(4, 19);
+    asm_call(0xA0, 0x04); // close
+    asm_li(4, 0);
+    asm_call(0xA0, 0x3A); // _exit
+    if (hle_exe_pc > HLE_EXE_THREAD) {
+        logfatal("HLE benchmark EXE overflowed into its thread");
+    }
+
+    hle_exe_pc = HLE_EXE_THREAD;
+    asm_li(8, 0xC0DE);
+    asm_li(9, HLE_RESULTS);
+    asm_sw(8, 9, 0x20);
+    asm_li(4, 0xFF000000); // Thread 0
+    asm_call(0xB0, 0x10); // ChangeThread
+    asm_word(0x08000000 | ((hle_exe_pc >> 2) & 0x3FFFFFF)); // j self
+    asm_word(0);
+
+    // No stack in the header, the EXE has to get the default one
+    u8 header[EXE_HEADER_SIZE] = "PS-X EXE";
+    u32 fields[] = { HLE_EXE_BASE, 0, HLE_EXE_BASE, HLE_EXE_SIZE };
+    memcpy(header + 0x10, fields, sizeof(fields));
+    FILE* fp = fopen(path, "wb");
+    if (fp == NULL) {
+        logfatal("Unable to create %s", path);
+    }
+    fwrite(header, sizeof(header), 1, fp);
+    fwrite(hle_exe, sizeof(hle_exe), 1, fp);
+    fclose(fp);
+}
+
+static char hle_tty[256];
+static size_t hle_tty_length;
+
+static void hle_tty_putchar(u8 c) {
+    if (hle_tty_length < sizeof(hle_tty) - 1) {
+        hle_tty[hle_tty_length++] = c;
+    }
+}
+
+static void hle_expect(u32 offset, u32 expected, const char* what) {
+    u32 value = ps1_read32(HLE_RESULTS + offset);
+    if (value != expected) {
+        logfatal("HLE %s returned 0x%08X, expected 0x%08X", what, value, expected);
+    }
+}
+
+// Boots an EXE on the HLE BIOS that goes through the C library, the heap, events, threads and files on the disc, then
+// checks its TTY output and what it left in RAM. One operation = one boot.
+static u64 bench_hle_bios(u64 iterations) {
+    char exe_path[256];
+    snprintf(exe_path, sizeof(exe_path), "%s.exe", bench_disc_path());
+    bench_write_disc();
+    hle_write_exe(exe_path);
+    for (u64 i = 0; i < iterations; i++) {
+        ps1_system_init_with_bios(HLE_BIOS_NAME);
+        ps1_system_insert_disc(bench_disc_path());
+        ps1_system_load_exe(exe_path, true);
+        hle_tty_length = 0;
+        PS1SYS.tty_handler = hle_tty_putchar;
+        for (int frame = 0; frame < 3; frame++) {
+            ps1_system_run_frame();
+        }
+        hle_tty[hle_tty_length] = '\0';
+
+        if (strcmp(hle_tty, HLE_PRINTF_OUTPUT) != 0) {
+            logfatal("HLE TTY output was \"%s\"", hle_tty);
+        }
+        u32 heap = ps1_read32(HLE_RESULTS);
+        if (heap < 0x80100000 || heap >= 0x80110000) {
+            logfatal("HLE malloc returned 0x%08X, outside the heap", heap);
+        }
+        for (u32 j = 0; j < 7; j++) {
+            if (ps1_read8(heap + j) != (u8)"kernel"[j]) {
+                logfatal("HLE memcpy didn't copy the string");
+            }
+        }
+        if (ps1_read32(EXE_DEFAULT_SP + 16) != heap) {
+            logfatal("printf's stack arguments weren't on the default stack");
+        }
+        hle_expect(0x04, 6, "strlen");
+        hle_expect(0x08, strlen(HLE_PRINTF_OUTPUT), "printf");
+        hle_expect(0x0C, 1, "WaitEvent");
+        hle_expect(0x10, 1, "ChangeThread");
+        hle_expect(0x14, 2, "open");
+        hle_expect(0x18, HLE_READ_OFFSET, "lseek");
+        hle_expect(0x1C, BENCH_DISC_FILE_SIZE - HLE_READ_OFFSET, "read");
+        hle_expect(0x20, 0xC0DE, "the thread");
+        for (u32 j = 0; j < BENCH_DISC_FILE_SIZE - HLE_READ_OFFSET; j++) {
+            u32 offset = HLE_READ_OFFSET + j;
+            if (ps1_read8(HLE_READ_BUFFER + j) != bench_disc_byte(BENCH_DISC_FILE_LBA + offset / 0x800, offset % 0x800)) {
+                logfatal("HLE read got the wrong byte at file offset %u", offset);
+            }
+        }
+    }
+    ps1_system_init_with_bios(HLE_BIOS_NAME); // Closes the disc
+    unlink(exe_path);
+    unlink(bench_disc_path());
+    return PS1CPU.pc;
+}
+
+// Boots the real BIOS for `iterations` cycles
+static u64 bench_boot(u64 iterations) {
+    ps1_system_init();
+    ps1_system_run_cycles(iterations);
+    return PS1CPU.pc;
+}
+
+static bench_t benches[] = {
+        { "decode",            bench_decode,            10000000, 100 },
+        { "disassemble",       bench_disassemble,       1000000,  1000 },
+        { "virt_to_phys",      bench_virt_to_phys,      10000000, 50 },
+        { "read32_ram",        bench_read32_ram,        10000000, 100 },
+        { "read32_bios",       bench_read32_bios,       10000000, 100 },
+        { "read32_i_stat",     bench_read32_i_stat,     10000000, 100 },
+        { "read32_gpustat",    bench_read32_gpustat,    10000000, 100 },
+        { "read32_dma",        bench_read32_dma,        10000000, 100 },
+        { "write32_ram",       bench_write32_ram,       10000000, 100 },
+        { "write32_i_mask",    bench_write32_i_mask,    10000000, 100 },
+        { "gp0_vram_copy",     bench_gp0_vram_copy,     10000000, 100 },
+        { "dma_otc",           bench_dma_otc,           10000000, 100 },
+        { "dma_gpu",           bench_dma_gpu,           10000000, 200 },
+        { "dma_gpu_list",      bench_dma_gpu_list,      10,       0 },
+        { "save_state",        bench_save_state,        100,      50000000 },
+        { "load_state",        bench_load_state,        100,      20000000 },
+        { "state_resume",      bench_state_resume,      2,        0 },
+        { "delta_save",        bench_delta_save,        1000,     2000000 },
+        { "lz_compress",       bench_lz_compress,       100000000, 5 },
+        { "lz_decompress",     bench_lz_decompress,     100000000, 5 },
+        { "rewind_capture",    bench_rewind_capture,    1000,     5000000 },
+        { "rewind_step_back",  bench_rewind_step_back,  1000,     0 },
+        { "run_ahead",         bench_run_ahead,         10,       0 },
+        { "instances",         bench_instances,         20,       0 },
+        { "cdrom_read",        bench_cdrom_read,        10,       0 },
+        { "cdz_read",          bench_cdz_read,          20,       0 },
+        { "hle_bios",          bench_hle_bios,          5,        0 },
+        { "boot_bios_10m",     bench_boot,              10000000, 0 },
+        { "boot_bios_100m",    bench_boot,              100000000, 0 },
+};
+#define NUM_BENCHES (sizeof(benches) / sizeof(benches[0]))
+
+static int run_bench(bench_t* bench) {
+    if (bench->run == bench_boot) {
+        if (access(BENCH_BIOS_PATH, R_OK) != 0) {
+            printf("%-20s skipped, %s not found\n", bench->name, BENCH_BIOS_PATH);
+            return BENCH_SKIPPED;
+        }
+    } else {
+        bench_reset_system();
+    }
+
+    u64 start = timing_now_ns();
+    bench_sink = bench->run(bench->iterations);
+    u64 elapsed = timing_now_ns() - start;
+
+    double ns_per_op = (double)elapsed / bench->iterations;
+    printf("%-20s %12.3f ns/op %10.2f Mops/s\n", bench->name, ns_per_op, 1e3 / ns_per_op);
+    if (bench->max_ns_per_op > 0 && ns_per_op > bench->max_ns_per_op) {
+        printf("%-20s REGRESSION: over the limit of %.1f ns/op\n", bench->name, bench->max_ns_per_op);
+        return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    log_set_verbosity(0);
+
+    if (argc > 1 && strcmp(argv[1], "--list") == 0) {
+        for (int i = 0; i < NUM_BENCHES; i++) {
+            printf("%s\n", benches[i].name);
+        }
+        return 0;
+    }
+
+    int result = 0;
+    bool found = false;
+    for (int i = 0; i < NUM_BENCHES; i++) {
+        if (argc > 1 && strcmp(argv[1], benches[i].name) != 0) {
+            continue;
+        }
+        found = true;
+        int bench_result = run_bench(&benches[i]);
+        if (bench_result != 0 && (result == 0 || result == BENCH_SKIPPED)) {
+            result = bench_result;
+        }
+    }
+
+    if (!found) {
+        fprintf(stderr, "Unknown benchmark: %s\n", argv[1]);
+        return 1;
+    }
+    // Only report a skip when everything requested was skipped
+    return argc == 1 && result == BENCH_SKIPPED ? 0 : result;
+}
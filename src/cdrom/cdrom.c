@@ -0,0 +1,523 @@
+#include "cdrom.h"
+
+#include <string.h>
+
+#include <log.h>
+#include <mem/addresses.h>
+#include <mem/ps1system.h>
+#include <cdrom/disc.h>
+
+// Status byte, the first byte of most responses
+#define STAT_ERROR      0x01
+#define STAT_MOTOR      0x02
+#define STAT_READING    0x20
+#define STAT_SEEKING    0x40
+
+#define MODE_DOUBLE_SPEED 0x80
+#define MODE_RAW_SECTORS  0x20 // 0x924 bytes from the header on instead of 0x800 bytes of data
+
+#define INT1_DATA_READY  1
+#define INT2_COMPLETE    2
+#define INT3_ACKNOWLEDGE 3
+#define INT5_ERROR       5
+
+#define ERROR_INVALID_COMMAND   0x40
+#define ERROR_WRONG_PARAMETERS  0x20
+#define ERROR_NO_DISC           0x80
+
+#define CDROM_IRQ (1 << 2)
+
+// Roughly how long the controller takes, in CPU cycles
+#define DELAY_ACKNOWLEDGE 50000
+#define DELAY_GETID       20000
+#define DELAY_INIT        120000
+#define DELAY_SEEK        100000
+#define SECTOR_CYCLES_SINGLE_SPEED (33868800 / 75)
+
+#define CDROM PS1SYS.cdrom
+
+INLINE u8 bcd(u32 value) {
+    return ((value / 10) << 4) | (value % 10);
+}
+
+INLINE u32 from_bcd(u8 value) {
+    return (value >> 4) * 10 + (value & 0xF);
+}
+
+INLINE u32 sector_cycles() {
+    return SECTOR_CYCLES_SINGLE_SPEED >> ((CDROM.mode & MODE_DOUBLE_SPEED) ? 1 : 0);
+}
+
+// BCD minutes, seconds and frames
+static void to_msf(u32 frames, u8* msf) {
+    msf[0] = bcd(frames / (60 * 75));
+    msf[1] = bcd((frames / 75) % 60);
+    msf[2] = bcd(frames % 75);
+}
+
+// Absolute time of `lba`
+static void lba_to_msf(u32 lba, u8* msf) {
+    to_msf(lba + DISC_LEAD_IN_SECTORS, msf);
+}
+
+static void reschedule() {
+    u64 next = UINT64_MAX;
+    // Nothing can be delivered until the current interrupt is acknowledged
+    if (CDROM.interrupt_flag == 0) {
+        for (int i = 0; i < CDROM.num_pending; i++) {
+            if (CDROM.pending[i].cycle < next) {
+                next = CDROM.pending[i].cycle;
+            }
+        }
+        if (CDROM.reading && CDROM.next_sector_cycle < next) {
+            next = CDROM.next_sector_cycle;
+        }
+    }
+    CDROM.next_event_cycle = next;
+}
+
+static void update_irq() {
+    if (CDROM.interrupt_flag & CDROM.interrupt_enable) {
+        PS1SYS.i_stat |= CDROM_IRQ;
+    }
+}
+
+static cdrom_response_t* queue_response(u8 interrupt, u32 delay, bool first) {
+    if (CDROM.num_pending == CDROM_MAX_PENDING) {
+        logwarn("CD-ROM response queue is full, dropping the oldest response");
+        memmove(&CDROM.pending[0], &CDROM.pending[1], (CDROM_MAX_PENDING - 1) * sizeof(cdrom_response_t));
+        CDROM.num_pending--;
+    }
+    cdrom_response_t* response = &CDROM.pending[CDROM.num_pending++];
+    memset(response, 0x00, sizeof(cdrom_response_t));
+    response->cycle = PS1SYS.cycles + delay;
+    response->interrupt = interrupt;
+    response->first = first;
+    return response;
+}
+
+INLINE void push(cdrom_response_t* response, u8 value) {
+    response->data[response->size++] = value;
+}
+
+// First response, the status byte plus any extra bytes the command returns
+static cdrom_response_t* acknowledge() {
+    cdrom_response_t* response = queue_response(INT3_ACKNOWLEDGE, DELAY_ACKNOWLEDGE, true);
+    push(response, CDROM.status);
+    return response;
+}
+
+static void complete(u32 delay) {
+    cdrom_response_t* response = queue_response(INT2_COMPLETE, DELAY_ACKNOWLEDGE + delay, false);
+    push(response, CDROM.status);
+}
+
+static void error(u8 code) {
+    cdrom_response_t* response = queue_response(INT5_ERROR, DELAY_ACKNOWLEDGE, true);
+    push(response, CDROM.status | STAT_ERROR);
+    push(response, code);
+}
+
+static void deliver(const cdrom_response_t* response) {
+    memcpy(CDROM.response, response->data, response->size);
+    CDROM.response_size = response->size;
+    CDROM.response_read = 0;
+    CDROM.interrupt_flag = response->interrupt;
+    update_irq();
+}
+
+static bool have_data_disc() {
+    return PS1SYS.disc != NULL && PS1SYS.disc->tracks[0].type == DISC_TRACK_DATA;
+}
+
+// The region letter from the license string in sector 4
+static u8 disc_region() {
+    const u8* sector = disc_sector(PS1SYS.disc, 4);
+    char license[0x80];
+    memcpy(license, sector + 24, sizeof(license) - 1);
+    license[sizeof(license) - 1] = '\0';
+    if (strstr(license, "Europe") != NULL) {
+        return 'E';
+    } else if (strstr(license, "Inc.") != NULL) {
+        return 'I';
+    }
+    return 'A';
+}
+
+static void start_reading() {
+    if (CDROM.setloc_pending) {
+        CDROM.read_lba = CDROM.setloc_lba;
+        CDROM.setloc_pending = false;
+    }
+    CDROM.status = (CDROM.status & ~STAT_SEEKING) | STAT_MOTOR | STAT_READING;
+    CDROM.reading = true;
+    disc_prefetch(PS1SYS.disc, CDROM.read_lba);
+    CDROM.next_sector_cycle = PS1SYS.cycles + DELAY_ACKNOWLEDGE + sector_cycles();
+}
+
+static void stop_reading() {
+    CDROM.reading = false;
+    CDROM.status &= ~(STAT_READING | STAT_SEEKING);
+}
+
+// How many parameters each command takes, -1 for ones that take a variable number
+static int parameter_count(u8 command) {
+    switch (command) {
+        case 0x02: return 3; // Setloc
+        case 0x0D: return 2; // Setfilter
+        case 0x0E: return 1; // Setmode
+        case 0x14: return 1; // GetTD
+        case 0x19: return -1; // Test
+        case 0x03: return -1; // Play
+        default:   return 0;
+    }
+}
+
+static void execute(u8 command) {
+    int expected = parameter_count(command);
+    if (expected >= 0 && CDROM.num_parameters != expected) {
+        logwarn("CD-ROM command %02Xh with %d parameters, expected %d", command, CDROM.num_parameters, expected);
+        error(ERROR_WRONG_PARAMETERS);
+        CDROM.num_parameters = 0;
+        return;
+    }
+    const u8* p = CDROM.parameters;
+    switch (command) {
+        case 0x01: // GetStat
+            acknowledge();
+            break;
+        case 0x02: // Setloc
+            CDROM.setloc_lba = (from_bcd(p[0]) * 60 + from_bcd(p[1])) * 75 + from_bcd(p[2]) - DISC_LEAD_IN_SECTORS;
+            CDROM.setloc_pending = true;
+            acknowledge();
+            break;
+        case 0x03: // Play
+        case 0x04: // Forward
+        case 0x05: { // Backward
+            static _Thread_local bool warned = false;
+            if (!warned) {
+                logwarn("CD-ROM audio playback isn't supported");
+                warned = true;
+            }
+            acknowledge();
+            break;
+        }
+        case 0x06: // ReadN
+        case 0x1B: // ReadS
+            if (!have_data_disc()) {
+                error(ERROR_NO_DISC);
+                break;
+            }
+            acknowledge();
+            start_reading();
+            break;
+        case 0x07: // MotorOn
+            CDROM.status |= STAT_MOTOR;
+            acknowledge();
+            complete(DELAY_SEEK);
+            break;
+        case 0x08: // Stop
+            stop_reading();
+            acknowledge();
+            CDROM.status &= ~STAT_MOTOR;
+            complete(DELAY_SEEK);
+            break;
+        case 0x09: // Pause
+            acknowledge();
+            stop_reading();
+            complete(sector_cycles());
+            break;
+        case 0x0A: // Init
+            CDROM.mode = 0;
+            stop_reading();
+            CDROM.status = PS1SYS.disc != NULL ? STAT_MOTOR : 0;
+            acknowledge();
+            complete(DELAY_INIT);
+            break;
+        case 0x0B: // Mute
+        case 0x0C: // Demute
+            acknowledge();
+            break;
+        case 0x0D: // Setfilter
+            CDROM.filter_file = p[0];
+            CDROM.filter_channel = p[1];
+            acknowledge();
+            break;
+        case 0x0E: // Setmode
+            CDROM.mode = p[0];
+            acknowledge();
+            break;
+        case 0x0F: { // Getparam
+            cdrom_response_t* response = acknowledge();
+            push(response, CDROM.mode);
+            push(response, 0x00);
+            push(response, CDROM.filter_file);
+            push(response, CDROM.filter_channel);
+            break;
+        }
+        case 0x10: { // GetlocL, the header and subheader of the last sector
+            if (!CDROM.sector_ready) {
+                error(ERROR_INVALID_COMMAND);
+                break;
+            }
+            cdrom_response_t* response = queue_response(INT3_ACKNOWLEDGE, DELAY_ACKNOWLEDGE, true);
+            const u8* sector = disc_sector(PS1SYS.disc, CDROM.sector_lba);
+            for (int i = 12; i < 20; i++) {
+                push(response, sector[i]);
+            }
+            break;
+        }
+        case 0x11: { // GetlocP
+            if (PS1SYS.disc == NULL) {
+                error(ERROR_NO_DISC);
+                break;
+            }
+            u32 lba = CDROM.sector_ready ? CDROM.sector_lba : CDROM.read_lba;
+            int track = disc_track_at(PS1SYS.disc, lba);
+            u32 track_start = PS1SYS.disc->tracks[track - 1].start;
+            u8 relative[3];
+            u8 absolute[3];
+            // Relative time counts down to the start of the track in the pregap
+            to_msf(lba >= track_start ? lba - track_start : track_start - lba, relative);
+            lba_to_msf(lba, absolute);
+            cdrom_response_t* response = queue_response(INT3_ACKNOWLEDGE, DELAY_ACKNOWLEDGE, true);
+            push(response, bcd(track));
+            push(response, lba >= track_start ? 0x01 : 0x00);
+            for (int i = 0; i < 3; i++) {
+                push(response, relative[i]);
+            }
+            for (int i = 0; i < 3; i++) {
+                push(response, absolute[i]);
+            }
+            break;
+        }
+        case 0x13: { // GetTN
+            if (PS1SYS.disc == NULL) {
+                error(ERROR_NO_DISC);
+                break;
+            }
+            cdrom_response_t* response = acknowledge();
+            push(response, 0x01);
+            push(response, bcd(PS1SYS.disc->num_tracks));
+            break;
+        }
+        case 0x14: { // GetTD
+            u32 track = from_bcd(p[0]);
+            if (PS1SYS.disc == NULL || track > (u32)PS1SYS.disc->num_tracks) {
+                error(PS1SYS.disc == NULL ? ERROR_NO_DISC : 0x10);
+                break;
+            }
+            u8 msf[3];
+            lba_to_msf(track == 0 ? PS1SYS.disc->num_sectors : PS1SYS.disc->tracks[track - 1].start, msf);
+            cdrom_response_t* response = acknowledge();
+            push(response, msf[0]);
+            push(response, msf[1]);
+            break;
+        }
+        case 0x15: // SeekL
+        case 0x16: // SeekP
+            if (PS1SYS.disc == NULL) {
+                error(ERROR_NO_DISC);
+                break;
+            }
+            stop_reading();
+            CDROM.read_lba = CDROM.setloc_lba;
+            CDROM.setloc_pending = false;
+            CDROM.status |= STAT_MOTOR;
+            disc_prefetch(PS1SYS.disc, CDROM.read_lba);
+            acknowledge();
+            complete(DELAY_SEEK);
+            break;
+        case 0x19: // Test
+            if (CDROM.num_parameters == 1 && p[0] == 0x20) {
+                // Date and version of the controller's firmware
+                cdrom_response_t* response = queue_response(INT3_ACKNOWLEDGE, DELAY_ACKNOWLEDGE, true);
+                push(response, 0x94);
+                push(response, 0x09);
+                push(response, 0x19);
+                push(response, 0xC0);
+            } else {
+                logwarn("CD-ROM Test subfunction %02Xh isn't supported", CDROM.num_parameters > 0 ? p[0] : 0);
+                error(ERROR_INVALID_COMMAND);
+            }
+            break;
+        case 0x1A: { // GetID
+            acknowledge();
+            cdrom_response_t* response;
+            if (PS1SYS.disc == NULL) {
+                response = queue_response(INT5_ERROR, DELAY_ACKNOWLEDGE + DELAY_GETID, false);
+                push(response, 0x08);
+                push(response, 0x40);
+                for (int i = 0; i < 6; i++) {
+                    push(response, 0x00);
+                }
+            } else {
+                response = queue_response(INT2_COMPLETE, DELAY_ACKNOWLEDGE + DELAY_GETID, false);
+                push(response, CDROM.status);
+                push(response, 0x00);
+                push(response, 0x20); // Mode 2
+                push(response, 0x00);
+                push(response, 'S');
+                push(response, 'C');
+                push(response, 'E');
+                push(response, disc_region());
+            }
+            break;
+        }
+        case 0x1E: // ReadTOC
+            acknowledge();
+            complete(DELAY_INIT);
+            break;
+        default:
+            logwarn("CD-ROM command %02Xh isn't supported", command);
+            error(ERROR_INVALID_COMMAND);
+            break;
+    }
+    CDROM.num_parameters = 0;
+}
+
+// Request register, BFRD loads the data FIFO with the last sector read
+static void request(u8 value) {
+    if (!(value & 0x80)) {
+        CDROM.data_offset = CDROM.data_end = 0;
+        return;
+    }
+    if (!CDROM.sector_ready) {
+        return;
+    }
+    if (CDROM.mode & MODE_RAW_SECTORS) {
+        // Everything after the sync bytes
+        CDROM.data_offset = 12;
+        CDROM.data_end = 12 + 0x924;
+    } else {
+        // Mode 2 sectors have an 8 byte subheader between the header and the data
+        const u8* sector = disc_sector(PS1SYS.disc, CDROM.sector_lba);
+        CDROM.data_offset = disc_data_offset(sector);
+        CDROM.data_end = CDROM.data_offset + 0x800;
+    }
+}
+
+void cdrom_reset() {
+    memset(&CDROM, 0x00, sizeof(CDROM));
+    CDROM.status = PS1SYS.disc != NULL ? STAT_MOTOR : 0;
+    CDROM.next_event_cycle = UINT64_MAX;
+}
+
+u8 cdrom_read(u32 address) {
+    switch (address) {
+        case CDROM_INDEX_STATUS: {
+            u8 value = CDROM.index;
+            value |= CDROM.num_parameters == 0 ? 0x08 : 0;
+            value |= CDROM.num_parameters < CDROM_FIFO_SIZE ? 0x10 : 0;
+            value |= CDROM.response_read < CDROM.response_size ? 0x20 : 0;
+            value |= CDROM.data_offset < CDROM.data_end ? 0x40 : 0;
+            for (int i = 0; i < CDROM.num_pending; i++) {
+                if (CDROM.pending[i].first) {
+                    value |= 0x80; // Busy until the command is acknowledged
+                }
+            }
+            return value;
+        }
+        case CDROM_RESPONSE_FIFO:
+            if (CDROM.response_read < CDROM.response_size) {
+                return CDROM.response[CDROM.response_read++];
+            }
+            return 0x00;
+        case CDROM_DATA_FIFO:
+            if (CDROM.data_offset < CDROM.data_end) {
+                return disc_sector(PS1SYS.disc, CDROM.sector_lba)[CDROM.data_offset++];
+            }
+            return 0x00;
+        case CDROM_INTERRUPT:
+            if (CDROM.index & 1) {
+                return CDROM.interrupt_flag | 0xE0;
+            }
+            return CDROM.interrupt_enable | 0xE0;
+        default:
+            logfatal("CD-ROM read from %08X", address);
+    }
+}
+
+void cdrom_write(u32 address, u8 value) {
+    switch (address) {
+        case CDROM_INDEX_STATUS:
+            CDROM.index = value & 3;
+            break;
+        case CDROM_RESPONSE_FIFO:
+            if (CDROM.index == 0) {
+                execute(value);
+                reschedule();
+            }
+            // The other indexes are the XA-ADPCM sound map and audio volume, there's no CD audio
+            break;
+        case CDROM_DATA_FIFO:
+            if (CDROM.index == 0) {
+                if (CDROM.num_parameters < CDROM_FIFO_SIZE) {
+                    CDROM.parameters[CDROM.num_parameters++] = value;
+                }
+            } else if (CDROM.index == 1) {
+                CDROM.interrupt_enable = value & 0x1F;
+                update_irq();
+            }
+            break;
+        case CDROM_INTERRUPT:
+            if (CDROM.index == 0) {
+                request(value);
+            } else if (CDROM.index == 1) {
+                CDROM.interrupt_flag &= ~(value & 0x1F);
+                if (value & 0x40) {
+                    CDROM.num_parameters = 0;
+                }
+                // Anything that was held back waiting for the acknowledge can go now
+                if (CDROM.interrupt_flag == 0) {
+                    reschedule();
+                    if (PS1SYS.cycles >= CDROM.next_event_cycle) {
+                        cdrom_event();
+                    }
+                }
+            }
+            break;
+        default:
+            logfatal("CD-ROM write to %08X = %02X", address, value);
+    }
+}
+
+void cdrom_event() {
+    if (CDROM.interrupt_flag != 0) {
+        reschedule();
+        return;
+    }
+    // Responses first, a sector that's due at the same time waits for the next acknowledge
+    int due = -1;
+    for (int i = 0; i < CDROM.num_pending; i++) {
+        if (CDROM.pending[i].cycle <= PS1SYS.cycles && (due < 0 || CDROM.pending[i].cycle < CDROM.pending[due].cycle)) {
+            due = i;
+        }
+    }
+    if (due >= 0) {
+        deliver(&CDROM.pending[due]);
+        CDROM.num_pending--;
+        memmove(&CDROM.pending[due], &CDROM.pending[due + 1], (CDROM.num_pending - due) * sizeof(cdrom_response_t));
+    } else if (CDROM.reading && CDROM.next_sector_cycle <= PS1SYS.cycles) {
+        CDROM.sector_lba = CDROM.read_lba++;
+        CDROM.sector_ready = true;
+        CDROM.next_sector_cycle += sector_cycles();
+        disc_prefetch(PS1SYS.disc, CDROM.read_lba);
+        cdrom_response_t response = { .interrupt = INT1_DATA_READY, .size = 1, .data = { CDROM.status } };
+        deliver(&response);
+    }
+    reschedule();
+}
+
+void cdrom_dma_read(u8* dst, u32 size) {
+    u32 available = CDROM.data_end - CDROM.data_offset;
+    u32 copied = size < available ? size : available;
+    if (copied > 0) {
+        memcpy(dst, disc_sector(PS1SYS.disc, CDROM.sector_lba) + CDROM.data_offset, copied);
+        CDROM.data_offset += copied;
+    }
+    if (copied < size) {
+        logwarn("CD-ROM DMA of %u bytes with only %u in the data FIFO", size, available);
+        memset(dst + copied, 0x00, size - copied);
+    }
+}
@@ -0,0 +1,64 @@
+#ifndef PS1_CDROM_H
+#define PS1_CDROM_H
+
+#include <util.h>
+#include <stdbool.h>
+
+#define CDROM_FIFO_SIZE 16
+// Responses that can be waiting to be delivered at once: a command's first and second response plus one spare
+#define CDROM_MAX_PENDING 4
+
+typedef struct cdrom_response {
+    u64 cycle;   // When it's due
+    u8 interrupt; // INT1-5
+    bool first;  // The command is busy until its first response is delivered
+    u8 size;
+    u8 data[CDROM_FIFO_SIZE];
+} cdrom_response_t;
+
+typedef struct cdrom_state {
+    u8 index;
+    u8 interrupt_enable;
+    u8 interrupt_flag;
+    u8 status;
+    u8 mode;
+    u8 filter_file;
+    u8 filter_channel;
+
+    u8 parameters[CDROM_FIFO_SIZE];
+    u8 num_parameters;
+
+    u8 response[CDROM_FIFO_SIZE];
+    u8 response_size;
+    u8 response_read;
+
+    cdrom_response_t pending[CDROM_MAX_PENDING];
+    u8 num_pending;
+
+    u32 setloc_lba;
+    bool setloc_pending;
+    // Next sector to read, and when it'll be ready while reading
+    u32 read_lba;
+    bool reading;
+    u64 next_sector_cycle;
+
+    // The last sector read. The data FIFO is the window [data_offset, data_end) of it, sector data is never copied
+    // anywhere but RAM
+    u32 sector_lba;
+    bool sector_ready;
+    u16 data_offset;
+    u16 data_end;
+
+    // The earliest of the pending responses and the next sector, cdrom_event() runs once the cycle counter reaches it
+    u64 next_event_cycle;
+} cdrom_state_t;
+
+void cdrom_reset();
+u8 cdrom_read(u32 address);
+void cdrom_write(u32 address, u8 value);
+// Delivers responses and sectors that are due
+void cdrom_event();
+// DMA3, copies `size` bytes of the data FIFO straight from the disc image to `dst`
+void cdrom_dma_read(u8* dst, u32 size);
+
+#endif //PS1_CDROM_H
@@ -0,0 +1,361 @@
+#include "cdz.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <log.h>
+#include <lz.h>
+
+#define CDZ_CACHE_HUNKS 32
+// 4 hunks of 8 sectors is about a fifth of a second of reading at double speed
+#define CDZ_READ_AHEAD_HUNKS 4
+#define CDZ_WORKERS 2
+
+typedef enum cdz_slot_state {
+    SLOT_EMPTY,
+    SLOT_QUEUED,
+    SLOT_DECOMPRESSING,
+    SLOT_READY
+} cdz_slot_state_t;
+
+typedef struct cdz_slot {
+    cdz_slot_state_t state;
+    u32 hunk;
+    u64 last_used;
+    u8* data;
+} cdz_slot_t;
+
+struct cdz {
+    const u8* file;
+    size_t file_size;
+    const cdz_header_t* header;
+    const cdz_hunk_t* hunks;
+    // Bytes in a full hunk
+    u32 hunk_size;
+
+    // Everything from here to the workers is protected by the lock. Workers only ever decompress slots that are
+    // queued, only the emulation thread picks slots to reuse, so a slot it's reading from can't change under it.
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+    pthread_cond_t done;
+    cdz_slot_t slots[CDZ_CACHE_HUNKS];
+    u64 clock;
+    // Slots waiting for a worker, oldest first
+    int queue[CDZ_CACHE_HUNKS];
+    int queue_size;
+    bool stopping;
+    pthread_t workers[CDZ_WORKERS];
+
+    // Emulation thread only: the hunk the last sector came from, most reads are from the same one
+    const cdz_slot_t* last_slot;
+    u32 last_prefetch;
+    u64 read_ahead;
+    u64 on_demand;
+    u64 waits;
+};
+
+static u32 hunk_sectors(const cdz_t* cdz, u32 hunk) {
+    u32 first = hunk * cdz->header->hunk_sectors;
+    u32 remaining = cdz->header->num_sectors - first;
+    return remaining < cdz->header->hunk_sectors ? remaining : cdz->header->hunk_sectors;
+}
+
+static void decompress(const cdz_t* cdz, u32 hunk, u8* dst) {
+    const cdz_hunk_t* entry = &cdz->hunks[hunk];
+    size_t expected = (size_t)hunk_sectors(cdz, hunk) * DISC_SECTOR_SIZE;
+    const u8* src = cdz->file + entry->offset;
+    if (entry->flags & CDZ_HUNK_STORED) {
+        memcpy(dst, src, expected);
+    } else if (lz_decompress(src, entry->size, dst, cdz->hunk_size) != expected) {
+        logwarn("Hunk %u of the compressed disc is corrupt, its sectors will read as zeroes", hunk);
+        memset(dst, 0x00, expected);
+    }
+}
+
+static void* worker_main(void* arg) {
+    cdz_t* cdz = arg;
+    pthread_mutex_lock(&cdz->lock);
+    while (true) {
+        while (!cdz->stopping && cdz->queue_size == 0) {
+            pthread_cond_wait(&cdz->work, &cdz->lock);
+        }
+        if (cdz->stopping) {
+            break;
+        }
+        cdz_slot_t* slot = &cdz->slots[cdz->queue[0]];
+        memmove(&cdz->queue[0], &cdz->queue[1], --cdz->queue_size * sizeof(int));
+        slot->state = SLOT_DECOMPRESSING;
+        pthread_mutex_unlock(&cdz->lock);
+
+        decompress(cdz, slot->hunk, slot->data);
+
+        pthread_mutex_lock(&cdz->lock);
+        slot->state = SLOT_READY;
+        pthread_cond_broadcast(&cdz->done);
+    }
+    pthread_mutex_unlock(&cdz->lock);
+    return NULL;
+}
+
+static int find_slot(const cdz_t* cdz, u32 hunk) {
+    for (int i = 0; i < CDZ_CACHE_HUNKS; i++) {
+        if (cdz->slots[i].state != SLOT_EMPTY && cdz->slots[i].hunk == hunk) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// An empty slot or the least recently used ready one, -1 when every slot is waiting on a worker
+static int claim_slot(cdz_t* cdz) {
+    int victim = -1;
+    for (int i = 0; i < CDZ_CACHE_HUNKS; i++) {
+        const cdz_slot_t* slot = &cdz->slots[i];
+        if (slot->state == SLOT_EMPTY) {
+            victim = i;
+            break;
+        }
+        if (slot->state == SLOT_READY && (victim < 0 || slot->last_used < cdz->slots[victim].last_used)) {
+            victim = i;
+        }
+    }
+    if (victim >= 0 && &cdz->slots[victim] == cdz->last_slot) {
+        cdz->last_slot = NULL;
+    }
+    return victim;
+}
+
+// Decompresses a claimed slot on the calling thread, with the lock held on entry and exit
+static void decompress_here(cdz_t* cdz, cdz_slot_t* slot) {
+    slot->state = SLOT_DECOMPRESSING;
+    pthread_mutex_unlock(&cdz->lock);
+    decompress(cdz, slot->hunk, slot->data);
+    pthread_mutex_lock(&cdz->lock);
+    slot->state = SLOT_READY;
+    pthread_cond_broadcast(&cdz->done);
+}
+
+const u8* cdz_sector(cdz_t* cdz, u32 lba) {
+    if (lba >= cdz->header->num_sectors) {
+        return NULL;
+    }
+    u32 hunk = lba / cdz->header->hunk_sectors;
+    size_t offset = (size_t)(lba % cdz->header->hunk_sectors) * DISC_SECTOR_SIZE;
+    if (cdz->last_slot != NULL && cdz->last_slot->hunk == hunk) {
+        return cdz->last_slot->data + offset;
+    }
+
+    pthread_mutex_lock(&cdz->lock);
+    int index = find_slot(cdz, hunk);
+    if (index >= 0 && cdz->slots[index].state == SLOT_QUEUED) {
+        // No worker has started on it, quicker to do it now than wait behind the rest of the queue
+        for (int i = 0; i < cdz->queue_size; i++) {
+            if (cdz->queue[i] == index) {
+                memmove(&cdz->queue[i], &cdz->queue[i + 1], (--cdz->queue_size - i) * sizeof(int));
+                break;
+            }
+        }
+        decompress_here(cdz, &cdz->slots[index]);
+        cdz->on_demand++;
+    } else if (index >= 0 && cdz->slots[index].state == SLOT_DECOMPRESSING) {
+        cdz->waits++;
+        while (cdz->slots[index].state != SLOT_READY) {
+            pthread_cond_wait(&cdz->done, &cdz->lock);
+        }
+    } else if (index < 0) {
+        while ((index = claim_slot(cdz)) < 0) {
+            pthread_cond_wait(&cdz->done, &cdz->lock);
+        }
+        cdz->slots[index].hunk = hunk;
+        decompress_here(cdz, &cdz->slots[index]);
+        cdz->on_demand++;
+    } else {
+        cdz->read_ahead++;
+    }
+    cdz_slot_t* slot = &cdz->slots[index];
+    slot->last_used = ++cdz->clock;
+    cdz->last_slot = slot;
+    pthread_mutex_unlock(&cdz->lock);
+    return slot->data + offset;
+}
+
+void cdz_prefetch(cdz_t* cdz, u32 lba) {
+    u32 first = lba / cdz->header->hunk_sectors;
+    if (first == cdz->last_prefetch) {
+        return;
+    }
+    cdz->last_prefetch = first;
+
+    pthread_mutex_lock(&cdz->lock);
+    for (u32 hunk = first; hunk < first + CDZ_READ_AHEAD_HUNKS && hunk < cdz->header->num_hunks; hunk++) {
+        int index = find_slot(cdz, hunk);
+        if (index < 0) {
+            if ((index = claim_slot(cdz)) < 0) {
+                break;
+            }
+            cdz->slots[index].state = SLOT_QUEUED;
+            cdz->slots[index].hunk = hunk;
+            cdz->queue[cdz->queue_size++] = index;
+            pthread_cond_signal(&cdz->work);
+        }
+        // Newer than anything already read, so the read-ahead isn't what gets evicted next
+        cdz->slots[index].last_used = ++cdz->clock;
+    }
+    pthread_mutex_unlock(&cdz->lock);
+}
+
+static bool validate(const cdz_t* cdz, const char* path) {
+    const cdz_header_t* header = cdz->header;
+    if (cdz->file_size < sizeof(cdz_header_t) || memcmp(header->magic, CDZ_MAGIC, sizeof(header->magic)) != 0) {
+        logwarn("%s isn't a compressed disc image", path);
+        return false;
+    }
+    if (header->hunk_sectors == 0 || header->num_sectors == 0 || header->num_tracks == 0 || header->num_tracks > DISC_MAX_TRACKS
+        || header->num_hunks != (header->num_sectors + header->hunk_sectors - 1) / header->hunk_sectors
+        || (cdz->file_size - sizeof(cdz_header_t)) / sizeof(cdz_hunk_t) < header->num_hunks) {
+        logwarn("%s has a corrupt header", path);
+        return false;
+    }
+    for (u32 i = 0; i < header->num_hunks; i++) {
+        const cdz_hunk_t* hunk = &cdz->hunks[i];
+        size_t raw_size = (size_t)hunk_sectors(cdz, i) * DISC_SECTOR_SIZE;
+        if (hunk->offset > cdz->file_size || hunk->size > cdz->file_size - hunk->offset
+            || ((hunk->flags & CDZ_HUNK_STORED) && hunk->size != raw_size)) {
+            logwarn("%s is truncated or corrupt at hunk %u", path, i);
+            return false;
+        }
+    }
+    return true;
+}
+
+cdz_t* cdz_open(disc_t* disc, const char* path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        logwarn("Unable to open the compressed disc image %s", path);
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        logwarn("Unable to read the compressed disc image %s", path);
+        close(fd);
+        return NULL;
+    }
+    void* file = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (file == MAP_FAILED) {
+        logwarn("Unable to map the compressed disc image %s", path);
+        return NULL;
+    }
+
+    cdz_t* cdz = calloc(1, sizeof(cdz_t));
+    cdz->file = file;
+    cdz->file_size = st.st_size;
+    cdz->header = file;
+    cdz->hunks = (const cdz_hunk_t*)(cdz->file + sizeof(cdz_header_t));
+    if (!validate(cdz, path)) {
+        munmap(file, st.st_size);
+        free(cdz);
+        return NULL;
+    }
+    cdz->hunk_size = cdz->header->hunk_sectors * DISC_SECTOR_SIZE;
+    cdz->last_prefetch = UINT32_MAX;
+
+    disc->num_tracks = cdz->header->num_tracks;
+    memcpy(disc->tracks, cdz->header->tracks, sizeof(disc->tracks));
+    disc->num_sectors = cdz->header->num_sectors;
+
+    u8* cache = malloc((size_t)CDZ_CACHE_HUNKS * cdz->hunk_size);
+    for (int i = 0; i < CDZ_CACHE_HUNKS; i++) {
+        cdz->slots[i].data = cache + (size_t)i * cdz->hunk_size;
+    }
+    pthread_mutex_init(&cdz->lock, NULL);
+    pthread_cond_init(&cdz->work, NULL);
+    pthread_cond_init(&cdz->done, NULL);
+    for (int i = 0; i < CDZ_WORKERS; i++) {
+        pthread_create(&cdz->workers[i], NULL, worker_main, cdz);
+    }
+    return cdz;
+}
+
+void cdz_close(cdz_t* cdz) {
+    if (cdz == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&cdz->lock);
+    cdz->stopping = true;
+    pthread_cond_broadcast(&cdz->work);
+    pthread_mutex_unlock(&cdz->lock);
+    for (int i = 0; i < CDZ_WORKERS; i++) {
+        pthread_join(cdz->workers[i], NULL);
+    }
+    loginfo("Compressed disc: %lu hunk lookups read ahead, %lu decompressed on demand, %lu waited on a worker",
+            (unsigned long)cdz->read_ahead, (unsigned long)cdz->on_demand, (unsigned long)cdz->waits);
+    pthread_mutex_destroy(&cdz->lock);
+    pthread_cond_destroy(&cdz->work);
+    pthread_cond_destroy(&cdz->done);
+    free(cdz->slots[0].data);
+    munmap((void*)cdz->file, cdz->file_size);
+    free(cdz);
+}
+
+bool cdz_write(const disc_t* disc, const char* path, u32 hunk_sectors) {
+    FILE* fp = fopen(path, "wb");
+    if (fp == NULL) {
+        logwarn("Unable to open %s for writing", path);
+        return false;
+    }
+    cdz_header_t header;
+    memset(&header, 0x00, sizeof(header));
+    memcpy(header.magic, CDZ_MAGIC, sizeof(header.magic));
+    header.hunk_sectors = hunk_sectors;
+    header.num_sectors = disc->num_sectors;
+    header.num_hunks = (disc->num_sectors + hunk_sectors - 1) / hunk_sectors;
+    header.num_tracks = disc->num_tracks;
+    memcpy(header.tracks, disc->tracks, sizeof(header.tracks));
+
+    cdz_hunk_t* table = calloc(header.num_hunks, sizeof(cdz_hunk_t));
+    size_t hunk_size = (size_t)hunk_sectors * DISC_SECTOR_SIZE;
+    u8* raw = malloc(hunk_size);
+    u8* compressed = malloc(LZ_COMPRESS_BOUND(hunk_size));
+    u64 offset = sizeof(header) + header.num_hunks * sizeof(cdz_hunk_t);
+    bool ok = fseek(fp, offset, SEEK_SET) == 0;
+    for (u32 hunk = 0; ok && hunk < header.num_hunks; hunk++) {
+        u32 first = hunk * hunk_sectors;
+        u32 sectors = disc->num_sectors - first < hunk_sectors ? disc->num_sectors - first : hunk_sectors;
+        for (u32 i = 0; i < sectors; i++) {
+            memcpy(raw + (size_t)i * DISC_SECTOR_SIZE, disc_sector(disc, first + i), DISC_SECTOR_SIZE);
+        }
+        size_t size = (size_t)sectors * DISC_SECTOR_SIZE;
+        size_t compressed_size = lz_compress(raw, size, compressed);
+        table[hunk].offset = offset;
+        if (compressed_size < size) {
+            table[hunk].size = compressed_size;
+            ok = fwrite(compressed, 1, compressed_size, fp) == compressed_size;
+        } else {
+            table[hunk].size = size;
+            table[hunk].flags = CDZ_HUNK_STORED;
+            ok = fwrite(raw, 1, size, fp) == size;
+        }
+        offset += table[hunk].size;
+    }
+    ok = ok && fseek(fp, 0, SEEK_SET) == 0
+         && fwrite(&header, sizeof(header), 1, fp) == 1
+         && fwrite(table, sizeof(cdz_hunk_t), header.num_hunks, fp) == header.num_hunks;
+    ok = fclose(fp) == 0 && ok;
+    if (ok) {
+        logalways("Wrote %s: %u sectors in %u hunks, %lu bytes (%.1f%% of the raw image)", path, header.num_sectors,
+                  header.num_hunks, (unsigned long)offset, 100.0 * offset / ((double)header.num_sectors * DISC_SECTOR_SIZE));
+    } else {
+        logwarn("Error writing %s", path);
+    }
+    free(compressed);
+    free(raw);
+    free(table);
+    return ok;
+}
@@ -0,0 +1,53 @@
+#ifndef PS1_CDZ_H
+#define PS1_CDZ_H
+
+#include <util.h>
+#include <stdbool.h>
+#include <cdrom/disc.h>
+
+/*
+ * Compressed disc images (.cdz). The disc is split into hunks of a few sectors, each compressed on its own with the LZ
+ * codec, so any sector can be reached by decompressing one hunk:
+ *
+ *   cdz_header_t
+ *   cdz_hunk_t[num_hunks]  where each hunk is in the file
+ *   hunk data
+ *
+ * Hunks are decompressed by a few worker threads into a small LRU cache. The CD-ROM controller tells the disc where
+ * it's reading (disc_prefetch()) and the hunks ahead of that are queued, so the emulation thread only decompresses
+ * when a seek lands somewhere that hasn't been read ahead.
+ */
+
+#define CDZ_MAGIC "PS1CDZ1"
+#define CDZ_DEFAULT_HUNK_SECTORS 8
+
+#define CDZ_HUNK_STORED 1 // Didn't compress, the data is the raw sectors
+
+typedef struct cdz_header {
+    char magic[8];
+    u32 hunk_sectors;
+    u32 num_sectors;
+    u32 num_hunks;
+    u32 num_tracks;
+    disc_track_t tracks[DISC_MAX_TRACKS];
+} cdz_header_t;
+
+typedef struct cdz_hunk {
+    u64 offset;
+    u32 size;
+    u32 flags;
+} cdz_hunk_t;
+
+typedef struct cdz cdz_t;
+
+// Maps `path` and fills in the disc's tracks, returns NULL after logging a warning when it isn't a usable .cdz
+cdz_t* cdz_open(disc_t* disc, const char* path);
+void cdz_close(cdz_t* cdz);
+const u8* cdz_sector(cdz_t* cdz, u32 lba);
+// Queues the hunks from `lba` on for the workers
+void cdz_prefetch(cdz_t* cdz, u32 lba);
+
+// Compresses `disc` into a .cdz at `path`
+bool cdz_write(const disc_t* disc, const char* path, u32 hunk_sectors);
+
+#endif //PS1_CDZ_H
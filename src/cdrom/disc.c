@@ -0,0 +1,239 @@
+#include "disc.h"
+
+#include <ctype.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <log.h>
+#include <cdrom/cdz.h>
+
+// How far ahead of the read position the mapped files are paged in
+#define DISC_READ_AHEAD_SECTORS 32
+
+static const u8 zero_sector[DISC_SECTOR_SIZE];
+
+static bool map_file(disc_t* disc, const char* path, u32 first_sector) {
+    if (disc->num_files == DISC_MAX_TRACKS) {
+        logwarn("Too many files in the disc image, ignoring %s", path);
+        return false;
+    }
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        logwarn("Unable to open the disc image file %s", path);
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < DISC_SECTOR_SIZE) {
+        logwarn("%s is too small to be a disc image", path);
+        close(fd);
+        return false;
+    }
+    void* data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        logwarn("Unable to map the disc image file %s", path);
+        return false;
+    }
+    if (st.st_size % DISC_SECTOR_SIZE != 0) {
+        logwarn("%s isn't a whole number of %d byte sectors, ignoring the last %zu bytes", path, DISC_SECTOR_SIZE, (size_t)(st.st_size % DISC_SECTOR_SIZE));
+    }
+    disc_file_t* file = &disc->files[disc->num_files++];
+    file->data = data;
+    file->size = st.st_size;
+    file->first_sector = first_sector;
+    file->num_sectors = st.st_size / DISC_SECTOR_SIZE;
+    return true;
+}
+
+static u32 parse_msf(const char* msf) {
+    unsigned m = 0, s = 0, f = 0;
+    sscanf(msf, "%u:%u:%u", &m, &s, &f);
+    return (m * 60 + s) * 75 + f;
+}
+
+// Paths in a cue sheet are relative to the cue sheet
+static void resolve_path(const char* cue_path, const char* name, char* out, size_t size) {
+    const char* slash = strrchr(cue_path, '/');
+    if (name[0] == '/' || slash == NULL) {
+        snprintf(out, size, "%s", name);
+    } else {
+        snprintf(out, size, "%.*s/%s", (int)(slash - cue_path), cue_path, name);
+    }
+}
+
+static bool parse_cue(disc_t* disc, const char* path) {
+    FILE* fp = fopen(path, "r");
+    if (fp == NULL) {
+        logwarn("Unable to open the cue sheet %s", path);
+        return false;
+    }
+    char line[512];
+    int line_number = 0;
+    bool ok = true;
+    // Whether the current file has had an INDEX yet, a PREGAP before that moves the whole file
+    bool file_indexed = false;
+    while (ok && fgets(line, sizeof(line), fp) != NULL) {
+        line_number++;
+        char* command = line;
+        while (isspace((unsigned char)*command)) {
+            command++;
+        }
+        if (strncasecmp(command, "FILE", 4) == 0) {
+            char* name = strchr(command, '"');
+            char* end = name != NULL ? strchr(name + 1, '"') : NULL;
+            if (end == NULL) {
+                logwarn("%s:%d: expected a quoted file name", path, line_number);
+                ok = false;
+                break;
+            }
+            *end = '\0';
+            u32 first_sector = 0;
+            if (disc->num_files > 0) {
+                const disc_file_t* previous = &disc->files[disc->num_files - 1];
+                first_sector = previous->first_sector + previous->num_sectors;
+            }
+            char file_path[1024];
+            resolve_path(path, name + 1, file_path, sizeof(file_path));
+            ok = map_file(disc, file_path, first_sector);
+            file_indexed = false;
+        } else if (strncasecmp(command, "TRACK", 5) == 0) {
+            int number = 0;
+            char type[32] = "";
+            sscanf(command + 5, "%d %31s", &number, type);
+            if (disc->num_files == 0 || number != disc->num_tracks + 1 || number > DISC_MAX_TRACKS) {
+                logwarn("%s:%d: unexpected TRACK %d", path, line_number, number);
+                ok = false;
+                break;
+            }
+            if (strcasecmp(type, "AUDIO") != 0 && strcasecmp(type, "MODE2/2352") != 0 && strcasecmp(type, "MODE1/2352") != 0) {
+                logwarn("%s:%d: %s tracks aren't supported, only raw 2352 byte sectors", path, line_number, type);
+                ok = false;
+                break;
+            }
+            disc->tracks[disc->num_tracks].type = strcasecmp(type, "AUDIO") == 0 ? DISC_TRACK_AUDIO : DISC_TRACK_DATA;
+            disc->num_tracks++;
+        } else if (strncasecmp(command, "PREGAP", 6) == 0) {
+            if (disc->num_files == 0) {
+                continue;
+            }
+            if (file_indexed) {
+                logwarn("%s:%d: PREGAP in the middle of a file isn't supported, ignoring it", path, line_number);
+                continue;
+            }
+            disc->files[disc->num_files - 1].first_sector += parse_msf(command + 6);
+        } else if (strncasecmp(command, "INDEX", 5) == 0) {
+            int index = -1;
+            char msf[16] = "";
+            sscanf(command + 5, "%d %15s", &index, msf);
+            if (disc->num_tracks == 0) {
+                logwarn("%s:%d: INDEX before any TRACK", path, line_number);
+                ok = false;
+                break;
+            }
+            file_indexed = true;
+            if (index == 1) {
+                disc->tracks[disc->num_tracks - 1].start = disc->files[disc->num_files - 1].first_sector + parse_msf(msf);
+            }
+        }
+        // REM, CATALOG, PERFORMER, TITLE and the rest don't matter to the console
+    }
+    fclose(fp);
+    if (ok && disc->num_tracks == 0) {
+        logwarn("%s has no tracks", path);
+        ok = false;
+    }
+    return ok;
+}
+
+disc_t* disc_open(const char* path) {
+    disc_t* disc = calloc(1, sizeof(disc_t));
+    size_t length = strlen(path);
+    bool ok;
+    if (length > 4 && strcasecmp(path + length - 4, ".cue") == 0) {
+        ok = parse_cue(disc, path);
+    } else if (length > 4 && strcasecmp(path + length - 4, ".cdz") == 0) {
+        disc->cdz = cdz_open(disc, path);
+        ok = disc->cdz != NULL;
+    } else {
+        // A bare image is a single data track
+        ok = map_file(disc, path, 0);
+        disc->num_tracks = 1;
+        disc->tracks[0].type = DISC_TRACK_DATA;
+    }
+    if (!ok) {
+        disc_close(disc);
+        return NULL;
+    }
+    if (disc->num_files > 0) {
+        const disc_file_t* last = &disc->files[disc->num_files - 1];
+        disc->num_sectors = last->first_sector + last->num_sectors;
+    }
+    logalways("Loaded the disc %s, %d tracks and %u sectors", path, disc->num_tracks, disc->num_sectors);
+    return disc;
+}
+
+void disc_close(disc_t* disc) {
+    if (disc == NULL) {
+        return;
+    }
+    for (int i = 0; i < disc->num_files; i++) {
+        munmap((void*)disc->files[i].data, disc->files[i].size);
+    }
+    cdz_close(disc->cdz);
+    free(disc);
+}
+
+const u8* disc_sector(const disc_t* disc, u32 lba) {
+    if (disc == NULL) {
+        return zero_sector;
+    }
+    if (disc->cdz != NULL) {
+        const u8* sector = cdz_sector(disc->cdz, lba);
+        return sector != NULL ? sector : zero_sector;
+    }
+    for (int i = 0; i < disc->num_files; i++) {
+        const disc_file_t* file = &disc->files[i];
+        if (lba >= file->first_sector && lba - file->first_sector < file->num_sectors) {
+            return file->data + (size_t)(lba - file->first_sector) * DISC_SECTOR_SIZE;
+        }
+    }
+    return zero_sector;
+}
+
+void disc_prefetch(const disc_t* disc, u32 lba) {
+    if (disc == NULL) {
+        return;
+    }
+    if (disc->cdz != NULL) {
+        cdz_prefetch(disc->cdz, lba);
+        return;
+    }
+    for (int i = 0; i < disc->num_files; i++) {
+        const disc_file_t* file = &disc->files[i];
+        if (lba >= file->first_sector && lba - file->first_sector < file->num_sectors) {
+            // Start the page cache reading ahead instead of faulting each page in as the DMA gets to it
+            size_t page_size = sysconf(_SC_PAGESIZE);
+            size_t start = (size_t)(lba - file->first_sector) * DISC_SECTOR_SIZE & ~(page_size - 1);
+            size_t length = (size_t)DISC_READ_AHEAD_SECTORS * DISC_SECTOR_SIZE;
+            if (length > file->size - start) {
+                length = file->size - start;
+            }
+            madvise((void*)(file->data + start), length, MADV_WILLNEED);
+            return;
+        }
+    }
+}
+
+int disc_track_at(const disc_t* disc, u32 lba) {
+    int track = 1;
+    while (track < disc->num_tracks && disc->tracks[track].start <= lba) {
+        track++;
+    }
+    return track;
+}
@@ -0,0 +1,63 @@
+#ifndef PS1_DISC_H
+#define PS1_DISC_H
+
+#include <util.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * A disc image, BIN/CUE, a bare BIN or a compressed .cdz (see cdz.h). The BIN files are mapped read-only and sectors
+ * are handed out as pointers into the mappings, nothing is copied until the CD-ROM DMA writes a sector to RAM.
+ */
+
+// Raw sectors, sync and header included
+#define DISC_SECTOR_SIZE 2352
+#define DISC_MAX_TRACKS 99
+// The first track starts at MSF 00:02:00, LBA 0
+#define DISC_LEAD_IN_SECTORS 150
+
+typedef enum disc_track_type {
+    DISC_TRACK_DATA,
+    DISC_TRACK_AUDIO
+} disc_track_type_t;
+
+typedef struct disc_track {
+    disc_track_type_t type;
+    u32 start; // LBA of INDEX 01
+} disc_track_t;
+
+typedef struct disc_file {
+    const u8* data;
+    size_t size;
+    u32 first_sector; // LBA the file starts at
+    u32 num_sectors;
+} disc_file_t;
+
+typedef struct disc {
+    disc_file_t files[DISC_MAX_TRACKS];
+    int num_files;
+    // Track n is tracks[n - 1]
+    disc_track_t tracks[DISC_MAX_TRACKS];
+    int num_tracks;
+    // LBA of the lead-out
+    u32 num_sectors;
+    // Set for compressed images, which have no files
+    struct cdz* cdz;
+} disc_t;
+
+// Opens a .cue sheet, a .cdz or a bare .bin, returns NULL after logging a warning when it can't be used
+disc_t* disc_open(const char* path);
+void disc_close(disc_t* disc);
+// The raw sector at `lba`. Sectors that aren't in any file (pregaps only in the cue sheet, past the end) and sectors
+// of no disc at all read as zeroes
+const u8* disc_sector(const disc_t* disc, u32 lba);
+// Called as the drive's read position moves, so the sectors after `lba` are ready by the time they're read
+void disc_prefetch(const disc_t* disc, u32 lba);
+// Where the 0x800 bytes of data start in a raw data sector, after the header (mode 1) or the subheader too (mode 2)
+INLINE u32 disc_data_offset(const u8* sector) {
+    return sector[15] == 1 ? 16 : 24;
+}
+// Track number the sector at `lba` belongs to
+int disc_track_at(const disc_t* disc, u32 lba);
+
+#endif //PS1_DISC_H
@@ -1,4 +1,15 @@
-#include <stdlib.h>
+#include "log.h"
+#include "util.h"
+
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
 
 void (*fatal_handler)() = NULL;
 
@@ -14,3 +25,415 @@ void log_call_fatal_handler() {
 
 unsigned int ps1_log_verbosity = 0;
 unsigned int next_ps1_log_verbosity = 0;
+
+/*
+ * Asynchronous sink: each thread that logs gets its own single producer/single consumer ring of fixed size
+ * records holding the format pointer, the arguments as read by walking the format string, and a cycle timestamp.
+ * A background thread formats the records and writes them to stdout. Strings are copied into the record, so
+ * arguments pointing at stack buffers are safe. When a ring is full the logging thread waits for space
+ * rather than dropping messages.
+ */
+
+#define LOG_RING_SIZE 2048 // Power of two
+#define LOG_RECORD_ARGS_SIZE 232
+#define LOG_LINE_MAX 1024
+#define LOG_WRITER_IDLE_US 1000
+
+typedef struct log_record {
+    const char* format;
+    u64 cycles;
+    u16 args_size;
+    u8 args[LOG_RECORD_ARGS_SIZE];
+} log_record_t;
+
+typedef struct log_ring {
+    _Atomic u32 head; // Written by the logging thread
+    _Atomic u32 tail; // Written by the writer thread
+    struct log_ring* next;
+    log_record_t records[LOG_RING_SIZE];
+} log_ring_t;
+
+static _Atomic(log_ring_t*) rings = NULL;
+static _Thread_local log_ring_t* thread_ring = NULL;
+static _Thread_local const u64* thread_cycle_counter = NULL;
+
+static pthread_once_t writer_once = PTHREAD_ONCE_INIT;
+static pthread_t writer_thread;
+static atomic_bool writer_running = false;
+static atomic_bool show_cycles = false;
+// Held while consuming records, normally only by the writer thread
+static pthread_mutex_t drain_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void log_set_cycle_counter(const u64* counter) {
+    thread_cycle_counter = counter;
+}
+
+void log_set_show_cycles(bool show) {
+    show_cycles = show;
+}
+
+// Conversion specifier parsed out of a format string
+typedef struct log_spec {
+    const char* start; // The '%'
+    const char* end;   // One past the conversion character
+    int stars;         // Number of '*' width/precision arguments
+    char length;       // 0, 'H' (hh), 'h', 'l', 'q' (ll), 'z', 'j', 't' or 'L'
+    char conversion;
+} log_spec_t;
+
+static const char* parse_spec(const char* p, log_spec_t* spec) {
+    spec->start = p++;
+    spec->stars = 0;
+    spec->length = 0;
+    while (*p && strchr("-+ #0'", *p)) {
+        p++;
+    }
+    if (*p == '*') {
+        spec->stars++;
+        p++;
+    } else {
+        while (*p >= '0' && *p <= '9') p++;
+    }
+    if (*p == '.') {
+        p++;
+        if (*p == '*') {
+            spec->stars++;
+            p++;
+        } else {
+            while (*p >= '0' && *p <= '9') p++;
+        }
+    }
+    switch (*p) {
+        case 'h':
+            spec->length = p[1] == 'h' ? 'H' : 'h';
+            p += p[1] == 'h' ? 2 : 1;
+            break;
+        case 'l':
+            spec->length = p[1] == 'l' ? 'q' : 'l';
+            p += p[1] == 'l' ? 2 : 1;
+            break;
+        case 'q': case 'z': case 'j': case 't': case 'L':
+            spec->length = *p++;
+            break;
+        default:
+            break;
+    }
+    spec->conversion = *p;
+    spec->end = *p ? p + 1 : p;
+    return spec->end;
+}
+
+typedef struct arg_writer {
+    u8* buf;
+    u16 size;
+} arg_writer_t;
+
+INLINE void put_u64(arg_writer_t* w, u64 value) {
+    if (w->size + sizeof(u64) <= LOG_RECORD_ARGS_SIZE) {
+        memcpy(w->buf + w->size, &value, sizeof(u64));
+    }
+    w->size += sizeof(u64);
+}
+
+INLINE void put_string(arg_writer_t* w, const char* s) {
+    if (s == NULL) {
+        s = "(null)";
+    }
+    size_t len = strlen(s);
+    // Always leave room for the length prefix, truncate the string instead
+    if (w->size + sizeof(u16) > LOG_RECORD_ARGS_SIZE) {
+        w->size += sizeof(u16);
+        return;
+    }
+    size_t room = LOG_RECORD_ARGS_SIZE - w->size - sizeof(u16);
+    u16 stored = len < room ? len : room;
+    memcpy(w->buf + w->size, &stored, sizeof(u16));
+    memcpy(w->buf + w->size + sizeof(u16), s, stored);
+    w->size += sizeof(u16) + stored;
+}
+
+static u16 capture_args(const char* format, u8* buf, va_list ap) {
+    arg_writer_t w = { buf, 0 };
+    for (const char* p = format; *p; ) {
+        if (*p != '%') {
+            p++;
+            continue;
+        }
+        if (p[1] == '%') {
+            p += 2;
+            continue;
+        }
+        log_spec_t spec;
+        p = parse_spec(p, &spec);
+        for (int i = 0; i < spec.stars; i++) {
+            put_u64(&w, (u64)va_arg(ap, int));
+        }
+        switch (spec.conversion) {
+            case 'd': case 'i': case 'o': case 'u': case 'x': case 'X': case 'c':
+                switch (spec.length) {
+                    case 'l': put_u64(&w, (u64)va_arg(ap, long)); break;
+                    case 'q': put_u64(&w, (u64)va_arg(ap, long long)); break;
+                    case 'z': put_u64(&w, (u64)va_arg(ap, size_t)); break;
+                    case 'j': put_u64(&w, (u64)va_arg(ap, intmax_t)); break;
+                    case 't': put_u64(&w, (u64)va_arg(ap, ptrdiff_t)); break;
+                    default:  put_u64(&w, (u64)va_arg(ap, int)); break;
+                }
+                break;
+            case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A': {
+                double d = spec.length == 'L' ? (double)va_arg(ap, long double) : va_arg(ap, double);
+                u64 bits;
+                memcpy(&bits, &d, sizeof(bits));
+                put_u64(&w, bits);
+                break;
+            }
+            case 's':
+                put_string(&w, va_arg(ap, const char*));
+                break;
+            case 'p':
+            case 'n':
+                put_u64(&w, (uintptr_t)va_arg(ap, void*));
+                break;
+            default:
+                break;
+        }
+    }
+    return w.size > LOG_RECORD_ARGS_SIZE ? LOG_RECORD_ARGS_SIZE : w.size;
+}
+
+typedef struct arg_reader {
+    const u8* buf;
+    u16 size;
+    u16 pos;
+} arg_reader_t;
+
+static u64 get_u64(arg_reader_t* r) {
+    u64 value = 0;
+    if (r->pos + sizeof(u64) <= r->size) {
+        memcpy(&value, r->buf + r->pos, sizeof(u64));
+    }
+    r->pos += sizeof(u64);
+    return value;
+}
+
+// Copies a stored string into `out`, NUL terminated
+static void get_string(arg_reader_t* r, char* out, size_t out_size) {
+    u16 len = 0;
+    if (r->pos + sizeof(u16) <= r->size) {
+        memcpy(&len, r->buf + r->pos, sizeof(u16));
+    }
+    r->pos += sizeof(u16);
+    if (len >= out_size) {
+        len = out_size - 1;
+    }
+    if (r->pos + len > r->size) {
+        len = r->pos < r->size ? r->size - r->pos : 0;
+    }
+    memcpy(out, r->buf + r->pos, len);
+    out[len] = '\0';
+    r->pos += len;
+}
+
+// snprintf of a single conversion with 0, 1 or 2 '*' arguments
+#define FORMAT_ONE(out, size, fmt, stars, star_args, value) \
+    ((stars) == 0 ? snprintf(out, size, fmt, value) : \
+     (stars) == 1 ? snprintf(out, size, fmt, (star_args)[0], value) : \
+                    snprintf(out, size, fmt, (star_args)[0], (star_args)[1], value))
+
+static int render_record(const log_record_t* record, char* out, int out_size) {
+    arg_reader_t r = { record->args, record->args_size, 0 };
+    int len = 0;
+    if (show_cycles) {
+        len += snprintf(out, out_size, "[%12llu] ", (unsigned long long)record->cycles);
+    }
+    for (const char* p = record->format; *p && len < out_size - 1; ) {
+        if (*p != '%') {
+            out[len++] = *p++;
+            continue;
+        }
+        if (p[1] == '%') {
+            out[len++] = '%';
+            p += 2;
+            continue;
+        }
+        log_spec_t spec;
+        p = parse_spec(p, &spec);
+
+        char fmt[32];
+        size_t fmt_len = spec.end - spec.start;
+        if (fmt_len >= sizeof(fmt)) {
+            continue;
+        }
+        memcpy(fmt, spec.start, fmt_len);
+        fmt[fmt_len] = '\0';
+
+        int star_args[2] = { 0, 0 };
+        for (int i = 0; i < spec.stars; i++) {
+            star_args[i] = (int)get_u64(&r);
+        }
+
+        char* dst = out + len;
+        size_t room = out_size - len;
+        int written = 0;
+        switch (spec.conversion) {
+            case 'd': case 'i': case 'o': case 'u': case 'x': case 'X': case 'c': {
+                u64 value = get_u64(&r);
+                switch (spec.length) {
+                    case 'l': written = FORMAT_ONE(dst, room, fmt, spec.stars, star_args, (long)value); break;
+                    case 'q': written = FORMAT_ONE(dst, room, fmt, spec.stars, star_args, (long long)value); break;
+                    case 'z': written = FORMAT_ONE(dst, room, fmt, spec.stars, star_args, (size_t)value); break;
+                    case 'j': written = FORMAT_ONE(dst, room, fmt, spec.stars, star_args, (intmax_t)value); break;
+                    case 't': written = FORMAT_ONE(dst, room, fmt, spec.stars, star_args, (ptrdiff_t)value); break;
+                    default:  written = FORMAT_ONE(dst, room, fmt, spec.stars, star_args, (int)value); break;
+                }
+                break;
+            }
+            case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A': {
+                u64 bits = get_u64(&r);
+                double d;
+                memcpy(&d, &bits, sizeof(d));
+                if (spec.length == 'L') {
+                    written = FORMAT_ONE(dst, room, fmt, spec.stars, star_args, (long double)d);
+                } else {
+                    written = FORMAT_ONE(dst, room, fmt, spec.stars, star_args, d);
+                }
+                break;
+            }
+            case 's': {
+                char s[LOG_RECORD_ARGS_SIZE + 1];
+                get_string(&r, s, sizeof(s));
+                written = FORMAT_ONE(dst, room, fmt, spec.stars, star_args, s);
+                break;
+            }
+            case 'p':
+                written = FORMAT_ONE(dst, room, fmt, spec.stars, star_args, (void*)(uintptr_t)get_u64(&r));
+                break;
+            case 'n':
+                get_u64(&r);
+                break;
+            default:
+                break;
+        }
+        if (written > 0) {
+            len += written < (int)room ? written : (int)room - 1;
+        }
+    }
+    if (len >= out_size) {
+        len = out_size - 1;
+    }
+    out[len] = '\0';
+    return len;
+}
+
+// Writes out everything currently in the rings, returns true if anything was written
+static bool drain_rings() {
+    bool wrote = false;
+    char line[LOG_LINE_MAX];
+    pthread_mutex_lock(&drain_lock);
+    for (log_ring_t* ring = atomic_load(&rings); ring != NULL; ring = ring->next) {
+        u32 tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+        u32 head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        while (tail != head) {
+            int len = render_record(&ring->records[tail & (LOG_RING_SIZE - 1)], line, sizeof(line));
+            fwrite(line, 1, len, stdout);
+            tail++;
+            atomic_store_explicit(&ring->tail, tail, memory_order_release);
+            wrote = true;
+        }
+    }
+    pthread_mutex_unlock(&drain_lock);
+    return wrote;
+}
+
+static void* writer_loop(void* arg) {
+    while (atomic_load(&writer_running)) {
+        if (!drain_rings()) {
+            fflush(stdout);
+            usleep(LOG_WRITER_IDLE_US);
+        }
+    }
+    return NULL;
+}
+
+static void stop_writer() {
+    if (atomic_exchange(&writer_running, false)) {
+        pthread_join(writer_thread, NULL);
+    }
+    drain_rings();
+    fflush(stdout);
+}
+
+// Only the forking thread survives fork(), so the child goes without a writer and logs synchronously
+static void before_fork() {
+    pthread_mutex_lock(&drain_lock);
+}
+
+static void after_fork_parent() {
+    pthread_mutex_unlock(&drain_lock);
+}
+
+static void after_fork_child() {
+    pthread_mutex_init(&drain_lock, NULL);
+    atomic_store(&writer_running, false);
+}
+
+static void start_writer() {
+    atomic_store(&writer_running, true);
+    if (pthread_create(&writer_thread, NULL, writer_loop, NULL) != 0) {
+        atomic_store(&writer_running, false);
+        return;
+    }
+    pthread_atfork(before_fork, after_fork_parent, after_fork_child);
+    atexit(stop_writer);
+}
+
+static log_ring_t* register_thread_ring() {
+    log_ring_t* ring = calloc(1, sizeof(log_ring_t));
+    ring->next = atomic_load(&rings);
+    while (!atomic_compare_exchange_weak(&rings, &ring->next, ring));
+    thread_ring = ring;
+    return ring;
+}
+
+void log_enqueue(const char* format, ...) {
+    pthread_once(&writer_once, start_writer);
+    log_ring_t* ring = thread_ring;
+    if (unlikely(ring == NULL)) {
+        ring = register_thread_ring();
+    }
+
+    u32 head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    while (head - atomic_load_explicit(&ring->tail, memory_order_acquire) >= LOG_RING_SIZE) {
+        if (!atomic_load(&writer_running)) {
+            // No writer (it failed to start, or we're exiting), write synchronously
+            drain_rings();
+            break;
+        }
+        sched_yield();
+    }
+
+    log_record_t* record = &ring->records[head & (LOG_RING_SIZE - 1)];
+    record->format = format;
+    record->cycles = thread_cycle_counter != NULL ? *thread_cycle_counter : 0;
+    va_list ap;
+    va_start(ap, format);
+    record->args_size = capture_args(format, record->args, ap);
+    va_end(ap);
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+
+    if (!atomic_load(&writer_running)) {
+        drain_rings();
+    }
+}
+
+void log_flush() {
+    if (atomic_load(&writer_running)) {
+        // Wait for the writer to catch up with every ring
+        for (log_ring_t* ring = atomic_load(&rings); ring != NULL; ring = ring->next) {
+            while (atomic_load(&ring->tail) != atomic_load(&ring->head) && atomic_load(&writer_running)) {
+                sched_yield();
+            }
+        }
+    }
+    drain_rings();
+    fflush(stdout);
+}
@@ -3,6 +3,8 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
 
 extern unsigned int ps1_log_verbosity;
 extern unsigned int next_ps1_log_verbosity;
@@ -33,26 +35,35 @@ extern unsigned int next_ps1_log_verbosity;
 
 void log_set_fatal_handler(void (*handler)());
 void log_call_fatal_handler();
+
+// Messages are queued and written to stdout by a background thread, see log.c
+void log_enqueue(const char* format, ...) __attribute__((format(printf, 1, 2)));
+// Blocks until everything queued so far has been written
+void log_flush();
+// Timestamps messages from the calling thread with the value behind `counter`
+void log_set_cycle_counter(const uint64_t* counter);
+void log_set_show_cycles(bool show);
 #define log_set_verbosity(new_verbosity) do {ps1_log_verbosity = new_verbosity; next_ps1_log_verbosity = new_verbosity;} while(0)
 #define delayed_log_set_verbosity(new_verbosity) do {next_ps1_log_verbosity = new_verbosity;} while(0)
 #define update_delayed_log_verbosity() do {ps1_log_verbosity = next_ps1_log_verbosity;} while(0)
 #define log_get_verbosity() ps1_log_verbosity
 
 #define logfatal(message,...) do { \
-    log_call_fatal_handler();                                           \
+    log_flush();                                                        \
     fprintf(stderr, COLOR_RED "[FATAL] at %s:%d ", __FILE__, __LINE__); \
     fprintf(stderr, message "\n" COLOR_END, ##__VA_ARGS__);             \
+    log_call_fatal_handler();                                           \
     exit(EXIT_FAILURE);} while(0)
 
-#define logwarn(message,...) do { if (ps1_log_verbosity >= LOG_VERBOSITY_WARN) {printf(COLOR_YELLOW "[WARN]  " message "\n" COLOR_END, ##__VA_ARGS__);} } while(0)
-#define logalways(message,...) do { printf(COLOR_CYAN "[LOG]  " message "\n" COLOR_END, ##__VA_ARGS__); } while(0)
+#define logwarn(message,...) do { if (ps1_log_verbosity >= LOG_VERBOSITY_WARN) {log_enqueue(COLOR_YELLOW "[WARN]  " message "\n" COLOR_END, ##__VA_ARGS__);} } while(0)
+#define logalways(message,...) do { log_enqueue(COLOR_CYAN "[LOG]  " message "\n" COLOR_END, ##__VA_ARGS__); } while(0)
 #define unimplemented(condition, message, ...) do { if (condition) { logfatal("UNIMPLEMENTED CASE DETECTED: " message, ##__VA_ARGS__); } } while(0)
 
 #ifdef LOG_ENABLED
-#define loginfo(message,...) do { if (ps1_log_verbosity >= LOG_VERBOSITY_INFO) {printf(COLOR_CYAN "[INFO]  " message "\n" COLOR_END, ##__VA_ARGS__);} } while(0)
-#define loginfo_nonewline(message,...) do { if (ps1_log_verbosity >= LOG_VERBOSITY_INFO) {printf(COLOR_CYAN "[INFO]  " message COLOR_END, ##__VA_ARGS__);} } while(0)
-#define logdebug(message,...) do { if (ps1_log_verbosity >= LOG_VERBOSITY_DEBUG) {printf(COLOR_GREEN "[DEBUG] " message "\n" COLOR_END, ##__VA_ARGS__);} } while(0)
-#define logtrace(message,...) do { if (ps1_log_verbosity >= LOG_VERBOSITY_TRACE) {printf("[TRACE] " message "\n", ##__VA_ARGS__);} } while(0)
+#define loginfo(message,...) do { if (ps1_log_verbosity >= LOG_VERBOSITY_INFO) {log_enqueue(COLOR_CYAN "[INFO]  " message "\n" COLOR_END, ##__VA_ARGS__);} } while(0)
+#define loginfo_nonewline(message,...) do { if (ps1_log_verbosity >= LOG_VERBOSITY_INFO) {log_enqueue(COLOR_CYAN "[INFO]  " message COLOR_END, ##__VA_ARGS__);} } while(0)
+#define logdebug(message,...) do { if (ps1_log_verbosity >= LOG_VERBOSITY_DEBUG) {log_enqueue(COLOR_GREEN "[DEBUG] " message "\n" COLOR_END, ##__VA_ARGS__);} } while(0)
+#define logtrace(message,...) do { if (ps1_log_verbosity >= LOG_VERBOSITY_TRACE) {log_enqueue("[TRACE] " message "\n", ##__VA_ARGS__);} } while(0)
 
 
 #else
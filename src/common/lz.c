@@ -0,0 +1,153 @@
+#include "lz.h"
+
+#include <stdbool.h>
+#include <string.h>
+
+#define LZ_HASH_BITS 12
+#define LZ_MAX_OFFSET 0xFFFF
+
+INLINE u32 lz_load32(const u8* p) {
+    u32 v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+INLINE u32 lz_hash(u32 v) {
+    return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+INLINE u8* lz_write_length(u8* op, size_t length) {
+    while (length >= 255) {
+        *op++ = 255;
+        length -= 255;
+    }
+    *op++ = length;
+    return op;
+}
+
+INLINE size_t lz_match_length(const u8* a, const u8* b, const u8* end) {
+    const u8* start = b;
+    while (b + 8 <= end) {
+        u64 x, y;
+        memcpy(&x, a, 8);
+        memcpy(&y, b, 8);
+        if (x != y) {
+            return b - start + (__builtin_ctzll(x ^ y) >> 3);
+        }
+        a += 8;
+        b += 8;
+    }
+    while (b < end && *a == *b) {
+        a++;
+        b++;
+    }
+    return b - start;
+}
+
+static u8* lz_write_sequence(u8* op, const u8* literals, size_t num_literals, u32 offset, size_t match_length) {
+    u8* token = op++;
+    size_t extra_match = offset != 0 ? match_length - LZ_MIN_MATCH : 0;
+    *token = ((num_literals < 15 ? num_literals : 15) << 4) | (extra_match < 15 ? extra_match : 15);
+    if (num_literals >= 15) {
+        op = lz_write_length(op, num_literals - 15);
+    }
+    memcpy(op, literals, num_literals);
+    op += num_literals;
+    *op++ = offset & 0xFF;
+    *op++ = offset >> 8;
+    if (offset != 0 && extra_match >= 15) {
+        op = lz_write_length(op, extra_match - 15);
+    }
+    return op;
+}
+
+size_t lz_compress(const u8* src, size_t n, u8* dst) {
+    u32 table[1 << LZ_HASH_BITS];
+    memset(table, 0x00, sizeof(table));
+
+    const u8* end = src + n;
+    const u8* ip = src;
+    const u8* anchor = src;
+    u8* op = dst;
+
+    while (ip + LZ_MIN_MATCH <= end) {
+        u32 sequence = lz_load32(ip);
+        u32 h = lz_hash(sequence);
+        const u8* candidate = src + table[h];
+        table[h] = ip - src;
+        if (candidate < ip && ip - candidate <= LZ_MAX_OFFSET && lz_load32(candidate) == sequence) {
+            size_t length = LZ_MIN_MATCH + lz_match_length(candidate + LZ_MIN_MATCH, ip + LZ_MIN_MATCH, end);
+            op = lz_write_sequence(op, anchor, ip - anchor, ip - candidate, length);
+            ip += length;
+            anchor = ip;
+        } else {
+            // Skip faster through data that doesn't compress
+            ip += 1 + ((ip - anchor) >> 6);
+        }
+    }
+    op = lz_write_sequence(op, anchor, end - anchor, 0, 0);
+    return op - dst;
+}
+
+INLINE bool lz_read_length(const u8** ip, const u8* end, size_t* length) {
+    u8 b;
+    do {
+        if (*ip >= end) {
+            return false;
+        }
+        b = *(*ip)++;
+        *length += b;
+    } while (b == 255);
+    return true;
+}
+
+size_t lz_decompress(const u8* src, size_t n, u8* dst, size_t dst_capacity) {
+    const u8* ip = src;
+    const u8* end = src + n;
+    u8* op = dst;
+    u8* op_end = dst + dst_capacity;
+
+    while (ip < end) {
+        u8 token = *ip++;
+        size_t num_literals = token >> 4;
+        if (num_literals == 15 && !lz_read_length(&ip, end, &num_literals)) {
+            return 0;
+        }
+        if (num_literals > (size_t)(end - ip) || num_literals > (size_t)(op_end - op)) {
+            return 0;
+        }
+        memcpy(op, ip, num_literals);
+        ip += num_literals;
+        op += num_literals;
+
+        if (end - ip < 2) {
+            return 0;
+        }
+        u32 offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if (offset == 0) {
+            return ip == end ? op - dst : 0;
+        }
+        size_t length = token & 0xF;
+        if (length == 15 && !lz_read_length(&ip, end, &length)) {
+            return 0;
+        }
+        length += LZ_MIN_MATCH;
+        if (offset > (size_t)(op - dst) || length > (size_t)(op_end - op)) {
+            return 0;
+        }
+        const u8* match = op - offset;
+        if (offset == 1) {
+            memset(op, match[0], length); // Runs, the common case for XOR deltas
+        } else if (offset >= length) {
+            memcpy(op, match, length);
+        } else {
+            // Overlaps its own output, has to go byte by byte
+            for (size_t i = 0; i < length; i++) {
+                op[i] = match[i];
+            }
+        }
+        op += length;
+    }
+    return 0;
+}
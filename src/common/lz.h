@@ -0,0 +1,23 @@
+#ifndef PS1_LZ_H
+#define PS1_LZ_H
+
+#include <stddef.h>
+#include "util.h"
+
+/*
+ * Small LZ77 codec in the style of LZ4: sequences of a token (literal length and match length nibbles), extra length
+ * bytes, literals and a 16 bit match offset. The last sequence has offset 0. Meant for data with long runs, like XOR
+ * deltas between snapshots, where speed matters more than ratio.
+ */
+
+#define LZ_MIN_MATCH 4
+
+// Worst case compressed size of n bytes
+#define LZ_COMPRESS_BOUND(n) ((n) + (n) / 255 + 16)
+
+// dst must hold LZ_COMPRESS_BOUND(n) bytes. Returns the compressed size.
+size_t lz_compress(const u8* src, size_t n, u8* dst);
+// Returns the decompressed size, or 0 if the input is corrupt or doesn't fit in dst_capacity
+size_t lz_decompress(const u8* src, size_t n, u8* dst, size_t dst_capacity);
+
+#endif //PS1_LZ_H
@@ -0,0 +1,14 @@
+#ifndef PS1_TIMING_H
+#define PS1_TIMING_H
+
+#include <time.h>
+#include "util.h"
+
+// Monotonic host time in nanoseconds
+INLINE u64 timing_now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u64)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+#endif //PS1_TIMING_H
@@ -5,49 +5,12 @@
 #include "disassemble.h"
 #include "mips_instructions.h"
 #include <mem/bus.h>
+#include "trace.h"
 
-const char* register_names[] = {
-        "zero", // 0
-        "at",   // 1
-        "v0",   // 2
-        "v1",   // 3
-        "a0",   // 4
-        "a1",   // 5
-        "a2",   // 6
-        "a3",   // 7
-        "t0",   // 8
-        "t1",   // 9
-        "t2",   // 10
-        "t3",   // 11
-        "t4",   // 12
-        "t5",   // 13
-        "t6",   // 14
-        "t7",   // 15
-        "s0",   // 16
-        "s1",   // 17
-        "s2",   // 18
-        "s3",   // 19
-        "s4",   // 20
-        "s5",   // 21
-        "s6",   // 22
-        "s7",   // 23
-        "t8",   // 24
-        "t9",   // 25
-        "k0",   // 26
-        "k1",   // 27
-        "gp",   // 28
-        "sp",   // 29
-        "s8",   // 30
-        "ra"    // 31
-};
-
-const char* cp0_register_names[] = {
-        "0", "1", "2", "BPC", "4", "BDA", "JUMPDEST", "DCIC", "BadVAddr", "BDAM", "10",
-        "BPCM", "SR", "CAUSE", "EPC", "PRId", "16", "17", "18", "19", "20", "21", "22",
-        "23", "24", "25", "26", "27", "28", "29", "30", "31"
-};
+#ifdef PS1_PROFILE
+#include "profiler.h"
+#endif
 
-r3000a_t ps1cpu;
 
 void cpu_handle_exception(u32 pc, u32 code, s32 coprocessor_error) {
     loginfo("Exception thrown! Code: %d Coprocessor: %d", code, coprocessor_error);
@@ -282,7 +245,18 @@ void cpu_step() {
     PS1CPU.next_pc += 4;
     PS1CPU.branch = false;
 
-    r3000a_instruction_decode(pc, instruction)(instruction);
+    mipsinstr_handler_t handler = r3000a_instruction_decode(pc, instruction);
+    if (unlikely(trace_enabled)) {
+        trace_step(pc, instruction, handler);
+    } else {
+#ifdef PS1_PROFILE
+        u64 start = profiler_ticks();
+        handler(instruction);
+        profiler_record(pc, instruction, handler, profiler_ticks() - start);
+#else
+        handler(instruction);
+#endif
+    }
     PS1CPU.exception = false; // only used in dynarec
 }
 
@@ -7,6 +7,7 @@
 #include <util.h>
 #include <log.h>
 #include "mips_instruction_decode.h"
+#include "disassemble.h"
 
 // Exceptions
 #define EXCEPTION_INTERRUPT            0
@@ -348,21 +349,19 @@ typedef struct r3000a {
     bool exception;
 } r3000a_t;
 
-extern r3000a_t ps1cpu;
-#define PS1CPU ps1cpu
+// The CPU of the current instance, see ps1_instance_select
+extern _Thread_local r3000a_t* ps1cpu;
+#define PS1CPU (*ps1cpu)
 #define PS1CP0 PS1CPU.cp0
 
 typedef void(*mipsinstr_handler_t)(mips_instruction_t);
 
 void cpu_step();
 void cpu_handle_exception(u32 pc, u32 code, s32 coprocessor_error);
-mipsinstr_handler_t cpu_instruction_decode(u32 pc, mips_instruction_t instr);
+mipsinstr_handler_t r3000a_instruction_decode(u32 pc, mips_instruction_t instr);
 void cpu_interrupt_update();
 bool instruction_stable(mips_instruction_t instr);
 
-extern const char* register_names[];
-extern const char* cp0_register_names[];
-
 INLINE void cpu_set_pc(u32 new_pc) {
     PS1CPU.prev_pc = PS1CPU.pc;
     PS1CPU.pc = new_pc;
@@ -3,55 +3,353 @@
 #include <stdbool.h>
 #include <stdio.h>
 
-#ifdef HAVE_CAPSTONE
-#include <capstone/capstone.h>
-#endif
+#include "mips_instruction_decode.h"
 
-#include "disassemble.h"
-#include <log.h>
+const char* register_names[] = {
+        "zero", // 0
+        "at",   // 1
+        "v0",   // 2
+        "v1",   // 3
+        "a0",   // 4
+        "a1",   // 5
+        "a2",   // 6
+        "a3",   // 7
+        "t0",   // 8
+        "t1",   // 9
+        "t2",   // 10
+        "t3",   // 11
+        "t4",   // 12
+        "t5",   // 13
+        "t6",   // 14
+        "t7",   // 15
+        "s0",   // 16
+        "s1",   // 17
+        "s2",   // 18
+        "s3",   // 19
+        "s4",   // 20
+        "s5",   // 21
+        "s6",   // 22
+        "s7",   // 23
+        "t8",   // 24
+        "t9",   // 25
+        "k0",   // 26
+        "k1",   // 27
+        "gp",   // 28
+        "sp",   // 29
+        "s8",   // 30
+        "ra"    // 31
+};
+
+const char* cp0_register_names[] = {
+        "0", "1", "2", "BPC", "4", "BDA", "JUMPDEST", "DCIC", "BadVAddr", "BDAM", "10",
+        "BPCM", "SR", "CAUSE", "EPC", "PRId", "16", "17", "18", "19", "20", "21", "22",
+        "23", "24", "25", "26", "27", "28", "29", "30", "31"
+};
+
+const char* gte_data_register_names[] = {
+        "vxy0", "vz0", "vxy1", "vz1", "vxy2", "vz2", "rgbc", "otz",
+        "ir0", "ir1", "ir2", "ir3", "sxy0", "sxy1", "sxy2", "sxyp",
+        "sz0", "sz1", "sz2", "sz3", "rgb0", "rgb1", "rgb2", "res1",
+        "mac0", "mac1", "mac2", "mac3", "irgb", "orgb", "lzcs", "lzcr"
+};
+
+const char* gte_control_register_names[] = {
+        "rt11rt12", "rt13rt21", "rt22rt23", "rt31rt32", "rt33", "trx", "try", "trz",
+        "l11l12", "l13l21", "l22l23", "l31l32", "l33", "rbk", "gbk", "bbk",
+        "lr1lr2", "lr3lg1", "lg2lg3", "lb1lb2", "lb3", "rfc", "gfc", "bfc",
+        "ofx", "ofy", "h", "dqa", "dqb", "zsf3", "zsf4", "flag"
+};
+
+typedef enum operand_format {
+    FMT_INVALID,
+    FMT_RD_RS_RT,       // addu rd, rs, rt
+    FMT_RD_RT_SA,       // sll rd, rt, sa
+    FMT_RD_RT_RS,       // sllv rd, rt, rs
+    FMT_RS,             // jr rs
+    FMT_RD_RS,          // jalr rd, rs
+    FMT_RD,             // mfhi rd
+    FMT_RS_RT,          // mult rs, rt
+    FMT_CODE,           // syscall code
+    FMT_RT_RS_SIMM,     // addiu rt, rs, -imm
+    FMT_RT_RS_UIMM,     // ori rt, rs, imm
+    FMT_RT_UIMM,        // lui rt, imm
+    FMT_RS_RT_BRANCH,   // beq rs, rt, target
+    FMT_RS_BRANCH,      // blez rs, target
+    FMT_JUMP,           // j target
+    FMT_RT_MEM,         // lw rt, offset(base)
+    FMT_GTE_MEM,        // lwc2 gte_reg, offset(base)
+} operand_format_t;
+
+typedef struct opcode_info {
+    const char* mnemonic;
+    operand_format_t format;
+} opcode_info_t;
 
-bool disassembler_initialized = false;
-#ifdef HAVE_CAPSTONE
-csh handle_mips64;
-cs_insn* insn;
-#endif
+static const opcode_info_t primary_table[64] = {
+        [0x02] = { "j",     FMT_JUMP },
+        [0x03] = { "jal",   FMT_JUMP },
+        [0x04] = { "beq",   FMT_RS_RT_BRANCH },
+        [0x05] = { "bne",   FMT_RS_RT_BRANCH },
+        [0x06] = { "blez",  FMT_RS_BRANCH },
+        [0x07] = { "bgtz",  FMT_RS_BRANCH },
+        [0x08] = { "addi",  FMT_RT_RS_SIMM },
+        [0x09] = { "addiu", FMT_RT_RS_SIMM },
+        [0x0A] = { "slti",  FMT_RT_RS_SIMM },
+        [0x0B] = { "sltiu", FMT_RT_RS_SIMM },
+        [0x0C] = { "andi",  FMT_RT_RS_UIMM },
+        [0x0D] = { "ori",   FMT_RT_RS_UIMM },
+        [0x0E] = { "xori",  FMT_RT_RS_UIMM },
+        [0x0F] = { "lui",   FMT_RT_UIMM },
+        [0x20] = { "lb",    FMT_RT_MEM },
+        [0x21] = { "lh",    FMT_RT_MEM },
+        [0x22] = { "lwl",   FMT_RT_MEM },
+        [0x23] = { "lw",    FMT_RT_MEM },
+        [0x24] = { "lbu",   FMT_RT_MEM },
+        [0x25] = { "lhu",   FMT_RT_MEM },
+        [0x26] = { "lwr",   FMT_RT_MEM },
+        [0x28] = { "sb",    FMT_RT_MEM },
+        [0x29] = { "sh",    FMT_RT_MEM },
+        [0x2A] = { "swl",   FMT_RT_MEM },
+        [0x2B] = { "sw",    FMT_RT_MEM },
+        [0x2E] = { "swr",   FMT_RT_MEM },
+        [0x32] = { "lwc2",  FMT_GTE_MEM },
+        [0x3A] = { "swc2",  FMT_GTE_MEM },
+};
+
+static const opcode_info_t special_table[64] = {
+        [0x00] = { "sll",     FMT_RD_RT_SA },
+        [0x02] = { "srl",     FMT_RD_RT_SA },
+        [0x03] = { "sra",     FMT_RD_RT_SA },
+        [0x04] = { "sllv",    FMT_RD_RT_RS },
+        [0x06] = { "srlv",    FMT_RD_RT_RS },
+        [0x07] = { "srav",    FMT_RD_RT_RS },
+        [0x08] = { "jr",      FMT_RS },
+        [0x09] = { "jalr",    FMT_RD_RS },
+        [0x0C] = { "syscall", FMT_CODE },
+        [0x0D] = { "break",   FMT_CODE },
+        [0x10] = { "mfhi",    FMT_RD },
+        [0x11] = { "mthi",    FMT_RS },
+        [0x12] = { "mflo",    FMT_RD },
+        [0x13] = { "mtlo",    FMT_RS },
+        [0x18] = { "mult",    FMT_RS_RT },
+        [0x19] = { "multu",   FMT_RS_RT },
+        [0x1A] = { "div",     FMT_RS_RT },
+        [0x1B] = { "divu",    FMT_RS_RT },
+        [0x20] = { "add",     FMT_RD_RS_RT },
+        [0x21] = { "addu",    FMT_RD_RS_RT },
+        [0x22] = { "sub",     FMT_RD_RS_RT },
+        [0x23] = { "subu",    FMT_RD_RS_RT },
+        [0x24] = { "and",     FMT_RD_RS_RT },
+        [0x25] = { "or",      FMT_RD_RS_RT },
+        [0x26] = { "xor",     FMT_RD_RS_RT },
+        [0x27] = { "nor",     FMT_RD_RS_RT },
+        [0x2A] = { "slt",     FMT_RD_RS_RT },
+        [0x2B] = { "sltu",    FMT_RD_RS_RT },
+};
+
+// Indexed by the low 6 bits of a COP2 command
+static const char* gte_command_names[64] = {
+        [0x01] = "rtps",
+        [0x06] = "nclip",
+        [0x0C] = "op",
+        [0x10] = "dpcs",
+        [0x11] = "intpl",
+        [0x12] = "mvmva",
+        [0x13] = "ncds",
+        [0x14] = "cdp",
+        [0x16] = "ncdt",
+        [0x1B] = "nccs",
+        [0x1C] = "cc",
+        [0x1E] = "ncs",
+        [0x20] = "nct",
+        [0x28] = "sqr",
+        [0x29] = "dcpl",
+        [0x2A] = "dpct",
+        [0x2D] = "avsz3",
+        [0x2E] = "avsz4",
+        [0x30] = "rtpt",
+        [0x3D] = "gpf",
+        [0x3E] = "gpl",
+        [0x3F] = "ncct",
+};
+
+static const char* mvmva_matrix_names[4] = { "rt", "llm", "lcm", "bad" };
+static const char* mvmva_vector_names[4] = { "v0", "v1", "v2", "ir" };
+static const char* mvmva_translation_names[4] = { "tr", "bk", "fc", "none" };
+
+#define GPR(r) register_names[(r)]
+
+static int disassemble_invalid(u32 raw, char* buf, int buflen) {
+    snprintf(buf, buflen, ".word 0x%08X", raw);
+    return 0;
+}
 
-void disassembler_initialize() {
-    if (disassembler_initialized) {
-        return;
+static int disassemble_cop0(mips_instruction_t instr, char* buf, int buflen) {
+    switch (instr.r.rs) {
+        case 0x00:
+            snprintf(buf, buflen, "mfc0 $%s, $%s", GPR(instr.r.rt), cp0_register_names[instr.r.rd]);
+            return 1;
+        case 0x04:
+            snprintf(buf, buflen, "mtc0 $%s, $%s", GPR(instr.r.rt), cp0_register_names[instr.r.rd]);
+            return 1;
+        case 0x10:
+            if (instr.r.funct == 0x10) {
+                snprintf(buf, buflen, "rfe");
+                return 1;
+            }
+            break;
     }
+    return disassemble_invalid(instr.raw, buf, buflen);
+}
 
-#ifdef HAVE_CAPSTONE
-    if (cs_open(CS_ARCH_MIPS, CS_MODE_MIPS64, &handle_mips64) != CS_ERR_OK) {
-        logfatal("Failed to initialize capstone");
+static int disassemble_cop2(mips_instruction_t instr, char* buf, int buflen) {
+    if (instr.raw & (1 << 25)) {
+        const char* name = gte_command_names[instr.r.funct];
+        if (name == NULL) {
+            return disassemble_invalid(instr.raw, buf, buflen);
+        }
+        bool sf = (instr.raw >> 19) & 1;
+        bool lm = (instr.raw >> 10) & 1;
+        if (instr.r.funct == 0x12) {
+            snprintf(buf, buflen, "%s sf=%d, mx=%s, v=%s, cv=%s, lm=%d", name, sf,
+                     mvmva_matrix_names[(instr.raw >> 17) & 3],
+                     mvmva_vector_names[(instr.raw >> 15) & 3],
+                     mvmva_translation_names[(instr.raw >> 13) & 3], lm);
+        } else {
+            snprintf(buf, buflen, "%s sf=%d, lm=%d", name, sf, lm);
+        }
+        return 1;
+    }
+    switch (instr.r.rs) {
+        case 0x00:
+            snprintf(buf, buflen, "mfc2 $%s, $%s", GPR(instr.r.rt), gte_data_register_names[instr.r.rd]);
+            return 1;
+        case 0x02:
+            snprintf(buf, buflen, "cfc2 $%s, $%s", GPR(instr.r.rt), gte_control_register_names[instr.r.rd]);
+            return 1;
+        case 0x04:
+            snprintf(buf, buflen, "mtc2 $%s, $%s", GPR(instr.r.rt), gte_data_register_names[instr.r.rd]);
+            return 1;
+        case 0x06:
+            snprintf(buf, buflen, "ctc2 $%s, $%s", GPR(instr.r.rt), gte_control_register_names[instr.r.rd]);
+            return 1;
     }
-#endif
+    return disassemble_invalid(instr.raw, buf, buflen);
+}
 
-    disassembler_initialized = true;
+// Where a branch at `address` goes. The offset is shifted unsigned, left shifting a negative int is undefined.
+static u32 branch_target(u32 address, mips_instruction_t instr) {
+    return address + 4 + ((u32)(s32)(s16)instr.i.immediate << 2);
 }
 
-int disassemble(u32 address, u32 raw, char* buf, int buflen) {
-#ifdef HAVE_CAPSTONE
-    u8 code[4];
-    code[0] = raw & 0xFF;
-    code[1] = (raw >> 8) & 0xFF;
-    code[2] = (raw >> 16) & 0xFF;
-    code[3] = (raw >> 24) & 0xFF;
-    disassembler_initialize();
-    size_t count = cs_disasm(handle_mips64, code, 4, address, 0, &insn);
-    if (count == 0) {
-        logwarn("Failed to disassemble code!");
-        snprintf(buf, buflen, "ERROR! big (0x%08X) little (0x%08X)", raw, FAKELITTLE_WORD(raw));
-        return 0;
-    } else if (count > 1) {
-        logwarn("Given more than one instruction, only disassembling the first one!");
+static int disassemble_regimm(u32 address, mips_instruction_t instr, char* buf, int buflen) {
+    u32 target = branch_target(address, instr);
+    const char* mnemonic;
+    // Same encodings r3000a_regimm_decode() accepts, anything else in rt is invalid
+    switch (instr.i.rt) {
+        case 0x00: mnemonic = "bltz";   break;
+        case 0x01: mnemonic = "bgez";   break;
+        case 0x10: mnemonic = "bltzal"; break;
+        case 0x11: mnemonic = "bgezal"; break;
+        default:
+            return disassemble_invalid(instr.raw, buf, buflen);
     }
+    snprintf(buf, buflen, "%s $%s, 0x%08X", mnemonic, GPR(instr.i.rs), target);
+    return 1;
+}
 
-    snprintf(buf, buflen, "%s %s", insn[0].mnemonic, insn[0].op_str);
-
-    cs_free(insn, count);
-#else
-    snprintf(buf, buflen, "[Disassembly Unsupported]");
-#endif
+static int format_operands(u32 address, mips_instruction_t instr, const opcode_info_t* info, char* buf, int buflen) {
+    const char* m = info->mnemonic;
+    s16 simm = instr.i.immediate;
+    u32 target = branch_target(address, instr);
+    switch (info->format) {
+        case FMT_INVALID:
+            return disassemble_invalid(instr.raw, buf, buflen);
+        case FMT_RD_RS_RT:
+            snprintf(buf, buflen, "%s $%s, $%s, $%s", m, GPR(instr.r.rd), GPR(instr.r.rs), GPR(instr.r.rt));
+            break;
+        case FMT_RD_RT_SA:
+            snprintf(buf, buflen, "%s $%s, $%s, %d", m, GPR(instr.r.rd), GPR(instr.r.rt), instr.r.sa);
+            break;
+        case FMT_RD_RT_RS:
+            snprintf(buf, buflen, "%s $%s, $%s, $%s", m, GPR(instr.r.rd), GPR(instr.r.rt), GPR(instr.r.rs));
+            break;
+        case FMT_RS:
+            snprintf(buf, buflen, "%s $%s", m, GPR(instr.r.rs));
+            break;
+        case FMT_RD_RS:
+            if (instr.r.rd == 31) {
+                snprintf(buf, buflen, "%s $%s", m, GPR(instr.r.rs));
+            } else {
+                snprintf(buf, buflen, "%s $%s, $%s", m, GPR(instr.r.rd), GPR(instr.r.rs));
+            }
+            break;
+        case FMT_RD:
+            snprintf(buf, buflen, "%s $%s", m, GPR(instr.r.rd));
+            break;
+        case FMT_RS_RT:
+            snprintf(buf, buflen, "%s $%s, $%s", m, GPR(instr.r.rs), GPR(instr.r.rt));
+            break;
+        case FMT_CODE: {
+            u32 code = (instr.raw >> 6) & 0xFFFFF;
+            if (code) {
+                snprintf(buf, buflen, "%s 0x%X", m, code);
+            } else {
+                snprintf(buf, buflen, "%s", m);
+            }
+            break;
+        }
+        case FMT_RT_RS_SIMM:
+            snprintf(buf, buflen, "%s $%s, $%s, %s0x%X", m, GPR(instr.i.rt), GPR(instr.i.rs),
+                     simm < 0 ? "-" : "", simm < 0 ? -simm : simm);
+            break;
+        case FMT_RT_RS_UIMM:
+            snprintf(buf, buflen, "%s $%s, $%s, 0x%X", m, GPR(instr.i.rt), GPR(instr.i.rs), instr.i.immediate);
+            break;
+        case FMT_RT_UIMM:
+            snprintf(buf, buflen, "%s $%s, 0x%X", m, GPR(instr.i.rt), instr.i.immediate);
+            break;
+        case FMT_RS_RT_BRANCH:
+            if (instr.i.rs == 0 && instr.i.rt == 0 && instr.op == 0x04) {
+                snprintf(buf, buflen, "b 0x%08X", target);
+            } else {
+                snprintf(buf, buflen, "%s $%s, $%s, 0x%08X", m, GPR(instr.i.rs), GPR(instr.i.rt), target);
+            }
+            break;
+        case FMT_RS_BRANCH:
+            snprintf(buf, buflen, "%s $%s, 0x%08X", m, GPR(instr.i.rs), target);
+            break;
+        case FMT_JUMP:
+            snprintf(buf, buflen, "%s 0x%08X", m, ((address + 4) & 0xF0000000) | (instr.j.target << 2));
+            break;
+        case FMT_RT_MEM:
+            snprintf(buf, buflen, "%s $%s, %s0x%X($%s)", m, GPR(instr.i.rt),
+                     simm < 0 ? "-" : "", simm < 0 ? -simm : simm, GPR(instr.i.rs));
+            break;
+        case FMT_GTE_MEM:
+            snprintf(buf, buflen, "%s $%s, %s0x%X($%s)", m, gte_data_register_names[instr.i.rt],
+                     simm < 0 ? "-" : "", simm < 0 ? -simm : simm, GPR(instr.i.rs));
+            break;
+    }
     return 1;
 }
+
+int disassemble(u32 address, u32 raw, char* buf, int buflen) {
+    mips_instruction_t instr = { .raw = raw };
+    switch (instr.op) {
+        case 0x00:
+            if (raw == 0) {
+                snprintf(buf, buflen, "nop");
+                return 1;
+            }
+            return format_operands(address, instr, &special_table[instr.r.funct], buf, buflen);
+        case 0x01:
+            return disassemble_regimm(address, instr, buf, buflen);
+        case 0x10:
+            return disassemble_cop0(instr, buf, buflen);
+        case 0x12:
+            return disassemble_cop2(instr, buf, buflen);
+        default:
+            return format_operands(address, instr, &primary_table[instr.op], buf, buflen);
+    }
+}
@@ -3,6 +3,12 @@
 
 #include <util.h>
 
+extern const char* register_names[];
+extern const char* cp0_register_names[];
+extern const char* gte_data_register_names[];
+extern const char* gte_control_register_names[];
+
+// Formats one R3000A instruction into buf. Never allocates. Returns 0 if the instruction is not a valid MIPS I/PS1 instruction.
 int disassemble(u32 address, u32 raw, char* buf, int buflen);
 
 #endif //N64_DISASSEMBLE_H
@@ -0,0 +1,219 @@
+#include "profiler.h"
+
+#include <inttypes.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mips_instructions.h"
+
+profiler_t profiler;
+
+static volatile sig_atomic_t report_requested = 0;
+
+static const char* opcode_names[64] = {
+        "SPECIAL", "REGIMM", "J", "JAL", "BEQ", "BNE", "BLEZ", "BGTZ",
+        "ADDI", "ADDIU", "SLTI", "SLTIU", "ANDI", "ORI", "XORI", "LUI",
+        "COP0", "COP1", "COP2", "COP3", "0x14", "0x15", "0x16", "0x17",
+        "0x18", "0x19", "0x1A", "0x1B", "0x1C", "0x1D", "0x1E", "0x1F",
+        "LB", "LH", "LWL", "LW", "LBU", "LHU", "LWR", "LWU",
+        "SB", "SH", "SWL", "SW", "0x2C", "0x2D", "SWR", "CACHE",
+        "LWC0", "LWC1", "LWC2", "LWC3", "0x34", "0x35", "0x36", "0x37",
+        "SWC0", "SWC1", "SWC2", "SWC3", "0x3C", "0x3D", "0x3E", "0x3F",
+};
+
+static const struct {
+    mipsinstr_handler_t handler;
+    const char* name;
+} handler_names[] = {
+        { mips_nop,          "mips_nop" },
+        { mips_addi,         "mips_addi" },
+        { mips_addiu,        "mips_addiu" },
+        { mips_andi,         "mips_andi" },
+        { mips_beq,          "mips_beq" },
+        { mips_bgtz,         "mips_bgtz" },
+        { mips_blez,         "mips_blez" },
+        { mips_bne,          "mips_bne" },
+        { mips_cache,        "mips_cache" },
+        { mips_j,            "mips_j" },
+        { mips_jal,          "mips_jal" },
+        { mips_slti,         "mips_slti" },
+        { mips_sltiu,        "mips_sltiu" },
+        { mips_mfc0,         "mips_mfc0" },
+        { mips_mtc0,         "mips_mtc0" },
+        { mips_lui,          "mips_lui" },
+        { mips_lbu,          "mips_lbu" },
+        { mips_lhu,          "mips_lhu" },
+        { mips_lh,           "mips_lh" },
+        { mips_lw,           "mips_lw" },
+        { mips_lwu,          "mips_lwu" },
+        { mips_sb,           "mips_sb" },
+        { mips_sh,           "mips_sh" },
+        { mips_sw,           "mips_sw" },
+        { mips_ori,          "mips_ori" },
+        { mips_xori,         "mips_xori" },
+        { mips_lb,           "mips_lb" },
+        { mips_lwl,          "mips_lwl" },
+        { mips_lwr,          "mips_lwr" },
+        { mips_swl,          "mips_swl" },
+        { mips_swr,          "mips_swr" },
+        { mips_spc_sll,      "mips_spc_sll" },
+        { mips_spc_srl,      "mips_spc_srl" },
+        { mips_spc_sra,      "mips_spc_sra" },
+        { mips_spc_srav,     "mips_spc_srav" },
+        { mips_spc_sllv,     "mips_spc_sllv" },
+        { mips_spc_srlv,     "mips_spc_srlv" },
+        { mips_spc_jr,       "mips_spc_jr" },
+        { mips_spc_jalr,     "mips_spc_jalr" },
+        { mips_spc_syscall,  "mips_spc_syscall" },
+        { mips_spc_mfhi,     "mips_spc_mfhi" },
+        { mips_spc_mthi,     "mips_spc_mthi" },
+        { mips_spc_mflo,     "mips_spc_mflo" },
+        { mips_spc_mtlo,     "mips_spc_mtlo" },
+        { mips_spc_mult,     "mips_spc_mult" },
+        { mips_spc_multu,    "mips_spc_multu" },
+        { mips_spc_div,      "mips_spc_div" },
+        { mips_spc_divu,     "mips_spc_divu" },
+        { mips_spc_add,      "mips_spc_add" },
+        { mips_spc_addu,     "mips_spc_addu" },
+        { mips_spc_and,      "mips_spc_and" },
+        { mips_spc_nor,      "mips_spc_nor" },
+        { mips_spc_sub,      "mips_spc_sub" },
+        { mips_spc_subu,     "mips_spc_subu" },
+        { mips_spc_or,       "mips_spc_or" },
+        { mips_spc_xor,      "mips_spc_xor" },
+        { mips_spc_slt,      "mips_spc_slt" },
+        { mips_spc_sltu,     "mips_spc_sltu" },
+        { mips_spc_teq,      "mips_spc_teq" },
+        { mips_spc_break,    "mips_spc_break" },
+        { mips_spc_tne,      "mips_spc_tne" },
+        { mips_ri_bltz,      "mips_ri_bltz" },
+        { mips_ri_bgez,      "mips_ri_bgez" },
+        { mips_ri_bltzal,    "mips_ri_bltzal" },
+        { mips_ri_bgezal,    "mips_ri_bgezal" },
+        { mips_rfe,          "mips_rfe" },
+};
+#define NUM_HANDLER_NAMES (sizeof(handler_names) / sizeof(handler_names[0]))
+
+#define REPORT_TOP_PCS 50
+
+static const char* handler_name(mipsinstr_handler_t handler) {
+    for (int i = 0; i < NUM_HANDLER_NAMES; i++) {
+        if (handler_names[i].handler == handler) {
+            return handler_names[i].name;
+        }
+    }
+    return "unknown";
+}
+
+static void profiler_report_atexit() {
+    profiler_report(stderr);
+}
+
+static void profiler_signal(int sig) {
+    report_requested = 1;
+}
+
+void profiler_init() {
+    // Every ps1_system_init_with_bios() calls this, the profile covers all of them and is reported once
+    static bool initialized = false;
+    if (initialized) {
+        return;
+    }
+    initialized = true;
+    profiler_reset();
+    atexit(profiler_report_atexit);
+    signal(SIGUSR1, profiler_signal);
+}
+
+void profiler_reset() {
+    memset(&profiler, 0x00, sizeof(profiler));
+}
+
+void profiler_check_signal() {
+    if (unlikely(report_requested)) {
+        report_requested = 0;
+        profiler_report(stderr);
+    }
+}
+
+static int compare_u64_desc(u64 a, u64 b) {
+    return a < b ? 1 : (a > b ? -1 : 0);
+}
+
+static int compare_handler_slots(const void* a, const void* b) {
+    return compare_u64_desc(((const profiler_handler_slot_t*)a)->ticks, ((const profiler_handler_slot_t*)b)->ticks);
+}
+
+typedef struct pc_hit {
+    u32 pc;
+    u64 hits;
+} pc_hit_t;
+
+static int compare_pc_hits(const void* a, const void* b) {
+    return compare_u64_desc(((const pc_hit_t*)a)->hits, ((const pc_hit_t*)b)->hits);
+}
+
+static u32 pc_slot_address(u32 slot) {
+    if (slot < PROFILER_PC_RAM_WORDS) {
+        return 0x80000000 | (slot << 2);
+    } else {
+        return 0xBFC00000 + ((slot - PROFILER_PC_RAM_WORDS) << 2);
+    }
+}
+
+void profiler_report(FILE* fp) {
+    u64 total = 0;
+    for (int i = 0; i < 64; i++) {
+        total += profiler.opcode_count[i];
+    }
+    if (total == 0) {
+        return;
+    }
+
+    fprintf(fp, "======== PROFILE: %" PRIu64 " instructions ========\n", total);
+    fprintf(fp, "-- Opcodes --\n");
+    for (int i = 0; i < 64; i++) {
+        if (profiler.opcode_count[i] > 0) {
+            fprintf(fp, "%-18s %14" PRIu64 " %6.2f%%\n", opcode_names[i], profiler.opcode_count[i], 100.0 * profiler.opcode_count[i] / total);
+        }
+    }
+    for (int i = 0; i < 64; i++) {
+        if (profiler.special_count[i] > 0) {
+            fprintf(fp, "SPECIAL funct 0x%02X %13" PRIu64 " %6.2f%%\n", i, profiler.special_count[i], 100.0 * profiler.special_count[i] / total);
+        }
+    }
+
+    profiler_handler_slot_t handlers[PROFILER_HANDLER_SLOTS];
+    memcpy(handlers, profiler.handlers, sizeof(handlers));
+    qsort(handlers, PROFILER_HANDLER_SLOTS, sizeof(profiler_handler_slot_t), compare_handler_slots);
+    u64 total_ticks = 0;
+    for (int i = 0; i < PROFILER_HANDLER_SLOTS; i++) {
+        total_ticks += handlers[i].ticks;
+    }
+
+    fprintf(fp, "-- Handlers, by host ticks --\n");
+    fprintf(fp, "%-18s %14s %16s %10s %7s\n", "handler", "count", "ticks", "ticks/op", "ticks%");
+    for (int i = 0; i < PROFILER_HANDLER_SLOTS && handlers[i].count > 0; i++) {
+        fprintf(fp, "%-18s %14" PRIu64 " %16" PRIu64 " %10.1f %6.2f%%\n", handler_name(handlers[i].handler), handlers[i].count,
+                handlers[i].ticks, (double)handlers[i].ticks / handlers[i].count, 100.0 * handlers[i].ticks / total_ticks);
+    }
+
+    pc_hit_t* hits = malloc(sizeof(pc_hit_t) * (PROFILER_PC_SLOTS - 1));
+    int num_hits = 0;
+    for (u32 slot = 0; slot < PROFILER_PC_SLOTS - 1; slot++) {
+        if (profiler.pc_hits[slot] > 0) {
+            hits[num_hits].pc = pc_slot_address(slot);
+            hits[num_hits].hits = profiler.pc_hits[slot];
+            num_hits++;
+        }
+    }
+    qsort(hits, num_hits, sizeof(pc_hit_t), compare_pc_hits);
+    fprintf(fp, "-- Hottest guest PCs --\n");
+    for (int i = 0; i < num_hits && i < REPORT_TOP_PCS; i++) {
+        fprintf(fp, "0x%08X %14" PRIu64 " %6.2f%%\n", hits[i].pc, hits[i].hits, 100.0 * hits[i].hits / total);
+    }
+    if (profiler.pc_hits[PROFILER_PC_SLOTS - 1] > 0) {
+        fprintf(fp, "other      %14" PRIu64 "\n", profiler.pc_hits[PROFILER_PC_SLOTS - 1]);
+    }
+    free(hits);
+}
@@ -0,0 +1,86 @@
+#ifndef PS1_PROFILER_H
+#define PS1_PROFILER_H
+
+#include <stdio.h>
+#include <util.h>
+#include "cpu.h"
+
+/*
+ * Instruction profiler, only compiled in when PS1_PROFILE is defined (cmake -DPS1_PROFILE=ON).
+ * Counts executions per opcode, per handler and per guest PC, and host cycles spent in each handler.
+ * The counters are plain arrays, each instance is expected to be stepped by a single thread.
+ */
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+INLINE u64 profiler_ticks() {
+    return __rdtsc();
+}
+#else
+#include <timing.h>
+INLINE u64 profiler_ticks() {
+    return timing_now_ns();
+}
+#endif
+
+// Words of RAM followed by words of BIOS, anything else is counted as "other"
+#define PROFILER_PC_RAM_WORDS  (0x200000 / 4)
+#define PROFILER_PC_BIOS_WORDS (0x80000 / 4)
+#define PROFILER_PC_SLOTS      (PROFILER_PC_RAM_WORDS + PROFILER_PC_BIOS_WORDS + 1)
+
+#define PROFILER_HANDLER_SLOTS 256
+
+typedef struct profiler_handler_slot {
+    mipsinstr_handler_t handler;
+    u64 count;
+    u64 ticks;
+} profiler_handler_slot_t;
+
+typedef struct profiler {
+    u64 opcode_count[64];
+    u64 special_count[64];
+    profiler_handler_slot_t handlers[PROFILER_HANDLER_SLOTS];
+    u64 pc_hits[PROFILER_PC_SLOTS];
+} profiler_t;
+
+extern profiler_t profiler;
+
+// Registers the report to run at exit and on SIGUSR1, only the first call does anything
+void profiler_init();
+void profiler_reset();
+void profiler_report(FILE* fp);
+// Prints the report if SIGUSR1 was received since the last call, called once per frame
+void profiler_check_signal();
+
+INLINE u32 profiler_pc_slot(u32 pc) {
+    u32 phys = pc & 0x1FFFFFFF;
+    if (phys < 0x200000) {
+        return phys >> 2;
+    } else if (phys >= 0x1FC00000 && phys < 0x1FC80000) {
+        return PROFILER_PC_RAM_WORDS + ((phys - 0x1FC00000) >> 2);
+    } else {
+        return PROFILER_PC_SLOTS - 1;
+    }
+}
+
+INLINE void profiler_record(u32 pc, mips_instruction_t instr, mipsinstr_handler_t handler, u64 ticks) {
+    profiler.opcode_count[instr.op]++;
+    if (instr.op == OPC_SPCL) {
+        profiler.special_count[instr.r.funct]++;
+    }
+
+    uintptr_t slot = ((uintptr_t)handler >> 4) % PROFILER_HANDLER_SLOTS;
+    while (profiler.handlers[slot].handler != handler) {
+        if (profiler.handlers[slot].handler == NULL) {
+            profiler.handlers[slot].handler = handler;
+            break;
+        }
+        slot = (slot + 1) % PROFILER_HANDLER_SLOTS;
+    }
+    profiler.handlers[slot].count++;
+    profiler.handlers[slot].ticks += ticks;
+
+    profiler.pc_hits[profiler_pc_slot(pc)]++;
+}
+
+#endif //PS1_PROFILER_H
@@ -0,0 +1,331 @@
+#include "sampler.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <log.h>
+#include <mem/ps1system.h>
+#include <mem/mem_util.h>
+#include "cpu.h"
+
+#define MAX_PROLOGUE_SCAN 1024
+// How far past a symbol without a size a PC is still considered part of it
+#define MAX_SYMBOL_DISTANCE 0x4000
+#define STACK_TABLE_SIZE 65536
+
+#define INSTR_JR_RA 0x03E00008
+#define IS_ADDIU_SP_SP(instr) (((instr) & 0xFFFF0000) == 0x27BD0000)
+#define IS_SW_RA_SP(instr) (((instr) & 0xFFFF0000) == 0xAFBF0000)
+
+typedef struct symbol {
+    u32 address;
+    u32 size; // 0 when the symbol file didn't give one
+    char* name;
+} symbol_t;
+
+typedef struct stack_entry {
+    sampler_sample_t stack;
+    u64 count;
+} stack_entry_t;
+
+u64 sampler_next_cycle = UINT64_MAX;
+
+static u64 sample_interval = 0;
+static const char* sampler_output_path = NULL;
+
+static sampler_sample_t ring[SAMPLER_RING_SIZE];
+static int ring_used = 0;
+
+static stack_entry_t* stacks = NULL;
+static u64 dropped_samples = 0;
+
+static symbol_t* symbols = NULL;
+static int num_symbols = 0;
+
+// Reads guest memory without side effects, only RAM and BIOS are considered valid for code and stacks
+static bool peek32(u32 virt, u32* value) {
+    u32 phys = virt & 0x1FFFFFFF;
+    if ((phys & 3) != 0) {
+        return false;
+    } else if (phys < 0x200000) {
+        *value = u32_from_byte_array(PS1SYS.mem.ram, phys);
+        return true;
+    } else if (phys >= 0x1FC00000 && phys - 0x1FC00000 < PS1SYS.mem.bios_size) {
+        *value = u32_from_byte_array(PS1SYS.mem.bios, phys - 0x1FC00000);
+        return true;
+    }
+    return false;
+}
+
+/*
+ * Finds the frame of the function containing `pc` by scanning back for its prologue:
+ *   addiu $sp, $sp, -size
+ *   ...
+ *   sw $ra, offset($sp)
+ * Returns false if no prologue was found before the previous function's `jr $ra`.
+ */
+static bool find_frame(u32 pc, u32* frame_size, s32* ra_offset, u32* prologue) {
+    *ra_offset = -1;
+    for (int i = 0; i < MAX_PROLOGUE_SCAN; i++) {
+        u32 addr = pc - i * 4;
+        u32 instr;
+        if (!peek32(addr, &instr)) {
+            return false;
+        }
+        if (i > 1 && instr == INSTR_JR_RA) {
+            return false;
+        }
+        if (IS_SW_RA_SP(instr)) {
+            *ra_offset = (s16)(instr & 0xFFFF);
+        }
+        if (IS_ADDIU_SP_SP(instr) && (s16)(instr & 0xFFFF) < 0) {
+            *frame_size = -(s16)(instr & 0xFFFF);
+            *prologue = addr;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Best guess at where the function containing `pc` starts: its prologue, or the first instruction after the previous function
+static bool guess_function_start(u32 pc, u32* start) {
+    u32 frame_size;
+    s32 ra_offset;
+    if (find_frame(pc, &frame_size, &ra_offset, start)) {
+        return true;
+    }
+    for (int i = 2; i < MAX_PROLOGUE_SCAN; i++) {
+        u32 instr;
+        if (!peek32(pc - i * 4, &instr)) {
+            return false;
+        }
+        if (instr == INSTR_JR_RA) {
+            // Skip the delay slot and any padding
+            u32 addr = pc - i * 4 + 8;
+            while (addr < pc && peek32(addr, &instr) && instr == 0) {
+                addr += 4;
+            }
+            *start = addr;
+            return true;
+        }
+    }
+    return false;
+}
+
+static void walk_stack(sampler_sample_t* sample) {
+    u32 pc = PS1CPU.prev_pc; // The instruction that just executed
+    u32 sp = PS1CPU.gpr[29];
+    u32 ra = PS1CPU.gpr[CPU_REG_LR];
+
+    sample->depth = 0;
+    sample->frames[sample->depth++] = pc;
+
+    while (sample->depth < SAMPLER_MAX_DEPTH) {
+        u32 frame_size, prologue;
+        s32 ra_offset;
+        u32 caller;
+        if (find_frame(pc, &frame_size, &ra_offset, &prologue)) {
+            if (ra_offset >= 0) {
+                if (!peek32(sp + ra_offset, &caller)) {
+                    break;
+                }
+            } else if (sample->depth == 1) {
+                // Has a frame but never saves $ra, so it calls nothing and $ra is still the return address
+                caller = ra;
+            } else {
+                break;
+            }
+            sp += frame_size;
+        } else if (sample->depth == 1) {
+            // Leaf function that never saved $ra
+            caller = ra;
+        } else {
+            break;
+        }
+
+        if (caller < 8 || caller == pc + 8) {
+            break;
+        }
+        pc = caller - 8; // Back to the call, past the delay slot
+        sample->frames[sample->depth++] = pc;
+    }
+}
+
+// By physical address, so KSEG0 and KSEG1 symbols sort together
+static int compare_symbols(const void* a, const void* b) {
+    u32 x = ((const symbol_t*)a)->address & 0x1FFFFFFF, y = ((const symbol_t*)b)->address & 0x1FFFFFFF;
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+void sampler_load_symbols(const char* path) {
+    FILE* fp = fopen(path, "r");
+    if (fp == NULL) {
+        logfatal("Unable to open symbol file %s", path);
+    }
+    char line[512];
+    char name[256];
+    unsigned int address, size;
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        size = 0;
+        if (sscanf(line, "%x %255s %x", &address, name, &size) < 2) {
+            continue;
+        }
+        symbols = realloc(symbols, sizeof(symbol_t) * (num_symbols + 1));
+        symbols[num_symbols].address = address;
+        symbols[num_symbols].size = size;
+        symbols[num_symbols].name = strdup(name);
+        num_symbols++;
+    }
+    fclose(fp);
+    qsort(symbols, num_symbols, sizeof(symbol_t), compare_symbols);
+    loginfo("Loaded symbols from %s, %d total", path, num_symbols);
+}
+
+// RAM and BIOS code never belong to each other's symbols
+static bool same_code_region(u32 a, u32 b) {
+    return (a < PS1_RAM_SIZE && b < PS1_RAM_SIZE) || (a >= 0x1FC00000 && b >= 0x1FC00000);
+}
+
+static void format_frame(u32 pc, char* buf, size_t buflen) {
+    // Greatest symbol at or below the PC. KSEG0 and KSEG1 addresses of the same code match the same symbol.
+    int lo = 0, hi = num_symbols - 1, found = -1;
+    u32 phys = pc & 0x1FFFFFFF;
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        if ((symbols[mid].address & 0x1FFFFFFF) <= phys) {
+            found = mid;
+            lo = mid + 1;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    if (found >= 0) {
+        // Only when the PC is actually inside it, not just somewhere after the last symbol
+        u32 symbol = symbols[found].address & 0x1FFFFFFF;
+        u32 size = symbols[found].size != 0 ? symbols[found].size : MAX_SYMBOL_DISTANCE;
+        if (same_code_region(symbol, phys) && phys - symbol < size) {
+            snprintf(buf, buflen, "%s", symbols[found].name);
+            return;
+        }
+    }
+
+    // Name unknown functions after where they seem to start, so all samples within one share a frame
+    u32 start;
+    if (guess_function_start(pc, &start)) {
+        snprintf(buf, buflen, "sub_%08X", start);
+        return;
+    }
+    snprintf(buf, buflen, "0x%08X", pc);
+}
+
+static u32 hash_sample(const sampler_sample_t* sample) {
+    u32 hash = 2166136261u;
+    for (int i = 0; i < sample->depth; i++) {
+        hash = (hash ^ sample->frames[i]) * 16777619u;
+    }
+    return hash;
+}
+
+// Folds the ring buffer into the per-stack counts
+static void drain_ring() {
+    for (int i = 0; i < ring_used; i++) {
+        sampler_sample_t* sample = &ring[i];
+        u32 hash = hash_sample(sample);
+        bool stored = false;
+        for (int probe = 0; probe < 64 && !stored; probe++) {
+            stack_entry_t* entry = &stacks[(hash + probe) % STACK_TABLE_SIZE];
+            if (entry->count == 0) {
+                entry->stack = *sample;
+                entry->count = 1;
+                stored = true;
+            } else if (entry->stack.depth == sample->depth
+                    && memcmp(entry->stack.frames, sample->frames, sample->depth * sizeof(u32)) == 0) {
+                entry->count++;
+                stored = true;
+            }
+        }
+        if (!stored) {
+            dropped_samples++;
+        }
+    }
+    ring_used = 0;
+}
+
+static void sampler_atexit() {
+    sampler_write_output();
+}
+
+void sampler_init(const char* output_path, u64 interval) {
+    sampler_output_path = output_path;
+    sample_interval = interval;
+    stacks = calloc(STACK_TABLE_SIZE, sizeof(stack_entry_t));
+    sampler_next_cycle = PS1SYS.cycles + interval;
+    atexit(sampler_atexit);
+}
+
+void sampler_sample() {
+    sampler_next_cycle += sample_interval;
+    walk_stack(&ring[ring_used++]);
+    if (ring_used == SAMPLER_RING_SIZE) {
+        drain_ring();
+    }
+}
+
+typedef struct collapsed_line {
+    char* stack;
+    u64 count;
+} collapsed_line_t;
+
+static int compare_lines(const void* a, const void* b) {
+    return strcmp(((const collapsed_line_t*)a)->stack, ((const collapsed_line_t*)b)->stack);
+}
+
+void sampler_write_output() {
+    if (sampler_output_path == NULL) {
+        return;
+    }
+    drain_ring();
+
+    // Different PCs within one function collapse into the same line once symbolized, so merge after formatting
+    collapsed_line_t* lines = malloc(sizeof(collapsed_line_t) * STACK_TABLE_SIZE);
+    int num_lines = 0;
+    char frame[300];
+    for (int i = 0; i < STACK_TABLE_SIZE; i++) {
+        stack_entry_t* entry = &stacks[i];
+        if (entry->count == 0) {
+            continue;
+        }
+        size_t len = 0;
+        char* stack = malloc(entry->stack.depth * sizeof(frame));
+        // Outermost caller first
+        for (int f = entry->stack.depth - 1; f >= 0; f--) {
+            format_frame(entry->stack.frames[f], frame, sizeof(frame));
+            len += sprintf(stack + len, "%s%s", frame, f > 0 ? ";" : "");
+        }
+        lines[num_lines].stack = stack;
+        lines[num_lines].count = entry->count;
+        num_lines++;
+    }
+    qsort(lines, num_lines, sizeof(collapsed_line_t), compare_lines);
+
+    FILE* fp = fopen(sampler_output_path, "w");
+    if (fp == NULL) {
+        logfatal("Unable to open %s for writing profile samples", sampler_output_path);
+    }
+    for (int i = 0; i < num_lines; i++) {
+        u64 count = lines[i].count;
+        while (i + 1 < num_lines && strcmp(lines[i].stack, lines[i + 1].stack) == 0) {
+            free(lines[i].stack);
+            count += lines[++i].count;
+        }
+        fprintf(fp, "%s %" PRIu64 "\n", lines[i].stack, count);
+        free(lines[i].stack);
+    }
+    fclose(fp);
+    free(lines);
+
+    if (dropped_samples > 0) {
+        logwarn("Sampling profiler: %" PRIu64 " samples dropped, too many distinct stacks", dropped_samples);
+    }
+}
@@ -0,0 +1,30 @@
+#ifndef PS1_SAMPLER_H
+#define PS1_SAMPLER_H
+
+#include <util.h>
+#include <stdbool.h>
+
+/*
+ * Sampling profiler for guest code. Every `interval` emulated cycles the PC and a call stack recovered from
+ * $ra/$sp and function prologues are written into a ring buffer, which is folded into per-stack counts when full.
+ * At exit the counts are written in the collapsed stack format used by flamegraph.pl and similar tools.
+ */
+
+#define SAMPLER_MAX_DEPTH 32
+#define SAMPLER_RING_SIZE 4096
+
+typedef struct sampler_sample {
+    u8 depth;
+    u32 frames[SAMPLER_MAX_DEPTH]; // Innermost first
+} sampler_sample_t;
+
+void sampler_init(const char* output_path, u64 interval);
+// Symbol files have one "ADDRESS NAME [SIZE]" per line, address and size in hex. Can be called more than once.
+void sampler_load_symbols(const char* path);
+void sampler_sample();
+void sampler_write_output();
+
+// Cycle count at which the next sample is due, never reached when the sampler is disabled
+extern u64 sampler_next_cycle;
+
+#endif //PS1_SAMPLER_H
@@ -0,0 +1,114 @@
+#include "trace.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <log.h>
+
+bool trace_enabled = false;
+
+static trace_header_t* trace_header = NULL;
+static trace_record_t* trace_records = NULL;
+static size_t trace_mapping_size = 0;
+
+void trace_open(const char* path, u64 capacity) {
+    if (capacity == 0) {
+        logfatal("The trace ring needs room for at least one record");
+    }
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        logfatal("Unable to open trace file %s", path);
+    }
+    trace_mapping_size = sizeof(trace_header_t) + capacity * sizeof(trace_record_t);
+    if (ftruncate(fd, trace_mapping_size) != 0) {
+        logfatal("Unable to size trace file %s to %zu bytes", path, trace_mapping_size);
+    }
+    void* mapping = mmap(NULL, trace_mapping_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        logfatal("Unable to map trace file %s", path);
+    }
+
+    trace_header = mapping;
+    trace_records = (trace_record_t*)(trace_header + 1);
+    memcpy(trace_header->magic, TRACE_MAGIC, sizeof(trace_header->magic));
+    trace_header->version = TRACE_VERSION;
+    trace_header->record_size = sizeof(trace_record_t);
+    trace_header->capacity = capacity;
+    trace_header->written = 0;
+    trace_enabled = true;
+    atexit(trace_close);
+}
+
+void trace_close() {
+    if (trace_header != NULL) {
+        trace_enabled = false;
+        munmap(trace_header, trace_mapping_size);
+        trace_header = NULL;
+        trace_records = NULL;
+    }
+}
+
+INLINE int load_store_width(u32 op) {
+    switch (op) {
+        case OPC_LB: case OPC_LBU: case OPC_SB:
+            return 1;
+        case OPC_LH: case OPC_LHU: case OPC_SH:
+            return 2;
+        default:
+            return 4;
+    }
+}
+
+void trace_step(u32 pc, mips_instruction_t instruction, mipsinstr_handler_t handler) {
+    u32 before[32];
+    memcpy(before, PS1CPU.gpr, sizeof(before));
+    u32 hi = PS1CPU.mult_hi;
+    u32 lo = PS1CPU.mult_lo;
+
+    handler(instruction);
+
+    trace_record_t* record = &trace_records[trace_header->written % trace_header->capacity];
+    record->pc = pc;
+    record->instruction = instruction.raw;
+    record->reg = TRACE_REG_NONE;
+    record->reg_value = 0;
+    record->mem_flags = TRACE_MEM_NONE;
+    record->mem_address = 0;
+    record->mem_value = 0;
+    record->reserved = 0;
+
+    for (int r = 1; r < 32; r++) {
+        if (PS1CPU.gpr[r] != before[r]) {
+            record->reg = r;
+            record->reg_value = PS1CPU.gpr[r];
+            break;
+        }
+    }
+    if (record->reg == TRACE_REG_NONE) {
+        if (PS1CPU.mult_lo != lo) {
+            record->reg = TRACE_REG_LO;
+            record->reg_value = PS1CPU.mult_lo;
+        } else if (PS1CPU.mult_hi != hi) {
+            record->reg = TRACE_REG_HI;
+            record->reg_value = PS1CPU.mult_hi;
+        }
+    }
+
+    // Loads and stores, op 0b100xxx and 0b101xxx
+    u32 op = instruction.op;
+    if (op >= 0b100000 && op < 0b110000 && op != OPC_CACHE) {
+        int width = load_store_width(op);
+        record->mem_address = before[instruction.i.rs] + (s16)instruction.i.immediate;
+        if (op >= 0b101000) {
+            record->mem_flags = TRACE_MEM_WRITE | width;
+            record->mem_value = width == 4 ? before[instruction.i.rt] : before[instruction.i.rt] & ((1u << (width * 8)) - 1);
+        } else {
+            record->mem_flags = TRACE_MEM_READ | width;
+            record->mem_value = PS1CPU.gpr[instruction.i.rt];
+        }
+    }
+
+    trace_header->written++;
+}
@@ -0,0 +1,53 @@
+#ifndef PS1_TRACE_H
+#define PS1_TRACE_H
+
+#include <stdbool.h>
+#include <util.h>
+#include "cpu.h"
+
+/*
+ * Binary execution trace. Every executed instruction becomes one fixed size record in a ring stored in a
+ * memory-mapped file, so the trace survives a crash and costs no syscalls while running.
+ * Decode it with ps1_trace_decode.
+ */
+
+#define TRACE_MAGIC "PS1TRACE"
+#define TRACE_VERSION 1
+
+#define TRACE_REG_NONE 0xFF
+#define TRACE_REG_HI   32
+#define TRACE_REG_LO   33
+
+#define TRACE_MEM_NONE  0
+#define TRACE_MEM_READ  0x10
+#define TRACE_MEM_WRITE 0x20
+#define TRACE_MEM_WIDTH_MASK 0x0F // Access width in bytes
+
+typedef struct trace_record {
+    u32 pc;
+    u32 instruction;
+    u32 reg_value;
+    u32 mem_address;
+    u32 mem_value;
+    u8 reg;       // GPR written by the instruction, TRACE_REG_HI/LO or TRACE_REG_NONE
+    u8 mem_flags; // TRACE_MEM_READ/WRITE | width
+    u16 reserved;
+} trace_record_t;
+
+_Static_assert(sizeof(trace_record_t) == 24, "trace records must stay 24 bytes");
+
+typedef struct trace_header {
+    char magic[8];
+    u32 version;
+    u32 record_size;
+    u64 capacity;
+    u64 written; // Total records written, the oldest one is at written % capacity once the ring has wrapped
+} trace_header_t;
+
+extern bool trace_enabled;
+
+void trace_open(const char* path, u64 capacity);
+void trace_close();
+void trace_step(u32 pc, mips_instruction_t instruction, mipsinstr_handler_t handler);
+
+#endif //PS1_TRACE_H
@@ -0,0 +1,139 @@
+#include "frontend.h"
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <SDL.h>
+
+#include <log.h>
+#include <mem/ps1system.h>
+#include <gpu/scanout.h>
+
+#define SCREEN_SCALE 2
+
+typedef struct frame {
+    u32 pixels[SCANOUT_MAX_WIDTH * SCANOUT_MAX_HEIGHT];
+    int width;
+    int height;
+} frame_t;
+
+/*
+ * Triple buffering: the emulator owns one frame (scanned out into), the presentation thread owns another,
+ * and the third sits in the middle. Both sides swap their frame with the middle one, so neither ever waits
+ * on the other. The middle index carries a flag saying whether it holds a frame that hasn't been presented yet.
+ */
+#define FRAME_FRESH 4
+
+static frame_t frames[3];
+static int emu_frame = 0;
+static int present_frame = 1;
+static atomic_int middle_frame = 2;
+
+static SDL_Window* window = NULL;
+static SDL_Renderer* renderer = NULL;
+static SDL_Texture* texture = NULL;
+
+// The instance frontend_init() was called for, run by the emulation thread
+static ps1_instance_t* instance = NULL;
+static int (*emulate_fn)(void* data) = NULL;
+static void* emulate_data = NULL;
+static atomic_bool emulation_done = false;
+
+static void frontend_vblank() {
+    frames[emu_frame].width = PS1GPU.display_width;
+    frames[emu_frame].height = PS1GPU.display_height;
+    emu_frame = atomic_exchange(&middle_frame, emu_frame | FRAME_FRESH) & ~FRAME_FRESH;
+    gpu_set_scanout_buffer(frames[emu_frame].pixels);
+}
+
+static void handle_events() {
+    SDL_Event event;
+    while (SDL_PollEvent(&event)) {
+        switch (event.type) {
+            case SDL_QUIT:
+                logalways("User requested quit");
+                // The emulation thread finishes the frame it's on and returns, see ps1_system_loop()
+                ps1_instance_request_stop(instance);
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+static void present() {
+    if (atomic_load(&middle_frame) & FRAME_FRESH) {
+        present_frame = atomic_exchange(&middle_frame, present_frame) & ~FRAME_FRESH;
+        frame_t* frame = &frames[present_frame];
+        SDL_Rect rect = { 0, 0, frame->width, frame->height };
+        SDL_UpdateTexture(texture, &rect, frame->pixels, SCANOUT_MAX_WIDTH * sizeof(u32));
+    }
+
+    frame_t* frame = &frames[present_frame];
+    SDL_Rect src = { 0, 0, frame->width, frame->height };
+    SDL_RenderClear(renderer);
+    SDL_RenderCopy(renderer, texture, &src, NULL);
+    SDL_RenderPresent(renderer);
+}
+
+static int emulation_thread(void* data) {
+    ps1_instance_select(instance);
+    int result = emulate_fn(emulate_data);
+    atomic_store(&emulation_done, true);
+    return result;
+}
+
+void frontend_init() {
+    // Video and events have to be on the main thread on some platforms (macOS), so the emulator moves off it instead
+    if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_EVENTS) != 0) {
+        logfatal("SDL_Init failed: %s", SDL_GetError());
+    }
+
+    window = SDL_CreateWindow("dgb ps1",
+                              SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
+                              SCANOUT_MAX_WIDTH * SCREEN_SCALE / 2, SCANOUT_MAX_HEIGHT * SCREEN_SCALE / 2,
+                              SDL_WINDOW_SHOWN | SDL_WINDOW_RESIZABLE);
+    if (window == NULL) {
+        logfatal("SDL_CreateWindow failed: %s", SDL_GetError());
+    }
+
+    // Only the main thread waits for vsync, the emulator keeps running
+    renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
+    if (renderer == NULL) {
+        logfatal("SDL_CreateRenderer failed: %s", SDL_GetError());
+    }
+
+    texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ABGR8888, SDL_TEXTUREACCESS_STREAMING,
+                                SCANOUT_MAX_WIDTH, SCANOUT_MAX_HEIGHT);
+    if (texture == NULL) {
+        logfatal("SDL_CreateTexture failed: %s", SDL_GetError());
+    }
+
+    frames[present_frame].width = 256;
+    frames[present_frame].height = 240;
+
+    instance = ps1_instance_current();
+    gpu_set_scanout_buffer(frames[emu_frame].pixels);
+    ps1_system_set_vblank_handler(frontend_vblank);
+}
+
+int frontend_run(int (*emulate)(void* data), void* data) {
+    emulate_fn = emulate;
+    emulate_data = data;
+    SDL_Thread* thread = SDL_CreateThread(emulation_thread, "emulation", NULL);
+    if (thread == NULL) {
+        logfatal("SDL_CreateThread failed: %s", SDL_GetError());
+    }
+
+    while (!atomic_load(&emulation_done)) {
+        handle_events();
+        present();
+    }
+
+    int result;
+    SDL_WaitThread(thread, &result);
+    SDL_DestroyTexture(texture);
+    SDL_DestroyRenderer(renderer);
+    SDL_DestroyWindow(window);
+    SDL_Quit();
+    return result;
+}
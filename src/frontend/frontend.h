@@ -0,0 +1,12 @@
+#ifndef PS1_FRONTEND_H
+#define PS1_FRONTEND_H
+
+// Opens the window for the current instance, on the main thread. Frames are handed over at every VBlank.
+void frontend_init();
+/*
+ * Runs `emulate` on a thread of its own with the instance selected, while the calling (main) thread presents frames
+ * and handles window events. Closing the window asks the instance to stop. Returns what `emulate` returned.
+ */
+int frontend_run(int (*emulate)(void* data), void* data);
+
+#endif //PS1_FRONTEND_H
@@ -2,6 +2,8 @@
 
 #include <log.h>
 #include <mem/ps1system.h>
+#include "scanout.h"
+#include <mem/dirty.h>
 
 u32 gpu_gpustat() {
     return 0x1C000000;
@@ -11,6 +13,20 @@ void draw_mode_setting(u32 value) {
     logwarn("Draw mode setting: %08X\n", value);
 }
 
+void vram_transfer_pixel(u16 pixel) {
+    int x = (PS1GPU.transfer_x + PS1GPU.transfer_pos_x) & (VRAM_WIDTH - 1);
+    int y = (PS1GPU.transfer_y + PS1GPU.transfer_pos_y) & (VRAM_HEIGHT - 1);
+    PS1GPU.vram[y * VRAM_WIDTH + x] = pixel;
+    dirty_mark_vram(y * VRAM_WIDTH + x);
+
+    if (++PS1GPU.transfer_pos_x == PS1GPU.transfer_width) {
+        PS1GPU.transfer_pos_x = 0;
+        if (++PS1GPU.transfer_pos_y == PS1GPU.transfer_height) {
+            PS1GPU.gp0_state = READY;
+        }
+    }
+}
+
 void gpu_gp0_write(u32 value) {
     switch (PS1GPU.gp0_state) {
         case READY: {
@@ -33,14 +49,24 @@ void gpu_gp0_write(u32 value) {
         }
         case A0_WAITING_FOR_DEST:
             logwarn("Rect CPU to VRAM, dest: %08X", value);
+            PS1GPU.transfer_x = value & 0x3FF;
+            PS1GPU.transfer_y = (value >> 16) & 0x1FF;
             PS1GPU.gp0_state = A0_WAITING_FOR_SIZE;
             break;
         case A0_WAITING_FOR_SIZE:
             logwarn("Rect CPU to VRAM, size: %08X", value);
+            PS1GPU.transfer_width  = (((value & 0xFFFF) - 1) & 0x3FF) + 1;
+            PS1GPU.transfer_height = ((((value >> 16) & 0xFFFF) - 1) & 0x1FF) + 1;
+            PS1GPU.transfer_pos_x = 0;
+            PS1GPU.transfer_pos_y = 0;
             PS1GPU.gp0_state = A0_TRANSFERRING_DATA;
             break;
         case A0_TRANSFERRING_DATA:
-            logfatal("A0_TRANSFERRING_DATA");
+            // Two pixels per word, the high halfword of the last word is dropped if the size is odd
+            vram_transfer_pixel(value & 0xFFFF);
+            if (PS1GPU.gp0_state == A0_TRANSFERRING_DATA) {
+                vram_transfer_pixel(value >> 16);
+            }
             break;
     }
 }
@@ -61,12 +87,16 @@ void display_mode(u32 value) {
     } parsed;
     parsed.raw = value;
 
-    int width = 0, height = 0;
+    static const int widths[] = {256, 320, 512, 640};
+    PS1GPU.display_width = parsed.h_res_2 ? 368 : widths[parsed.hres];
+    PS1GPU.display_height = (parsed.vres && parsed.v_interlace) ? 480 : 240;
+    PS1GPU.display_24bit = parsed.color_depth;
 
+    logwarn("Display mode: %dx%d %s", PS1GPU.display_width, PS1GPU.display_height, PS1GPU.display_24bit ? "24 bit" : "15 bit");
 }
 
 void display_area(u32 value) {
-    PS1GPU.display_start_x = value & 0x3FF;;
+    PS1GPU.display_start_x = value & 0x3FF;
     PS1GPU.display_start_y = (value >> 10) & 0x1FF;
 }
 
@@ -93,4 +123,11 @@ void gpu_gp1_write(u32 value) {
         default:
             logfatal("Unknown GP1 command: %02X", command);
     }
+}
+
+void gpu_vblank(bool scanout) {
+    PS1SYS.i_stat |= 1; // IRQ0, VBLANK
+    if (scanout) {
+        gpu_scanout();
+    }
 }
\ No newline at end of file
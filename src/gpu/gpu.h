@@ -1,6 +1,11 @@
 #ifndef PS1_GPU_H
 #define PS1_GPU_H
 #include <util.h>
+#include <stdbool.h>
+
+#define VRAM_WIDTH  1024
+#define VRAM_HEIGHT 512
+#define VRAM_SIZE (VRAM_WIDTH * VRAM_HEIGHT * 2)
 
 typedef enum ps1_gpu_dma_direction {
     OFF,
@@ -25,12 +30,29 @@ typedef struct ps1_gpu {
 
     ps1_gp0_state_t gp0_state;
 
+    // In-progress CPU to VRAM copy
+    int transfer_x;
+    int transfer_y;
+    int transfer_width;
+    int transfer_height;
+    int transfer_pos_x;
+    int transfer_pos_y;
+
     int display_start_x;
     int display_start_y;
+    int display_width;
+    int display_height;
+    bool display_24bit;
+
+    // Owned by the frontend, see gpu_set_scanout_buffer()
+    u32* scanout_buffer;
 
+    // VRAM_WIDTH * VRAM_HEIGHT pixels, part of the instance's guest memory
+    u16* vram;
 } ps1_gpu_t;
 
 u32 gpu_gpustat();
 void gpu_gp0_write(u32 value);
 void gpu_gp1_write(u32 value);
+void gpu_vblank(bool scanout);
 #endif //PS1_GPU_H
@@ -0,0 +1,131 @@
+#include "scanout.h"
+
+#include <stdbool.h>
+#include <mem/ps1system.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCANOUT_X86
+#endif
+
+INLINE u32 rgb555_to_rgba8888(u16 pixel) {
+    u32 r = pixel & 0x1F;
+    u32 g = (pixel >> 5) & 0x1F;
+    u32 b = (pixel >> 10) & 0x1F;
+    r = (r << 3) | (r >> 2);
+    g = (g << 3) | (g >> 2);
+    b = (b << 3) | (b >> 2);
+    return 0xFF000000 | (b << 16) | (g << 8) | r;
+}
+
+// Converts `count` consecutive 15 bit pixels
+static void scanout_row_15bit(const u16* src, u32* dst, int count) {
+    int i = 0;
+#ifdef __SSE2__
+    // Eight pixels at a time. Each 16 bit lane is expanded into an (R | G << 8) and a (B | A << 8) half,
+    // then the halves are interleaved into 32 bit pixels.
+    const __m128i mask_r_hi = _mm_set1_epi16(0x00F8);
+    const __m128i mask_r_lo = _mm_set1_epi16(0x0007);
+    const __m128i mask_g_hi = _mm_set1_epi16((short)0xF800);
+    const __m128i mask_g_lo = _mm_set1_epi16(0x0700);
+    const __m128i alpha     = _mm_set1_epi16((short)0xFF00);
+    for (; i + 8 <= count; i += 8) {
+        __m128i px = _mm_loadu_si128((const __m128i*)(src + i));
+        __m128i rg = _mm_or_si128(
+                _mm_or_si128(_mm_and_si128(_mm_slli_epi16(px, 3), mask_r_hi), _mm_and_si128(_mm_srli_epi16(px, 2), mask_r_lo)),
+                _mm_or_si128(_mm_and_si128(_mm_slli_epi16(px, 6), mask_g_hi), _mm_and_si128(_mm_slli_epi16(px, 1), mask_g_lo)));
+        __m128i ba = _mm_or_si128(
+                _mm_or_si128(_mm_and_si128(_mm_srli_epi16(px, 7), mask_r_hi), _mm_and_si128(_mm_srli_epi16(px, 12), mask_r_lo)),
+                alpha);
+        _mm_storeu_si128((__m128i*)(dst + i),     _mm_unpacklo_epi16(rg, ba));
+        _mm_storeu_si128((__m128i*)(dst + i + 4), _mm_unpackhi_epi16(rg, ba));
+    }
+#endif
+    for (; i < count; i++) {
+        dst[i] = rgb555_to_rgba8888(src[i]);
+    }
+}
+
+// Converts `count` packed 24 bit pixels. Reads up to 4 bytes past the last pixel, callers make sure they're in bounds.
+#ifdef SCANOUT_X86
+__attribute__((target("ssse3")))
+static void scanout_row_24bit_ssse3(const u8* src, u32* dst, int count) {
+    const __m128i shuffle = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+    const __m128i alpha = _mm_set1_epi32((int)0xFF000000);
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128i px = _mm_loadu_si128((const __m128i*)(src + i * 3));
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_or_si128(_mm_shuffle_epi8(px, shuffle), alpha));
+    }
+    for (; i < count; i++) {
+        const u8* p = src + i * 3;
+        dst[i] = 0xFF000000 | (p[2] << 16) | (p[1] << 8) | p[0];
+    }
+}
+#endif
+
+static void scanout_row_24bit_generic(const u8* src, u32* dst, int count) {
+    for (int i = 0; i < count; i++) {
+        const u8* p = src + i * 3;
+        dst[i] = 0xFF000000 | (p[2] << 16) | (p[1] << 8) | p[0];
+    }
+}
+
+static void (*scanout_row_24bit)(const u8* src, u32* dst, int count) = NULL;
+
+void gpu_set_scanout_buffer(u32* buffer) {
+    if (scanout_row_24bit == NULL) {
+        scanout_row_24bit = scanout_row_24bit_generic;
+#ifdef SCANOUT_X86
+        if (__builtin_cpu_supports("ssse3")) {
+            scanout_row_24bit = scanout_row_24bit_ssse3;
+        }
+#endif
+    }
+    PS1GPU.scanout_buffer = buffer;
+}
+
+// Slow path for rows that wrap around the right edge of VRAM
+static void scanout_row_wrapped(int x, const u16* row, u32* dst, int width, bool is_24bit) {
+    const u8* bytes = (const u8*)row;
+    for (int i = 0; i < width; i++) {
+        if (is_24bit) {
+            int offset = x * 2 + i * 3;
+            u8 r = bytes[offset % (VRAM_WIDTH * 2)];
+            u8 g = bytes[(offset + 1) % (VRAM_WIDTH * 2)];
+            u8 b = bytes[(offset + 2) % (VRAM_WIDTH * 2)];
+            dst[i] = 0xFF000000 | (b << 16) | (g << 8) | r;
+        } else {
+            dst[i] = rgb555_to_rgba8888(row[(x + i) & (VRAM_WIDTH - 1)]);
+        }
+    }
+}
+
+void gpu_scanout() {
+    u32* buffer = PS1GPU.scanout_buffer;
+    if (buffer == NULL) {
+        return;
+    }
+
+    int x = PS1GPU.display_start_x;
+    int width = PS1GPU.display_width;
+    int height = PS1GPU.display_height;
+    bool is_24bit = PS1GPU.display_24bit;
+
+    // Width of the displayed area in VRAM, in halfwords. The 24 bit kernel may over-read by 4 bytes.
+    int vram_span = is_24bit ? (width * 3 + 1) / 2 + 2 : width;
+    bool fits = x + vram_span <= VRAM_WIDTH;
+
+    for (int line = 0; line < height; line++) {
+        int y = (PS1GPU.display_start_y + line) & (VRAM_HEIGHT - 1);
+        const u16* row = &PS1GPU.vram[y * VRAM_WIDTH];
+        u32* dst = buffer + line * SCANOUT_MAX_WIDTH;
+        if (!fits) {
+            scanout_row_wrapped(x, row, dst, width, is_24bit);
+        } else if (is_24bit) {
+            scanout_row_24bit((const u8*)(row + x), dst, width);
+        } else {
+            scanout_row_15bit(row + x, dst, width);
+        }
+    }
+}
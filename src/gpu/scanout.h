@@ -0,0 +1,17 @@
+#ifndef PS1_SCANOUT_H
+#define PS1_SCANOUT_H
+
+#include <util.h>
+
+// Largest display area the GPU can output, the scanout buffer must hold at least this many pixels.
+#define SCANOUT_MAX_WIDTH  640
+#define SCANOUT_MAX_HEIGHT 480
+
+/*
+ * The buffer is owned by the frontend and written to in place every VBlank, as RGBA8888
+ * (bytes R, G, B, A in memory) with a pitch of SCANOUT_MAX_WIDTH pixels. NULL disables scanout.
+ */
+void gpu_set_scanout_buffer(u32* buffer);
+void gpu_scanout();
+
+#endif //PS1_SCANOUT_H
@@ -0,0 +1,1176 @@
+#include "hle.h"
+
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <ctype.h>
+
+#include <log.h>
+#include <cpu/cpu.h>
+#include <gpu/gpu.h>
+#include <mem/bus.h>
+#include <mem/dirty.h>
+#include <mem/mem_util.h>
+#include <mem/ps1system.h>
+
+// Entry points, each holds a `j self` loop in RAM so a blocked call just comes back around
+#define HLE_VECTOR_EXCEPTION 0x80
+#define HLE_VECTOR_A0 0xA0
+#define HLE_VECTOR_B0 0xB0
+#define HLE_VECTOR_C0 0xC0
+// Where the CPU is parked when there's nothing to run: before an EXE is loaded and after it exits
+#define HLE_HALT 0xD0
+
+#define KSEG0(address) (0x80000000 | (address))
+
+// Kernel variables
+#define HLE_VAR_THREAD     KSEG0(0x500) // Index of the running thread
+#define HLE_VAR_HEAP_START KSEG0(0x504)
+#define HLE_VAR_HEAP_END   KSEG0(0x508)
+#define HLE_VAR_RAND       KSEG0(0x50C)
+
+// Event control blocks
+#define HLE_EVENTS KSEG0(0x1000)
+#define HLE_NUM_EVENTS 32
+#define HLE_EVENT_SIZE 0x1C
+#define EVENT_CLASS  0x00
+#define EVENT_STATUS 0x04
+#define EVENT_SPEC   0x08
+#define EVENT_MODE   0x0C
+#define EVENT_FUNC   0x10
+#define EVENT_HANDLE 0xF1000000
+
+#define EVENT_STATUS_FREE     0x0000
+#define EVENT_STATUS_DISABLED 0x1000
+#define EVENT_STATUS_ENABLED  0x2000
+#define EVENT_STATUS_READY    0x4000
+#define EVENT_MODE_CALLBACK   0x1000
+#define EVENT_MODE_READY      0x2000
+
+// Root counter 3 is VBlank
+#define EVENT_CLASS_VBLANK   0xF2000003
+#define EVENT_SPEC_INTERRUPT 0x0002
+
+// Thread control blocks, thread 0 is the one the EXE starts on
+#define HLE_THREADS KSEG0(0x2000)
+#define HLE_NUM_THREADS 4
+#define HLE_THREAD_SIZE 0xC0
+#define THREAD_STATUS 0x00
+#define THREAD_GPR    0x08
+#define THREAD_PC     0x88
+#define THREAD_HI     0x8C
+#define THREAD_LO     0x90
+#define THREAD_HANDLE 0xFF000000
+#define THREAD_STATUS_USED 0x4000
+
+// Open files. Descriptors 0 and 1 are the TTY, files on the disc start at 2.
+#define HLE_FILES KSEG0(0x2400)
+#define HLE_NUM_FILES 16
+#define HLE_FILE_SIZE 0x10
+#define FILE_STATUS 0x00
+#define FILE_LBA    0x04
+#define FILE_LENGTH 0x08
+#define FILE_POS    0x0C
+#define FILE_STATUS_OPEN 1
+#define FILE_FIRST_FD 2
+
+#define FILE_MODE_WRITE 2
+
+#define SYSCALL_ENTER_CRITICAL 1
+#define SYSCALL_EXIT_CRITICAL  2
+
+#define REG_V0 2
+#define REG_A0 4
+#define REG_T1 9
+#define REG_S0 16
+#define REG_GP 28
+#define REG_SP 29
+#define REG_FP 30
+#define REG_RA 31
+
+#define ARG(n) PS1CPU.gpr[REG_A0 + (n)]
+// Functions return true to go back to the caller with v0 set, false when they moved the PC themselves or are blocked
+#define RETURN(value) do { PS1CPU.gpr[REG_V0] = (value); return true; } while (0)
+
+typedef bool (*hle_function_t)();
+
+typedef struct hle_entry {
+    const char* name;
+    hle_function_t function;
+} hle_entry_t;
+
+// Functions that aren't implemented are reported once each
+static _Thread_local u64 warned[3][4];
+
+// Pointer into RAM for [address, address + size), or NULL if that isn't all in RAM
+static u8* ram_span(u32 address, u32 size) {
+    u32 phys = address & 0x1FFFFFFF;
+    if (phys >= PS1_RAM_SIZE || size > PS1_RAM_SIZE - phys) {
+        return NULL;
+    }
+    return PS1SYS.mem.ram + phys;
+}
+
+static void copy_guest(u32 dst, u32 src, u32 size) {
+    u8* to = ram_span(dst, size);
+    const u8* from = ram_span(src, size);
+    if (to != NULL && from != NULL) {
+        memmove(to, from, size);
+        dirty_mark_ram_range(dst, size);
+    } else {
+        for (u32 i = 0; i < size; i++) {
+            ps1_write8(dst + i, ps1_read8(src + i));
+        }
+    }
+}
+
+static void write_guest(u32 dst, const u8* data, u32 size) {
+    u8* to = ram_span(dst, size);
+    if (to != NULL) {
+        memcpy(to, data, size);
+        dirty_mark_ram_range(dst, size);
+    } else {
+        for (u32 i = 0; i < size; i++) {
+            ps1_write8(dst + i, data[i]);
+        }
+    }
+}
+
+static void fill_guest(u32 dst, u8 value, u32 size) {
+    u8* to = ram_span(dst, size);
+    if (to != NULL) {
+        memset(to, value, size);
+        dirty_mark_ram_range(dst, size);
+    } else {
+        for (u32 i = 0; i < size; i++) {
+            ps1_write8(dst + i, value);
+        }
+    }
+}
+
+// Copies a NUL terminated guest string, truncating it to fit
+static void read_string(u32 address, char* out, size_t size) {
+    size_t i = 0;
+    while (i + 1 < size) {
+        char c = ps1_read8(address + i);
+        if (c == '\0') {
+            break;
+        }
+        out[i++] = c;
+    }
+    out[i] = '\0';
+}
+
+static u32 guest_strlen(u32 s) {
+    u32 length = 0;
+    while (ps1_read8(s + length) != '\0') {
+        length++;
+    }
+    return length;
+}
+
+static void tty_write(const char* s, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        ps1_system_tty_putchar(s[i]);
+    }
+}
+
+// ---- A0h: C library ----
+
+static bool hle_abs() {
+    s32 value = ARG(0);
+    RETURN(value < 0 ? -value : value);
+}
+
+static bool hle_atoi() {
+    char buffer[32];
+    read_string(ARG(0), buffer, sizeof(buffer));
+    RETURN(strtol(buffer, NULL, 10));
+}
+
+static bool hle_setjmp() {
+    u32 buffer = ARG(0);
+    ps1_write32(buffer + 0x00, PS1CPU.gpr[REG_RA]);
+    ps1_write32(buffer + 0x04, PS1CPU.gpr[REG_SP]);
+    ps1_write32(buffer + 0x08, PS1CPU.gpr[REG_FP]);
+    for (int i = 0; i < 8; i++) {
+        ps1_write32(buffer + 0x0C + i * 4, PS1CPU.gpr[REG_S0 + i]);
+    }
+    ps1_write32(buffer + 0x2C, PS1CPU.gpr[REG_GP]);
+    RETURN(0);
+}
+
+static bool hle_longjmp() {
+    u32 buffer = ARG(0);
+    PS1CPU.gpr[REG_V0] = ARG(1);
+    PS1CPU.gpr[REG_RA] = ps1_read32(buffer + 0x00);
+    PS1CPU.gpr[REG_SP] = ps1_read32(buffer + 0x04);
+    PS1CPU.gpr[REG_FP] = ps1_read32(buffer + 0x08);
+    for (int i = 0; i < 8; i++) {
+        PS1CPU.gpr[REG_S0 + i] = ps1_read32(buffer + 0x0C + i * 4);
+    }
+    PS1CPU.gpr[REG_GP] = ps1_read32(buffer + 0x2C);
+    cpu_set_pc(PS1CPU.gpr[REG_RA]);
+    return false;
+}
+
+static bool hle_strcat() {
+    u32 dst = ARG(0);
+    u32 src = ARG(1);
+    if (dst == 0 || src == 0) {
+        RETURN(0);
+    }
+    copy_guest(dst + guest_strlen(dst), src, guest_strlen(src) + 1);
+    RETURN(dst);
+}
+
+static bool hle_strncat() {
+    u32 dst = ARG(0);
+    u32 src = ARG(1);
+    u32 n = ARG(2);
+    if (dst == 0 || src == 0) {
+        RETURN(0);
+    }
+    u32 end = dst + guest_strlen(dst);
+    u32 i = 0;
+    for (u8 c; i < n && (c = ps1_read8(src + i)) != '\0'; i++) {
+        ps1_write8(end + i, c);
+    }
+    ps1_write8(end + i, '\0');
+    RETURN(dst);
+}
+
+static bool hle_strcmp() {
+    u32 a = ARG(0);
+    u32 b = ARG(1);
+    for (;; a++, b++) {
+        u8 ca = ps1_read8(a);
+        u8 cb = ps1_read8(b);
+        if (ca != cb || ca == '\0') {
+            RETURN((s32)ca - (s32)cb);
+        }
+    }
+}
+
+static bool hle_strncmp() {
+    u32 a = ARG(0);
+    u32 b = ARG(1);
+    for (u32 i = 0; i < ARG(2); i++) {
+        u8 ca = ps1_read8(a + i);
+        u8 cb = ps1_read8(b + i);
+        if (ca != cb || ca == '\0') {
+            RETURN((s32)ca - (s32)cb);
+        }
+    }
+    RETURN(0);
+}
+
+static bool hle_strcpy() {
+    u32 dst = ARG(0);
+    u32 src = ARG(1);
+    if (dst == 0 || src == 0) {
+        RETURN(0);
+    }
+    copy_guest(dst, src, guest_strlen(src) + 1);
+    RETURN(dst);
+}
+
+static bool hle_strncpy() {
+    u32 dst = ARG(0);
+    u32 src = ARG(1);
+    u32 n = ARG(2);
+    if (dst == 0 || src == 0) {
+        RETURN(0);
+    }
+    u32 i = 0;
+    for (u8 c; i < n && (c = ps1_read8(src + i)) != '\0'; i++) {
+        ps1_write8(dst + i, c);
+    }
+    fill_guest(dst + i, 0, n - i);
+    RETURN(dst);
+}
+
+static bool hle_strlen() {
+    RETURN(ARG(0) == 0 ? 0 : guest_strlen(ARG(0)));
+}
+
+static bool hle_strchr() {
+    u8 c = ARG(1);
+    for (u32 s = ARG(0); s != 0; s++) {
+        u8 here = ps1_read8(s);
+        if (here == c) {
+            RETURN(s);
+        }
+        if (here == '\0') {
+            break;
+        }
+    }
+    RETURN(0);
+}
+
+static bool hle_strrchr() {
+    u8 c = ARG(1);
+    u32 found = 0;
+    for (u32 s = ARG(0); s != 0; s++) {
+        u8 here = ps1_read8(s);
+        if (here == c) {
+            found = s;
+        }
+        if (here == '\0') {
+            break;
+        }
+    }
+    RETURN(found);
+}
+
+static bool hle_toupper() {
+    RETURN(toupper(ARG(0) & 0xFF));
+}
+
+static bool hle_tolower() {
+    RETURN(tolower(ARG(0) & 0xFF));
+}
+
+static bool hle_bcopy() {
+    copy_guest(ARG(1), ARG(0), ARG(2));
+    RETURN(0);
+}
+
+static bool hle_bzero() {
+    fill_guest(ARG(0), 0, ARG(1));
+    RETURN(0);
+}
+
+static bool hle_memcmp() {
+    for (u32 i = 0; i < ARG(2); i++) {
+        u8 a = ps1_read8(ARG(0) + i);
+        u8 b = ps1_read8(ARG(1) + i);
+        if (a != b) {
+            RETURN((s32)a - (s32)b);
+        }
+    }
+    RETURN(0);
+}
+
+static bool hle_memcpy() {
+    copy_guest(ARG(0), ARG(1), ARG(2));
+    RETURN(ARG(0));
+}
+
+static bool hle_memset() {
+    fill_guest(ARG(0), ARG(1), ARG(2));
+    RETURN(ARG(0));
+}
+
+static bool hle_memchr() {
+    for (u32 i = 0; i < ARG(2); i++) {
+        if (ps1_read8(ARG(0) + i) == (ARG(1) & 0xFF)) {
+            RETURN(ARG(0) + i);
+        }
+    }
+    RETURN(0);
+}
+
+static bool hle_rand() {
+    u32 seed = ps1_read32(HLE_VAR_RAND) * 0x41C64E6D + 0x3039;
+    ps1_write32(HLE_VAR_RAND, seed);
+    RETURN((seed >> 16) & 0x7FFF);
+}
+
+static bool hle_srand() {
+    ps1_write32(HLE_VAR_RAND, ARG(0));
+    RETURN(0);
+}
+
+/*
+ * First fit heap. Every block starts with a header word holding its size, the low bit is set while it's in use.
+ */
+#define HEAP_USED 1
+
+static u32 heap_alloc(u32 size) {
+    size = (size + 3) & ~3;
+    if (size == 0) {
+        size = 4;
+    }
+    u32 end = ps1_read32(HLE_VAR_HEAP_END);
+    for (u32 block = ps1_read32(HLE_VAR_HEAP_START); block != 0 && block + 4 <= end;) {
+        u32 header = ps1_read32(block);
+        u32 block_size = header & ~3;
+        if (block_size == 0) {
+            break; // Trampled by the game
+        }
+        if (!(header & HEAP_USED) && block_size >= size) {
+            // Split off the rest when there's room for another block
+            if (block_size >= size + 8) {
+                ps1_write32(block + 4 + size, block_size - size - 4);
+                block_size = size;
+            }
+            ps1_write32(block, block_size | HEAP_USED);
+            return block + 4;
+        }
+        block += 4 + block_size;
+    }
+    return 0;
+}
+
+static void heap_free(u32 address) {
+    if (address == 0) {
+        return;
+    }
+    u32 block = address - 4;
+    u32 size = ps1_read32(block) & ~3;
+    u32 end = ps1_read32(HLE_VAR_HEAP_END);
+    // Merge with the free blocks that follow
+    for (u32 next = block + 4 + size; next + 4 <= end; next = block + 4 + size) {
+        u32 header = ps1_read32(next);
+        if ((header & HEAP_USED) || (header & ~3) == 0) {
+            break;
+        }
+        size += 4 + (header & ~3);
+    }
+    ps1_write32(block, size);
+}
+
+static bool hle_malloc() {
+    RETURN(heap_alloc(ARG(0)));
+}
+
+static bool hle_free() {
+    heap_free(ARG(0));
+    RETURN(0);
+}
+
+static bool hle_calloc() {
+    u32 size = ARG(0) * ARG(1);
+    u32 address = heap_alloc(size);
+    if (address != 0) {
+        fill_guest(address, 0, size);
+    }
+    RETURN(address);
+}
+
+static bool hle_realloc() {
+    u32 old = ARG(0);
+    u32 size = ARG(1);
+    if (old == 0) {
+        RETURN(heap_alloc(size));
+    }
+    if (size == 0) {
+        heap_free(old);
+        RETURN(0);
+    }
+    u32 address = heap_alloc(size);
+    if (address != 0) {
+        u32 old_size = ps1_read32(old - 4) & ~3;
+        copy_guest(address, old, old_size < size ? old_size : size);
+        heap_free(old);
+    }
+    RETURN(address);
+}
+
+static bool hle_init_heap() {
+    u32 start = (ARG(0) + 3) & ~3;
+    u32 size = (ARG(1) - (start - ARG(0))) & ~3;
+    ps1_write32(HLE_VAR_HEAP_START, start);
+    ps1_write32(HLE_VAR_HEAP_END, start + size);
+    ps1_write32(start, size - 4);
+    RETURN(0);
+}
+
+static bool hle_exit() {
+    loginfo("HLE BIOS: exit(%d)", (s32)ARG(0));
+    cpu_set_pc(KSEG0(HLE_HALT));
+    return false;
+}
+
+static bool hle_putchar() {
+    ps1_system_tty_putchar(ARG(0));
+    RETURN(ARG(0));
+}
+
+static bool hle_puts() {
+    char buffer[256];
+    for (u32 s = ARG(0); s != 0;) {
+        read_string(s, buffer, sizeof(buffer));
+        size_t length = strlen(buffer);
+        tty_write(buffer, length);
+        if (length < sizeof(buffer) - 1) {
+            break;
+        }
+        s += length;
+    }
+    ps1_system_tty_putchar('\n');
+    RETURN(1);
+}
+
+// printf's arguments after the format string, the first three are in a1-a3 and the rest on the stack
+static u32 printf_arg(int n) {
+    return n < 4 ? ARG(n) : ps1_read32(PS1CPU.gpr[REG_SP] + n * 4);
+}
+
+static bool hle_printf() {
+    u32 format = ARG(0);
+    int next_arg = 1;
+    u32 written = 0;
+    char out[512];
+    for (u8 c; (c = ps1_read8(format++)) != '\0';) {
+        if (c != '%') {
+            ps1_system_tty_putchar(c);
+            written++;
+            continue;
+        }
+        /*
+         * Rebuilt as a host format string, with the guest's arguments in place of any '*'. The spec ends at the first
+         * character that can't be a flag, width or precision, and only the conversions below ever reach the host's
+         * snprintf, each with exactly one argument. Anything else (%f, %S, a spec too long to rebuild) is printed as is.
+         */
+        char spec[32] = "%";
+        size_t spec_length = 1;
+        char raw[64] = "%";
+        size_t raw_length = 1;
+        bool valid = true;
+        while ((c = ps1_read8(format++)) != '\0') {
+            if (raw_length < sizeof(raw) - 1) {
+                raw[raw_length++] = c;
+            }
+            if (c == 'l' || c == 'h') {
+                // Everything is 32 bits
+            } else if (c == '*') {
+                char width[16];
+                int length = snprintf(width, sizeof(width), "%d", (s32)printf_arg(next_arg++));
+                if (spec_length + length < sizeof(spec) - 2) {
+                    memcpy(spec + spec_length, width, length);
+                    spec_length += length;
+                } else {
+                    valid = false;
+                }
+            } else if (strchr("-+ #0123456789.", c) != NULL) {
+                if (spec_length < sizeof(spec) - 2) {
+                    spec[spec_length++] = c;
+                } else {
+                    valid = false;
+                }
+            } else {
+                break;
+            }
+        }
+        if (c == '\0') {
+            format--;
+        } else if (strchr("diouxXcspn%", c) == NULL) {
+            valid = false;
+        }
+        spec[spec_length++] = c == 'p' ? 'x' : c;
+        spec[spec_length] = '\0';
+        int length;
+        if (!valid || c == '\0') {
+            length = snprintf(out, sizeof(out), "%.*s", (int)raw_length, raw);
+        } else if (c == '%') {
+            length = snprintf(out, sizeof(out), "%%");
+        } else if (c == 's') {
+            char string[256];
+            u32 address = printf_arg(next_arg++);
+            read_string(address, string, sizeof(string));
+            length = snprintf(out, sizeof(out), spec, address == 0 ? "(null)" : string);
+        } else if (c == 'n') {
+            ps1_write32(printf_arg(next_arg++), written);
+            length = 0;
+        } else if (c == 'd' || c == 'i' || c == 'c') {
+            length = snprintf(out, sizeof(out), spec, (s32)printf_arg(next_arg++));
+        } else {
+            length = snprintf(out, sizeof(out), spec, printf_arg(next_arg++));
+        }
+        if (length > (int)sizeof(out) - 1) {
+            length = sizeof(out) - 1;
+        }
+        tty_write(out, length);
+        written += length;
+    }
+    RETURN(written);
+}
+
+static bool hle_flush_cache() {
+    RETURN(0);
+}
+
+static bool hle_gp1_command() {
+    gpu_gp1_write(ARG(0));
+    RETURN(0);
+}
+
+static bool hle_gp0_command() {
+    gpu_gp0_write(ARG(0));
+    RETURN(0);
+}
+
+static bool hle_gp0_command_words() {
+    for (u32 i = 0; i < ARG(1); i++) {
+        gpu_gp0_write(ps1_read32(ARG(0) + i * 4));
+    }
+    RETURN(0);
+}
+
+static bool hle_gpu_linked_list() {
+    u32 node = ARG(0) & 0x1FFFFC;
+    // Bounded, in case the list loops
+    for (int nodes = 0; nodes < 0x100000; nodes++) {
+        u32 header = ps1_read32(KSEG0(node));
+        for (u32 i = 0; i < header >> 24; i++) {
+            gpu_gp0_write(ps1_read32(KSEG0(node + 4 + i * 4)));
+        }
+        if (header & 0x800000) {
+            break;
+        }
+        node = header & 0x1FFFFC;
+    }
+    RETURN(0);
+}
+
+static bool hle_gpu_status() {
+    RETURN(gpu_gpustat());
+}
+
+static bool hle_gpu_sync() {
+    RETURN(0);
+}
+
+// The 0x800 bytes of data of the disc's sector at `lba`
+static const u8* iso_sector(u32 lba) {
+    const u8* sector = disc_sector(PS1SYS.disc, lba);
+    return sector + disc_data_offset(sector);
+}
+
+// A directory record's name against one path component. "FILE.EXT" matches "FILE.EXT;1" and "FILE" matches "FILE.;1".
+static bool iso_name_matches(const u8* id, size_t id_length, const char* name, size_t name_length) {
+    if (memchr(name, ';', name_length) == NULL) {
+        const u8* version = memchr(id, ';', id_length);
+        if (version != NULL) {
+            id_length = version - id;
+        }
+        if (id_length > 0 && id[id_length - 1] == '.' && memchr(name, '.', name_length) == NULL) {
+            id_length--;
+        }
+    }
+    return id_length == name_length && strncasecmp((const char*)id, name, name_length) == 0;
+}
+
+// Looks one path component up in the directory at `*lba`, replacing the extent with the entry's
+static bool iso_find(const char* name, size_t name_length, u32* lba, u32* length, bool* directory) {
+    u32 offset = 0;
+    while (offset < *length) {
+        const u8* record = iso_sector(*lba + offset / 0x800) + offset % 0x800;
+        // Records never cross a sector, the rest of one is padded with zeroes
+        if (record[0] == 0) {
+            offset = (offset / 0x800 + 1) * 0x800;
+            continue;
+        }
+        if (record[0] < 34 || offset % 0x800 + record[0] > 0x800) {
+            return false;
+        }
+        if (iso_name_matches(record + 33, record[32], name, name_length)) {
+            *lba = u32_from_byte_array(record, 2);
+            *length = u32_from_byte_array(record, 10);
+            *directory = (record[25] & 2) != 0;
+            return true;
+        }
+        offset += record[0];
+    }
+    return false;
+}
+
+// Finds a file on the ISO9660 filesystem of the disc in the drive, `path` is what follows "cdrom:"
+static bool iso_lookup(const char* path, u32* lba, u32* length) {
+    if (PS1SYS.disc == NULL) {
+        return false;
+    }
+    const u8* descriptor = iso_sector(16);
+    if (descriptor[0] != 1 || memcmp(descriptor + 1, "CD001", 5) != 0) {
+        return false;
+    }
+    // The root directory's record is in the primary volume descriptor
+    *lba = u32_from_byte_array(descriptor, 156 + 2);
+    *length = u32_from_byte_array(descriptor, 156 + 10);
+    bool directory = true;
+    while (*path != '\0') {
+        size_t name_length = strcspn(path, "\\/");
+        if (name_length > 0 && (!directory || !iso_find(path, name_length, lba, length, &directory))) {
+            return false;
+        }
+        path += name_length;
+        if (*path != '\0') {
+            path++;
+        }
+    }
+    return !directory;
+}
+
+static u32 file_address(u32 fd) {
+    if (fd < FILE_FIRST_FD || fd >= FILE_FIRST_FD + HLE_NUM_FILES) {
+        return 0;
+    }
+    u32 file = HLE_FILES + (fd - FILE_FIRST_FD) * HLE_FILE_SIZE;
+    return ps1_read32(file + FILE_STATUS) == FILE_STATUS_OPEN ? file : 0;
+}
+
+// Only files on the disc can be opened, read-only
+static bool hle_open() {
+    char name[128];
+    read_string(ARG(0), name, sizeof(name));
+    const char* path = NULL;
+    if (strncasecmp(name, "cdrom:", 6) == 0) {
+        path = name + 6;
+    } else if (strncasecmp(name, "cdrom0:", 7) == 0) {
+        path = name + 7;
+    }
+    u32 lba, length;
+    if (path == NULL || (ARG(1) & FILE_MODE_WRITE) || !iso_lookup(path, &lba, &length)) {
+        loginfo("HLE BIOS: open(\"%s\", %x) failed", name, ARG(1));
+        RETURN(-1);
+    }
+    for (int i = 0; i < HLE_NUM_FILES; i++) {
+        u32 file = HLE_FILES + i * HLE_FILE_SIZE;
+        if (ps1_read32(file + FILE_STATUS) != FILE_STATUS_OPEN) {
+            ps1_write32(file + FILE_STATUS, FILE_STATUS_OPEN);
+            ps1_write32(file + FILE_LBA, lba);
+            ps1_write32(file + FILE_LENGTH, length);
+            ps1_write32(file + FILE_POS, 0);
+            RETURN(FILE_FIRST_FD + i);
+        }
+    }
+    logwarn("HLE BIOS: open(\"%s\") failed, all %d files are open", name, HLE_NUM_FILES);
+    RETURN(-1);
+}
+
+static bool hle_read() {
+    u32 file = file_address(ARG(0));
+    if (file == 0) {
+        RETURN(-1);
+    }
+    u32 lba = ps1_read32(file + FILE_LBA);
+    u32 length = ps1_read32(file + FILE_LENGTH);
+    u32 pos = ps1_read32(file + FILE_POS);
+    u32 count = ARG(2) < length - pos ? ARG(2) : length - pos;
+    u32 dst = ARG(1);
+    for (u32 done = 0; done < count;) {
+        u32 offset = (pos + done) % 0x800;
+        u32 chunk = 0x800 - offset < count - done ? 0x800 - offset : count - done;
+        write_guest(dst + done, iso_sector(lba + (pos + done) / 0x800) + offset, chunk);
+        done += chunk;
+    }
+    ps1_write32(file + FILE_POS, pos + count);
+    RETURN(count);
+}
+
+static bool hle_lseek() {
+    u32 file = file_address(ARG(0));
+    if (file == 0) {
+        RETURN(-1);
+    }
+    s64 pos;
+    switch (ARG(2)) {
+        case 0: pos = (s32)ARG(1); break; // SEEK_SET
+        case 1: pos = (s64)ps1_read32(file + FILE_POS) + (s32)ARG(1); break; // SEEK_CUR
+        case 2: pos = (s64)ps1_read32(file + FILE_LENGTH) + (s32)ARG(1); break; // SEEK_END
+        default: RETURN(-1);
+    }
+    if (pos < 0 || pos > ps1_read32(file + FILE_LENGTH)) {
+        RETURN(-1);
+    }
+    ps1_write32(file + FILE_POS, pos);
+    RETURN(pos);
+}
+
+static bool hle_write() {
+    if (ARG(0) != 1) {
+        RETURN(-1);
+    }
+    for (u32 i = 0; i < ARG(2); i++) {
+        ps1_system_tty_putchar(ps1_read8(ARG(1) + i));
+    }
+    RETURN(ARG(2));
+}
+
+static bool hle_close() {
+    u32 file = file_address(ARG(0));
+    if (file != 0) {
+        ps1_write32(file + FILE_STATUS, 0);
+    }
+    RETURN(ARG(0));
+}
+
+// ---- B0h: events, threads and pads ----
+
+// Address of the EvCB for a handle, 0 if it isn't one
+static u32 event_address(u32 handle) {
+    u32 index = handle & 0xFFFF;
+    if ((handle & 0xFFFF0000) != EVENT_HANDLE || index >= HLE_NUM_EVENTS) {
+        return 0;
+    }
+    return HLE_EVENTS + index * HLE_EVENT_SIZE;
+}
+
+static void deliver_event(u32 class, u32 spec) {
+    for (int i = 0; i < HLE_NUM_EVENTS; i++) {
+        u32 event = HLE_EVENTS + i * HLE_EVENT_SIZE;
+        if (ps1_read32(event + EVENT_STATUS) != EVENT_STATUS_ENABLED
+            || ps1_read32(event + EVENT_CLASS) != class
+            || ps1_read32(event + EVENT_SPEC) != spec) {
+            continue;
+        }
+        u32 mode = ps1_read32(event + EVENT_MODE);
+        if (mode == EVENT_MODE_READY) {
+            ps1_write32(event + EVENT_STATUS, EVENT_STATUS_READY);
+        } else if (mode == EVENT_MODE_CALLBACK) {
+            static _Thread_local bool warned_callback = false;
+            if (!warned_callback) {
+                logwarn("HLE BIOS: event callbacks aren't supported (class 0x%08X, function 0x%08X)", class, ps1_read32(event + EVENT_FUNC));
+                warned_callback = true;
+            }
+        }
+    }
+}
+
+static bool hle_deliver_event() {
+    deliver_event(ARG(0), ARG(1));
+    RETURN(0);
+}
+
+static bool hle_undeliver_event() {
+    for (int i = 0; i < HLE_NUM_EVENTS; i++) {
+        u32 event = HLE_EVENTS + i * HLE_EVENT_SIZE;
+        if (ps1_read32(event + EVENT_STATUS) == EVENT_STATUS_READY
+            && ps1_read32(event + EVENT_MODE) == EVENT_MODE_READY
+            && ps1_read32(event + EVENT_CLASS) == ARG(0)
+            && ps1_read32(event + EVENT_SPEC) == ARG(1)) {
+            ps1_write32(event + EVENT_STATUS, EVENT_STATUS_ENABLED);
+        }
+    }
+    RETURN(0);
+}
+
+static bool hle_open_event() {
+    for (int i = 0; i < HLE_NUM_EVENTS; i++) {
+        u32 event = HLE_EVENTS + i * HLE_EVENT_SIZE;
+        if (ps1_read32(event + EVENT_STATUS) == EVENT_STATUS_FREE) {
+            ps1_write32(event + EVENT_CLASS, ARG(0));
+            ps1_write32(event + EVENT_STATUS, EVENT_STATUS_DISABLED);
+            ps1_write32(event + EVENT_SPEC, ARG(1));
+            ps1_write32(event + EVENT_MODE, ARG(2));
+            ps1_write32(event + EVENT_FUNC, ARG(3));
+            RETURN(EVENT_HANDLE | i);
+        }
+    }
+    RETURN(-1);
+}
+
+static bool hle_close_event() {
+    u32 event = event_address(ARG(0));
+    if (event == 0) {
+        RETURN(0);
+    }
+    ps1_write32(event + EVENT_STATUS, EVENT_STATUS_FREE);
+    RETURN(1);
+}
+
+static bool hle_wait_event() {
+    u32 event = event_address(ARG(0));
+    u32 status = event != 0 ? ps1_read32(event + EVENT_STATUS) : EVENT_STATUS_FREE;
+    if (status == EVENT_STATUS_READY) {
+        ps1_write32(event + EVENT_STATUS, EVENT_STATUS_ENABLED);
+        RETURN(1);
+    }
+    if (status != EVENT_STATUS_ENABLED) {
+        RETURN(0);
+    }
+    // Stay at the entry point, the loop there brings the CPU back until the event is delivered
+    return false;
+}
+
+static bool hle_test_event() {
+    u32 event = event_address(ARG(0));
+    if (event != 0 && ps1_read32(event + EVENT_STATUS) == EVENT_STATUS_READY) {
+        ps1_write32(event + EVENT_STATUS, EVENT_STATUS_ENABLED);
+        RETURN(1);
+    }
+    RETURN(0);
+}
+
+static bool hle_enable_event() {
+    u32 event = event_address(ARG(0));
+    if (event != 0 && ps1_read32(event + EVENT_STATUS) != EVENT_STATUS_FREE) {
+        ps1_write32(event + EVENT_STATUS, EVENT_STATUS_ENABLED);
+    }
+    RETURN(1);
+}
+
+static bool hle_disable_event() {
+    u32 event = event_address(ARG(0));
+    if (event != 0 && ps1_read32(event + EVENT_STATUS) != EVENT_STATUS_FREE) {
+        ps1_write32(event + EVENT_STATUS, EVENT_STATUS_DISABLED);
+    }
+    RETURN(1);
+}
+
+static u32 thread_address(u32 index) {
+    return HLE_THREADS + index * HLE_THREAD_SIZE;
+}
+
+static bool hle_open_thread() {
+    for (int i = 1; i < HLE_NUM_THREADS; i++) {
+        u32 thread = thread_address(i);
+        if (ps1_read32(thread + THREAD_STATUS) != THREAD_STATUS_USED) {
+            fill_guest(thread, 0, HLE_THREAD_SIZE);
+            ps1_write32(thread + THREAD_STATUS, THREAD_STATUS_USED);
+            ps1_write32(thread + THREAD_PC, ARG(0));
+            ps1_write32(thread + THREAD_GPR + REG_SP * 4, ARG(1));
+            ps1_write32(thread + THREAD_GPR + REG_FP * 4, ARG(1));
+            ps1_write32(thread + THREAD_GPR + REG_GP * 4, ARG(2));
+            RETURN(THREAD_HANDLE | i);
+        }
+    }
+    RETURN(-1);
+}
+
+static bool hle_close_thread() {
+    u32 index = ARG(0) & 0xFFFF;
+    if (index > 0 && index < HLE_NUM_THREADS) {
+        ps1_write32(thread_address(index) + THREAD_STATUS, 0);
+    }
+    RETURN(1);
+}
+
+static bool hle_change_thread() {
+    u32 index = ARG(0) & 0xFFFF;
+    if ((ARG(0) & 0xFFFF0000) != THREAD_HANDLE || index >= HLE_NUM_THREADS
+        || ps1_read32(thread_address(index) + THREAD_STATUS) != THREAD_STATUS_USED) {
+        RETURN(0);
+    }
+    // What ChangeThread returns when this thread is switched back to
+    PS1CPU.gpr[REG_V0] = 1;
+    u32 from = thread_address(ps1_read32(HLE_VAR_THREAD));
+    for (int r = 1; r < 32; r++) {
+        ps1_write32(from + THREAD_GPR + r * 4, PS1CPU.gpr[r]);
+    }
+    ps1_write32(from + THREAD_PC, PS1CPU.gpr[REG_RA]);
+    ps1_write32(from + THREAD_HI, PS1CPU.mult_hi);
+    ps1_write32(from + THREAD_LO, PS1CPU.mult_lo);
+
+    u32 to = thread_address(index);
+    for (int r = 1; r < 32; r++) {
+        PS1CPU.gpr[r] = ps1_read32(to + THREAD_GPR + r * 4);
+    }
+    PS1CPU.mult_hi = ps1_read32(to + THREAD_HI);
+    PS1CPU.mult_lo = ps1_read32(to + THREAD_LO);
+    ps1_write32(HLE_VAR_THREAD, index);
+    cpu_set_pc(ps1_read32(to + THREAD_PC));
+    return false;
+}
+
+// There's no controller port either, the buffers read as nothing connected
+static bool hle_init_pad() {
+    fill_guest(ARG(0), 0xFF, ARG(1));
+    fill_guest(ARG(2), 0xFF, ARG(3));
+    RETURN(2);
+}
+
+static bool hle_return_from_exception() {
+    PS1CP0.status.ie_ku >>= 2;
+    cp0_status_updated();
+    cpu_set_pc(PS1CP0.EPC);
+    return false;
+}
+
+static bool hle_nop() {
+    RETURN(0);
+}
+
+static bool hle_nop_success() {
+    RETURN(1);
+}
+
+static const hle_entry_t a0_functions[0x100] = {
+    [0x00] = { "open", hle_open },
+    [0x01] = { "lseek", hle_lseek },
+    [0x02] = { "read", hle_read },
+    [0x03] = { "write", hle_write },
+    [0x04] = { "close", hle_close },
+    [0x0E] = { "abs", hle_abs },
+    [0x0F] = { "labs", hle_abs },
+    [0x10] = { "atoi", hle_atoi },
+    [0x11] = { "atol", hle_atoi },
+    [0x13] = { "setjmp", hle_setjmp },
+    [0x14] = { "longjmp", hle_longjmp },
+    [0x15] = { "strcat", hle_strcat },
+    [0x16] = { "strncat", hle_strncat },
+    [0x17] = { "strcmp", hle_strcmp },
+    [0x18] = { "strncmp", hle_strncmp },
+    [0x19] = { "strcpy", hle_strcpy },
+    [0x1A] = { "strncpy", hle_strncpy },
+    [0x1B] = { "strlen", hle_strlen },
+    [0x1C] = { "index", hle_strchr },
+    [0x1D] = { "rindex", hle_strrchr },
+    [0x1E] = { "strchr", hle_strchr },
+    [0x1F] = { "strrchr", hle_strrchr },
+    [0x25] = { "toupper", hle_toupper },
+    [0x26] = { "tolower", hle_tolower },
+    [0x27] = { "bcopy", hle_bcopy },
+    [0x28] = { "bzero", hle_bzero },
+    [0x29] = { "bcmp", hle_memcmp },
+    [0x2A] = { "memcpy", hle_memcpy },
+    [0x2B] = { "memset", hle_memset },
+    [0x2C] = { "memmove", hle_memcpy },
+    [0x2D] = { "memcmp", hle_memcmp },
+    [0x2E] = { "memchr", hle_memchr },
+    [0x2F] = { "rand", hle_rand },
+    [0x30] = { "srand", hle_srand },
+    [0x33] = { "malloc", hle_malloc },
+    [0x34] = { "free", hle_free },
+    [0x37] = { "calloc", hle_calloc },
+    [0x38] = { "realloc", hle_realloc },
+    [0x39] = { "InitHeap", hle_init_heap },
+    [0x3A] = { "_exit", hle_exit },
+    [0x3C] = { "putchar", hle_putchar },
+    [0x3E] = { "puts", hle_puts },
+    [0x3F] = { "printf", hle_printf },
+    [0x44] = { "FlushCache", hle_flush_cache },
+    [0x48] = { "SendGP1Command", hle_gp1_command },
+    [0x49] = { "GPU_cw", hle_gp0_command },
+    [0x4A] = { "GPU_cwp", hle_gp0_command_words },
+    [0x4B] = { "send_gpu_linked_list", hle_gpu_linked_list },
+    [0x4C] = { "gpu_abort_dma", hle_nop },
+    [0x4D] = { "GetGPUStatus", hle_gpu_status },
+    [0x4E] = { "gpu_sync", hle_gpu_sync },
+};
+
+static const hle_entry_t b0_functions[0x100] = {
+    [0x07] = { "DeliverEvent", hle_deliver_event },
+    [0x08] = { "OpenEvent", hle_open_event },
+    [0x09] = { "CloseEvent", hle_close_event },
+    [0x0A] = { "WaitEvent", hle_wait_event },
+    [0x0B] = { "TestEvent", hle_test_event },
+    [0x0C] = { "EnableEvent", hle_enable_event },
+    [0x0D] = { "DisableEvent", hle_disable_event },
+    [0x0E] = { "OpenThread", hle_open_thread },
+    [0x0F] = { "CloseThread", hle_close_thread },
+    [0x10] = { "ChangeThread", hle_change_thread },
+    [0x12] = { "InitPad", hle_init_pad },
+    [0x13] = { "StartPad", hle_nop_success },
+    [0x14] = { "StopPad", hle_nop_success },
+    [0x17] = { "ReturnFromException", hle_return_from_exception },
+    [0x18] = { "SetDefaultExitFromException", hle_nop },
+    [0x19] = { "SetCustomExitFromException", hle_nop },
+    [0x20] = { "UnDeliverEvent", hle_undeliver_event },
+    [0x32] = { "open", hle_open },
+    [0x33] = { "lseek", hle_lseek },
+    [0x34] = { "read", hle_read },
+    [0x35] = { "write", hle_write },
+    [0x36] = { "close", hle_close },
+    [0x3D] = { "putchar", hle_putchar },
+    [0x3F] = { "puts", hle_puts },
+    [0x5B] = { "ChangeClearPad", hle_nop },
+};
+
+// Nothing here matters without interrupts, see hle_vblank()
+static const hle_entry_t c0_functions[0x100] = {
+    [0x00] = { "InitRCnt", hle_nop },
+    [0x01] = { "InitException", hle_nop },
+    [0x02] = { "SysEnqIntRP", hle_nop },
+    [0x03] = { "SysDeqIntRP", hle_nop },
+    [0x07] = { "InstallExceptionHandlers", hle_nop },
+    [0x08] = { "SysInitMemory", hle_nop },
+    [0x0A] = { "ChangeClearRCnt", hle_nop_success },
+    [0x0C] = { "InitDefInt", hle_nop },
+    [0x12] = { "InstallDevices", hle_nop },
+    [0x1C] = { "AdjustA0Table", hle_nop },
+};
+
+static void call_function(int table_index, const hle_entry_t* table) {
+    static const char table_names[] = { 'A', 'B', 'C' };
+    u32 number = PS1CPU.gpr[REG_T1] & 0xFF;
+    const hle_entry_t* entry = &table[number];
+    if (entry->function == NULL) {
+        u64 bit = 1ull << (number & 63);
+        if (!(warned[table_index][number >> 6] & bit)) {
+            logwarn("HLE BIOS: %c0h function %02Xh isn't implemented, returning 0", table_names[table_index], number);
+            warned[table_index][number >> 6] |= bit;
+        }
+        PS1CPU.gpr[REG_V0] = 0;
+    } else {
+        logtrace("HLE BIOS: %s(0x%08X, 0x%08X, 0x%08X, 0x%08X)", entry->name, ARG(0), ARG(1), ARG(2), ARG(3));
+        if (!entry->function()) {
+            return;
+        }
+    }
+    cpu_set_pc(PS1CPU.gpr[REG_RA]);
+}
+
+static void handle_exception() {
+    u32 code = PS1CP0.cause.exception_code;
+    if (code != EXCEPTION_SYSCALL) {
+        logfatal("HLE BIOS: unhandled exception %d at 0x%08X, there are no interrupts to handle", code, PS1CP0.EPC);
+    }
+    u32 function = ARG(0);
+    // Back to the instruction after the syscall, the same way rfe leaves
+    PS1CP0.status.ie_ku >>= 2;
+    switch (function) {
+        case SYSCALL_ENTER_CRITICAL:
+            PS1CPU.gpr[REG_V0] = PS1CP0.status.iec;
+            PS1CP0.status.iec = 0;
+            break;
+        case SYSCALL_EXIT_CRITICAL:
+            PS1CP0.status.iec = 1;
+            break;
+        default:
+            logwarn("HLE BIOS: unsupported syscall %d", function);
+            break;
+    }
+    cp0_status_updated();
+    cpu_set_pc(PS1CP0.EPC + 4);
+}
+
+void hle_check_pc() {
+    u32 phys = PS1CPU.pc & 0x1FFFFFFF;
+    if (phys > HLE_VECTOR_C0 || (phys & 0xF) != 0) {
+        return;
+    }
+    switch (phys) {
+        case HLE_VECTOR_EXCEPTION:
+            handle_exception();
+            break;
+        case HLE_VECTOR_A0:
+            call_function(0, a0_functions);
+            break;
+        case HLE_VECTOR_B0:
+            call_function(1, b0_functions);
+            break;
+        case HLE_VECTOR_C0:
+            call_function(2, c0_functions);
+            break;
+    }
+}
+
+void hle_vblank() {
+    deliver_event(EVENT_CLASS_VBLANK, EVENT_SPEC_INTERRUPT);
+}
+
+// j address; nop
+static void write_loop(u32 address) {
+    ps1_write32(KSEG0(address), 0x08000000 | (address >> 2));
+    ps1_write32(KSEG0(address + 4), 0);
+}
+
+void hle_init() {
+    write_loop(HLE_VECTOR_EXCEPTION);
+    write_loop(HLE_VECTOR_A0);
+    write_loop(HLE_VECTOR_B0);
+    write_loop(HLE_VECTOR_C0);
+    write_loop(HLE_HALT);
+    ps1_write32(thread_address(0) + THREAD_STATUS, THREAD_STATUS_USED);
+    memset(warned, 0x00, sizeof(warned));
+
+    // Kernel mode with interrupts enabled and exceptions going to RAM, as the real BIOS leaves it for the shell
+    PS1CP0.status.raw = 0;
+    PS1CP0.status.iec = 1;
+    PS1CP0.status.im = 0x04;
+    cp0_status_updated();
+    cpu_set_pc(KSEG0(HLE_HALT));
+}
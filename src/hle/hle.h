@@ -0,0 +1,25 @@
+#ifndef PS1_HLE_H
+#define PS1_HLE_H
+
+#include <util.h>
+
+/*
+ * High level emulation of the BIOS kernel. Calls through the A0h, B0h and C0h function tables and syscalls are
+ * implemented in C instead of running BIOS code, so no BIOS image is needed. Only side-loaded EXEs can be booted, and
+ * they can read files from the ISO9660 filesystem of the disc in the drive through "cdrom:" paths.
+ *
+ * The kernel's own state (events, threads, the heap) lives in the kernel area of guest RAM like the real one's does,
+ * so save states, deltas, rewind and run-ahead all cover it.
+ */
+
+// Pass as the BIOS path to boot with the HLE BIOS
+#define HLE_BIOS_NAME "hle"
+
+// Sets up the kernel area of RAM, the CPU is left waiting for an EXE
+void hle_init();
+// Called before every instruction while the HLE BIOS is in use, runs the kernel when the PC is at one of its entry points
+void hle_check_pc();
+// The kernel's VBlank handling, delivers the root counter 3 events
+void hle_vblank();
+
+#endif //PS1_HLE_H
@@ -1,7 +1,35 @@
 #include <stdio.h>
+#include <inttypes.h>
 #include <cflags.h>
 #include <mem/ps1system.h>
 #include <log.h>
+#include <timing.h>
+#include <mem/bus_stats.h>
+#include <cpu/sampler.h>
+#include <cpu/trace.h>
+#include <mem/rewind.h>
+#include <mem/runahead.h>
+#include <mem/footprint.h>
+#include <hle/hle.h>
+
+#ifdef HAVE_SDL2
+#include <frontend/frontend.h>
+#endif
+
+void add_symbol_file(const char* path) {
+    sampler_load_symbols(path);
+}
+
+#define MAX_DELTAS 256
+const char* delta_paths[MAX_DELTAS];
+int num_deltas = 0;
+
+void add_delta_file(const char* path) {
+    if (num_deltas == MAX_DELTAS) {
+        logfatal("At most %d delta snapshots can be applied", MAX_DELTAS);
+    }
+    delta_paths[num_deltas++] = path;
+}
 
 void usage(cflags_t* flags) {
     cflags_print_usage(flags,
@@ -10,28 +38,266 @@ void usage(cflags_t* flags) {
                        "https://github.com/Dillonb/ps1");
 }
 
+typedef struct bench_result {
+    u64 host_ns;
+    u64 cycles;
+    u64 frames;
+    u64 vblank_ns;
+} bench_result_t;
+
+void print_bench_report(bench_result_t* result) {
+    double host_s = result->host_ns / 1e9;
+    double instructions = (double)result->cycles / CYCLES_PER_INSTR;
+    u64 cpu_ns = result->host_ns - result->vblank_ns;
+
+    logalways("======== BENCHMARK ========");
+    logalways("Host time:        %.3f s", host_s);
+    logalways("Emulated cycles:  %" PRIu64 " (%.3f s of guest time)", result->cycles, (double)result->cycles / (CPU_CYCLES_PER_FRAME * 60.0));
+    logalways("Guest MIPS:       %.2f", instructions / host_s / 1e6);
+    logalways("Frames:           %" PRIu64 " (%.2f FPS)", result->frames, result->frames / host_s);
+    if (result->frames > 0) {
+        logalways("Host time/frame:  %.3f ms", result->host_ns / 1e6 / result->frames);
+    }
+    logalways("  cpu:            %.3f s (%.1f%%)", cpu_ns / 1e9, 100.0 * cpu_ns / result->host_ns);
+    logalways("  vblank:         %.3f s (%.1f%%)", result->vblank_ns / 1e9, 100.0 * result->vblank_ns / result->host_ns);
+}
+
+void write_bench_json(bench_result_t* result, const char* path) {
+    FILE* fp = fopen(path, "w");
+    if (fp == NULL) {
+        logfatal("Unable to open %s for writing benchmark results", path);
+    }
+    double host_s = result->host_ns / 1e9;
+    fprintf(fp, "{\n");
+    fprintf(fp, "  \"host_ns\": %" PRIu64 ",\n", result->host_ns);
+    fprintf(fp, "  \"cycles\": %" PRIu64 ",\n", result->cycles);
+    fprintf(fp, "  \"instructions\": %" PRIu64 ",\n", result->cycles / CYCLES_PER_INSTR);
+    fprintf(fp, "  \"frames\": %" PRIu64 ",\n", result->frames);
+    fprintf(fp, "  \"mips\": %.4f,\n", (double)result->cycles / CYCLES_PER_INSTR / host_s / 1e6);
+    fprintf(fp, "  \"fps\": %.4f,\n", result->frames / host_s);
+    fprintf(fp, "  \"ns_per_frame\": %.1f,\n", result->frames > 0 ? (double)result->host_ns / result->frames : 0.0);
+    fprintf(fp, "  \"subsystem_ns\": {\n");
+    fprintf(fp, "    \"cpu\": %" PRIu64 ",\n", result->host_ns - result->vblank_ns);
+    fprintf(fp, "    \"vblank\": %" PRIu64 "\n", result->vblank_ns);
+    fprintf(fp, "  }\n");
+    fprintf(fp, "}\n");
+    fclose(fp);
+}
+
+typedef struct run_options {
+    int frames;
+    u64 cycles;
+    int run_ahead;
+    int checkpoint_every;
+    const char* checkpoint_prefix;
+    int rewind_frames;
+    const char* save_state;
+    bool print_footprint;
+    bool bench;
+    const char* bench_json;
+} run_options_t;
+
+// Everything after setup, on the main thread when headless and on the emulation thread with the frontend
+int emulate(void* data) {
+    const run_options_t* options = data;
+    // --load-state/--load-delta resume with counters already running, only this run is reported
+    u64 start = timing_now_ns();
+    u64 start_cycles = PS1SYS.cycles;
+    u64 start_frames = PS1SYS.stats.frames;
+    u64 start_vblank_ns = PS1SYS.stats.vblank_ns + PS1SYS.stats.speculative_vblank_ns;
+    if (options->cycles > 0) {
+        ps1_system_run_cycles(options->cycles);
+    } else if (options->frames > 0) {
+        for (int i = 0; i < options->frames && !ps1_system_stop_requested(); i++) {
+            ps1_system_run_frame_ahead(options->run_ahead);
+            if (options->checkpoint_every > 0 && (i + 1) % options->checkpoint_every == 0) {
+                char path[512];
+                snprintf(path, sizeof(path), "%s.%" PRIu64 ".delta", options->checkpoint_prefix, PS1SYS.stats.frames);
+                ps1_system_save_delta(path);
+            }
+        }
+    } else {
+        // Until the window is closed
+        while (options->run_ahead > 0 && !ps1_system_stop_requested()) {
+            ps1_system_run_frame_ahead(options->run_ahead);
+        }
+        ps1_system_loop();
+    }
+    // Rewinding, saving and measuring below aren't emulation
+    u64 end = timing_now_ns();
+
+    for (int i = 0; i < options->rewind_frames; i++) {
+        if (!rewind_step_back()) {
+            logwarn("Only %d frames of rewind history", i);
+            break;
+        }
+    }
+    if (rewind_enabled) {
+        rewind_print_stats();
+    }
+    runahead_print_stats();
+
+    if (options->save_state != NULL) {
+        ps1_system_save_state(options->save_state);
+    }
+    if (options->print_footprint) {
+        footprint_t footprint;
+        footprint_measure(&footprint);
+        footprint_print(&footprint);
+    }
+
+    if (options->bench) {
+        bench_result_t result = {
+                .host_ns = end - start,
+                .cycles = PS1SYS.cycles - start_cycles,
+                .frames = PS1SYS.stats.frames - start_frames,
+                // Time spent in every vblank, rolled back or not, so the cpu/vblank split adds up
+                .vblank_ns = PS1SYS.stats.vblank_ns + PS1SYS.stats.speculative_vblank_ns - start_vblank_ns
+        };
+        print_bench_report(&result);
+        if (options->bench_json != NULL) {
+            write_bench_json(&result, options->bench_json);
+        }
+    }
+    return 0;
+}
+
 int main(int argc, char** argv) {
     cflags_t* flags = cflags_init();
     cflags_flag_t * verbose = cflags_add_bool(flags, 'v', "verbose", NULL, "enables verbose output, repeat up to 4 times for more verbosity");
+    const char* bios = "SCPH1001.BIN";
+    cflags_add_string(flags, 'b', "bios", &bios, "BIOS to boot, default SCPH1001.BIN, \"" HLE_BIOS_NAME "\" for the built-in one");
+    const char* disc = NULL;
+    cflags_add_string(flags, '\0', "disc", &disc, "put this disc image (.cue or .bin) in the drive");
+    bool direct_boot = false;
+    cflags_add_bool(flags, '\0', "direct-boot", &direct_boot, "start FILE right away instead of once the BIOS has set up the kernel");
     bool dump_on_fatal = false;
-    cflags_add_bool(flags, 'd', "dump-on-fatal", &dump_on_fatal, "create crash dump on fatal error");
+    cflags_add_bool(flags, 'd', "dump-on-fatal", &dump_on_fatal, "create crash dump on fatal error or crash");
+    const char* dump_path = NULL;
+    cflags_add_string(flags, '\0', "dump-path", &dump_path, "where -d writes the machine state, default ps1_crash.state");
+    const char* load_state = NULL;
+    cflags_add_string(flags, '\0', "load-state", &load_state, "resume from a save state or crash dump instead of booting");
+    cflags_add_string_callback(flags, '\0', "load-delta", add_delta_file, "apply a delta snapshot after --load-state, can be repeated to replay a chain in order");
+    int checkpoint_every = 0;
+    cflags_add_int(flags, '\0', "checkpoint-every", &checkpoint_every, "with --frames, write a delta snapshot every N frames");
+    const char* checkpoint_prefix = "checkpoint";
+    cflags_add_string(flags, '\0', "checkpoint-prefix", &checkpoint_prefix, "delta snapshots are written to PREFIX.FRAME.delta, default checkpoint");
+    int rewind_budget = 0;
+    cflags_add_int(flags, '\0', "rewind-budget", &rewind_budget, "keep per-frame rewind history in this many MiB");
+    int rewind_frames = 0;
+    cflags_add_int(flags, '\0', "rewind", &rewind_frames, "step back this many frames after --frames/--cycles, needs --rewind-budget");
+    int run_ahead = 0;
+    cflags_add_int(flags, '\0', "run-ahead", &run_ahead, "present the frame N frames in the future and roll back, hides N frames of input lag");
+    bool print_footprint = false;
+    cflags_add_bool(flags, '\0', "footprint", &print_footprint, "print resident host memory per subsystem at exit");
+    const char* save_state = NULL;
+    cflags_add_string(flags, '\0', "save-state", &save_state, "save the machine state to this file after --frames/--cycles");
+
+    bool log_cycles = false;
+    cflags_add_bool(flags, '\0', "log-cycles", &log_cycles, "prefix log messages with the emulated cycle count");
+
+    bool headless = false;
+    cflags_add_bool(flags, '\0', "headless", &headless, "run without opening a window");
+    int frames = 0;
+    cflags_add_int(flags, '\0', "frames", &frames, "stop after emulating N frames");
+    const char* cycles_str = NULL;
+    cflags_add_string(flags, '\0', "cycles", &cycles_str, "stop after emulating N cycles");
+    bool bench = false;
+    cflags_add_bool(flags, '\0', "bench", &bench, "print throughput numbers at exit, implies --headless");
+    const char* bench_json = NULL;
+    cflags_add_string(flags, '\0', "bench-json", &bench_json, "also write the benchmark numbers as JSON to this file");
+
+    const char* sample_profile = NULL;
+    cflags_add_string(flags, '\0', "sample-profile", &sample_profile, "sample the guest call stack and write it in collapsed stack format to this file at exit");
+    int sample_interval = 10000;
+    cflags_add_int(flags, '\0', "sample-interval", &sample_interval, "emulated cycles between samples, default 10000");
+    cflags_add_string_callback(flags, '\0', "symbols", add_symbol_file, "load guest symbols (\"ADDRESS NAME [SIZE]\" per line) for --sample-profile, can be repeated");
+
+    const char* trace_path = NULL;
+    cflags_add_string(flags, '\0', "trace", &trace_path, "write a binary execution trace to this file, decode it with ps1_trace_decode");
+    const char* trace_size = NULL;
+    cflags_add_string(flags, '\0', "trace-records", &trace_size, "number of records kept in the trace ring, default 16M");
+
+#ifdef PS1_BUS_STATS
+    const char* bus_stats_csv = NULL;
+    cflags_add_string(flags, '\0', "bus-stats-csv", &bus_stats_csv, "write bus access statistics as CSV to this file at exit");
+#endif
 
     bool help = false;
     cflags_add_bool(flags, 'h', "help", &help, "Display this help message");
 
     cflags_parse(flags, argc, argv);
 
-    if (help || flags->argc != 1) {
+    if (help || flags->argc > 1) {
         usage(flags);
         return 0;
     }
+    // A PS-X EXE to side-load
+    const char* file = flags->argc == 1 ? flags->argv[0] : NULL;
     log_set_verbosity(verbose->count);
+    log_set_show_cycles(log_cycles);
     if (dump_on_fatal) {
-        log_set_fatal_handler(ps1_create_crash_dump);
+        ps1_enable_crash_dumps(dump_path);
     }
 
     cflags_free(flags);
 
-    ps1_system_init();
-    ps1_system_loop();
-}
\ No newline at end of file
+    u64 cycles = cycles_str != NULL ? strtoull(cycles_str, NULL, 0) : 0;
+    if (bench || bench_json != NULL) {
+        bench = true;
+        headless = true;
+    }
+
+    ps1_system_init_with_bios(bios);
+    if (load_state != NULL) {
+        ps1_system_load_state(load_state);
+    }
+    for (int i = 0; i < num_deltas; i++) {
+        ps1_system_load_delta(delta_paths[i]);
+    }
+    if (disc != NULL) {
+        ps1_system_insert_disc(disc);
+    }
+    if (file != NULL) {
+        ps1_system_load_exe(file, direct_boot);
+    }
+#ifdef PS1_BUS_STATS
+    bus_stats_set_csv_path(bus_stats_csv);
+#endif
+    if (trace_path != NULL) {
+        u64 trace_records = 16 * 1024 * 1024;
+        if (trace_size != NULL) {
+            char* end;
+            trace_records = strtoull(trace_size, &end, 0);
+            if (end == trace_size || *end != '\0' || trace_records == 0) {
+                logfatal("--trace-records needs a number of records greater than 0, not \"%s\"", trace_size);
+            }
+        }
+        trace_open(trace_path, trace_records);
+    }
+    if (rewind_budget > 0) {
+        rewind_init((size_t)rewind_budget << 20);
+    }
+    if (sample_profile != NULL) {
+        sampler_init(sample_profile, sample_interval > 0 ? sample_interval : 10000);
+    }
+    run_options_t options = {
+            .frames = frames,
+            .cycles = cycles,
+            .run_ahead = run_ahead,
+            .checkpoint_every = checkpoint_every,
+            .checkpoint_prefix = checkpoint_prefix,
+            .rewind_frames = rewind_frames,
+            .save_state = save_state,
+            .print_footprint = print_footprint,
+            .bench = bench,
+            .bench_json = bench_json
+    };
+#ifdef HAVE_SDL2
+    if (!headless) {
+        frontend_init();
+        return frontend_run(emulate, &options);
+    }
+#endif
+    return emulate(&options);
+}
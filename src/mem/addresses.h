@@ -86,6 +86,15 @@
 
 #define EXP2_PSX_POST 0x1F802041
 
+#define SREGION_CDROM 0x1F801800
+#define REGION_CDROM SREGION_CDROM ... 0x1F801803
+
+// What each register does also depends on the index written to CDROM_INDEX_STATUS
+#define CDROM_INDEX_STATUS  0x1F801800
+#define CDROM_RESPONSE_FIFO 0x1F801801
+#define CDROM_DATA_FIFO     0x1F801802
+#define CDROM_INTERRUPT     0x1F801803
+
 #define SREGION_SPU 0x1F801C00
 #define REGION_SPU SREGION_SPU ... 0x1F801FFF
 
@@ -0,0 +1,119 @@
+#include "bios.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <log.h>
+
+// Words replaced to force the TTY output on
+#define BIOS_TTY_PATCH_FIRST 0x1bc3
+#define BIOS_TTY_PATCH_LAST  0x1bc5
+
+static pthread_mutex_t images_lock = PTHREAD_MUTEX_INITIALIZER;
+static bios_image_t* images = NULL;
+
+/*
+ * Patch the BIOS to enable TTY output. The mapping is private, so writing to it copies the one page being patched and
+ * leaves the rest of the image shared.
+ */
+static void apply_tty_patch(u8* data, size_t size) {
+    if (size < (BIOS_TTY_PATCH_LAST + 1) * sizeof(u32)) {
+        logwarn("The BIOS is only %zu bytes, not patching it to enable TTY output", size);
+        return;
+    }
+    ((u32*)data)[BIOS_TTY_PATCH_FIRST] = 0x24010001; /* ADDIU $at, $zero, 0x1 */
+    ((u32*)data)[BIOS_TTY_PATCH_LAST] = 0xaf81a9c0;  /* SW $at, -0x5640($gp) */
+}
+
+static bios_image_t* map_image(const char* path, const struct stat* st, int fd) {
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    size_t mapped_size = (st->st_size + page_size - 1) & ~(page_size - 1);
+    u8* data = mmap(NULL, mapped_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+        logfatal("Unable to map the BIOS file at %s", path);
+    }
+    apply_tty_patch(data, st->st_size);
+    // Nothing writes to the BIOS after this, catch anything that tries
+    mprotect(data, mapped_size, PROT_READ);
+
+    bios_image_t* image = calloc(1, sizeof(bios_image_t));
+    image->data = data;
+    image->size = st->st_size;
+    image->mapped_size = mapped_size;
+    image->mapped = true;
+    image->device = st->st_dev;
+    image->inode = st->st_ino;
+    return image;
+}
+
+bios_image_t* bios_open(const char* path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        logfatal("Error opening the BIOS file at %s! Are you sure this is a correct path?", path);
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        logfatal("Error reading the BIOS file at %s!", path);
+    }
+
+    pthread_mutex_lock(&images_lock);
+    bios_image_t* image = images;
+    while (image != NULL && !(image->mapped && image->device == st.st_dev && image->inode == st.st_ino)) {
+        image = image->next;
+    }
+    if (image == NULL) {
+        image = map_image(path, &st, fd);
+        image->next = images;
+        images = image;
+        logalways("Loaded the BIOS, it's %zu bytes.", image->size);
+    }
+    image->refs++;
+    pthread_mutex_unlock(&images_lock);
+    close(fd);
+    return image;
+}
+
+bios_image_t* bios_from_memory(const u8* data, size_t size) {
+    bios_image_t* image = calloc(1, sizeof(bios_image_t));
+    u8* copy = malloc(size);
+    memcpy(copy, data, size);
+    image->data = copy;
+    image->size = size;
+    image->refs = 1;
+    return image;
+}
+
+bios_image_t* bios_blank(size_t size) {
+    bios_image_t* image = calloc(1, sizeof(bios_image_t));
+    image->data = calloc(1, size);
+    image->size = size;
+    image->refs = 1;
+    return image;
+}
+
+void bios_release(bios_image_t* image) {
+    if (image == NULL) {
+        return;
+    }
+    if (!image->mapped) {
+        free((u8*)image->data);
+        free(image);
+        return;
+    }
+    pthread_mutex_lock(&images_lock);
+    if (--image->refs == 0) {
+        bios_image_t** link = &images;
+        while (*link != image) {
+            link = &(*link)->next;
+        }
+        *link = image->next;
+        munmap((u8*)image->data, image->mapped_size);
+        free(image);
+    }
+    pthread_mutex_unlock(&images_lock);
+}
@@ -0,0 +1,35 @@
+#ifndef PS1_BIOS_H
+#define PS1_BIOS_H
+
+#include <util.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <sys/types.h>
+
+/*
+ * A BIOS image. Images loaded from a file are mapped read-only and shared by every instance in the process that loads
+ * the same file. The page holding the TTY patch is the only private copy, everything else is shared with the page
+ * cache and so with other processes running the same BIOS.
+ */
+typedef struct bios_image {
+    const u8* data;
+    size_t size;
+
+    // Private to bios.c
+    size_t mapped_size;
+    bool mapped;
+    dev_t device;
+    ino_t inode;
+    int refs;
+    struct bios_image* next;
+} bios_image_t;
+
+// Takes a reference to the image of the file at `path`, loading it if no instance has it yet
+bios_image_t* bios_open(const char* path);
+// A private image holding a copy of `data`, used when a save state comes with a different BIOS
+bios_image_t* bios_from_memory(const u8* data, size_t size);
+// A private image of zeroes, what the CPU sees in the BIOS region while the HLE BIOS is in use
+bios_image_t* bios_blank(size_t size);
+void bios_release(bios_image_t* image);
+
+#endif //PS1_BIOS_H
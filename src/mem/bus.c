@@ -6,30 +6,16 @@
 #include <mem/dma.h>
 #include <cpu/cpu.h>
 #include <gpu/gpu.h>
+#include <mem/bus_stats.h>
+#include <mem/dirty.h>
+#include <cdrom/cdrom.h>
 
 #define CHECK_ISC do { if (PS1CP0.isolate_cache) { return; } } while(0)
 
 
-INLINE u32 virt_to_phys(u32 virt) {
-    switch (virt) {
-        case VREGION_KUSEG_VAL:
-            return virt - SVREGION_KUSEG_VAL;
-        case VREGION_KUSEG_INV:
-            logfatal("Invalid region of KUSEG accessed, throw an exception");
-            break;
-        case VREGION_KSEG0:
-            return virt - SVREGION_KSEG0;
-        case VREGION_KSEG1:
-            return virt - SVREGION_KSEG1;
-        case VREGION_KSEG2:
-            return virt - SVREGION_KSEG2;
-        default:
-            logfatal("Unknown region! Virtual address: %08X\n", virt);
-    }
-}
-
 u8 ps1_read8(u32 virt) {
     u32 address = virt_to_phys(virt);
+    BUS_STATS_RECORD(virt, address, 8, BUS_READ);
     switch (address) {
         case REGION_RAM:
             return PS1SYS.mem.ram[address];
@@ -50,6 +36,8 @@ u8 ps1_read8(u32 virt) {
             }
             break;
         case REGION_EXP1: return 0xFF; // Expansion port on the back of the console. Ignored.
+        case REGION_CDROM:
+            return cdrom_read(address);
         default:
             logfatal("ps1_read8 virt [%08X] phys [%08X]", virt, address);
     }
@@ -57,6 +45,7 @@ u8 ps1_read8(u32 virt) {
 
 u16 ps1_read16(u32 virt) {
     u32 address = virt_to_phys(virt);
+    BUS_STATS_RECORD(virt, address, 16, BUS_READ);
     switch (address) {
         case REGION_RAM:
             return u16_from_byte_array(PS1SYS.mem.ram, address);
@@ -71,6 +60,7 @@ u16 ps1_read16(u32 virt) {
 
 u32 ps1_read32(u32 virt) {
     u32 address = virt_to_phys(virt);
+    BUS_STATS_RECORD(virt, address, 32, BUS_READ);
     switch (address) {
         case REGION_RAM:
             return u32_from_byte_array(PS1SYS.mem.ram, address);
@@ -101,14 +91,17 @@ u32 ps1_read32(u32 virt) {
 
 void ps1_write8(u32 virt, u8 value) {
     u32 address = virt_to_phys(virt);
+    BUS_STATS_RECORD(virt, address, 8, BUS_WRITE);
     switch (address) {
         case REGION_RAM:
             CHECK_ISC;
             PS1SYS.mem.ram[address] = value;
+            dirty_mark_ram(address);
+            break;
         case REGION_DEBUG:
             switch (address) {
                 case UART_THRA:
-                    printf("%c", value);
+                    ps1_system_tty_putchar(value);
                 case EXP2_PSX_POST:
                     loginfo("PSX POST: %02X", value);
                     break;
@@ -116,6 +109,9 @@ void ps1_write8(u32 virt, u8 value) {
                     break;
             }
             break;
+        case REGION_CDROM:
+            cdrom_write(address, value);
+            break;
         default:
             logfatal("ps1_write8 virt [0x%08X] phys [%08X]=%02X", virt, address, value);
     }
@@ -123,10 +119,13 @@ void ps1_write8(u32 virt, u8 value) {
 
 void ps1_write16(u32 virt, u16 value) {
     u32 address = virt_to_phys(virt);
+    BUS_STATS_RECORD(virt, address, 16, BUS_WRITE);
     switch (address) {
         case REGION_RAM:
             CHECK_ISC;
             u16_to_byte_array(PS1SYS.mem.ram, address, value);
+            dirty_mark_ram(address);
+            break;
         case REGION_SPU:
             logwarn("SPU register write: [%08X]=%04X ignoring.", address, value);
             break;
@@ -142,10 +141,12 @@ void ps1_write16(u32 virt, u16 value) {
 
 void ps1_write32(u32 virt, u32 value) {
     u32 address = virt_to_phys(virt);
+    BUS_STATS_RECORD(virt, address, 32, BUS_WRITE);
     switch (address) {
         case REGION_RAM:
             CHECK_ISC;
             u32_to_byte_array(PS1SYS.mem.ram, address, value);
+            dirty_mark_ram(address);
             break;
         // Expansion Region 1
         // Scratchpad
@@ -2,6 +2,26 @@
 #define PS1_BUS_H
 
 #include <util.h>
+#include <log.h>
+#include <mem/addresses.h>
+
+INLINE u32 virt_to_phys(u32 virt) {
+    switch (virt) {
+        case VREGION_KUSEG_VAL:
+            return virt - SVREGION_KUSEG_VAL;
+        case VREGION_KUSEG_INV:
+            logfatal("Invalid region of KUSEG accessed, throw an exception");
+            break;
+        case VREGION_KSEG0:
+            return virt - SVREGION_KSEG0;
+        case VREGION_KSEG1:
+            return virt - SVREGION_KSEG1;
+        case VREGION_KSEG2:
+            return virt - SVREGION_KSEG2;
+        default:
+            logfatal("Unknown region! Virtual address: %08X\n", virt);
+    }
+}
 
 u8 ps1_read8(u32 address);
 u16 ps1_read16(u32 address);
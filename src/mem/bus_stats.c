@@ -0,0 +1,300 @@
+#include "bus_stats.h"
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <log.h>
+#include <mem/addresses.h>
+#include <cpu/cpu.h>
+
+static bus_stats_t* bus_stats = NULL;
+static const char* csv_path = NULL;
+
+#define REPORT_TOP_MMIO 40
+#define REPORT_TOP_PCS 40
+
+static const char* region_names[BUS_REGION_COUNT] = { "RAM", "BIOS", "SCRATCHPAD", "MMIO", "EXP1", "OTHER" };
+static const char* kind_names[BUS_KIND_COUNT] = { "read", "write", "fetch" };
+static const int widths[BUS_WIDTH_COUNT] = { 8, 16, 32 };
+
+static const struct {
+    u32 address;
+    const char* name;
+} mmio_names[] = {
+        { MEM_CNT_EXP1_BASE,  "MEM_CNT_EXP1_BASE" },
+        { MEM_CNT_EXP2_BASE,  "MEM_CNT_EXP2_BASE" },
+        { MEM_CNT_EXP1_SIZE,  "MEM_CNT_EXP1_SIZE" },
+        { MEM_CNT_EXP3_SIZE,  "MEM_CNT_EXP3_SIZE" },
+        { MEM_CNT_BIOS_ROM,   "MEM_CNT_BIOS_ROM" },
+        { MEM_CNT_SPU_SIZE,   "MEM_CNT_SPU_SIZE" },
+        { MEM_CNT_CDROM_SIZE, "MEM_CNT_CDROM_SIZE" },
+        { MEM_CNT_EXP2_SIZE,  "MEM_CNT_EXP2_SIZE" },
+        { MEM_CNT_COM_DELAY,  "MEM_CNT_COM_DELAY" },
+        { MEM_CNT_RAM_SIZE,   "MEM_CNT_RAM_SIZE" },
+        { INTC_I_STAT,        "I_STAT" },
+        { INTC_I_MASK,        "I_MASK" },
+        { DMA0_BASE_ADDR,     "DMA0_BASE_ADDR" },
+        { DMA0_BLOCK_CTRL,    "DMA0_BLOCK_CTRL" },
+        { DMA0_CHANNEL_CTRL,  "DMA0_CHANNEL_CTRL" },
+        { DMA1_BASE_ADDR,     "DMA1_BASE_ADDR" },
+        { DMA1_BLOCK_CTRL,    "DMA1_BLOCK_CTRL" },
+        { DMA1_CHANNEL_CTRL,  "DMA1_CHANNEL_CTRL" },
+        { DMA2_BASE_ADDR,     "DMA2_BASE_ADDR" },
+        { DMA2_BLOCK_CTRL,    "DMA2_BLOCK_CTRL" },
+        { DMA2_CHANNEL_CTRL,  "DMA2_CHANNEL_CTRL" },
+        { DMA3_BASE_ADDR,     "DMA3_BASE_ADDR" },
+        { DMA3_BLOCK_CTRL,    "DMA3_BLOCK_CTRL" },
+        { DMA3_CHANNEL_CTRL,  "DMA3_CHANNEL_CTRL" },
+        { DMA4_BASE_ADDR,     "DMA4_BASE_ADDR" },
+        { DMA4_BLOCK_CTRL,    "DMA4_BLOCK_CTRL" },
+        { DMA4_CHANNEL_CTRL,  "DMA4_CHANNEL_CTRL" },
+        { DMA5_BASE_ADDR,     "DMA5_BASE_ADDR" },
+        { DMA5_BLOCK_CTRL,    "DMA5_BLOCK_CTRL" },
+        { DMA5_CHANNEL_CTRL,  "DMA5_CHANNEL_CTRL" },
+        { DMA6_BASE_ADDR,     "DMA6_BASE_ADDR" },
+        { DMA6_BLOCK_CTRL,    "DMA6_BLOCK_CTRL" },
+        { DMA6_CHANNEL_CTRL,  "DMA6_CHANNEL_CTRL" },
+        { DMA_DPCR,           "DPCR" },
+        { DMA_DICR,           "DICR" },
+        { GPU_GP0,            "GP0/GPUREAD" },
+        { GPU_GP1,            "GP1/GPUSTAT" },
+        { SPU_SPUCNT,         "SPUCNT" },
+        { SPU_SPUSTAT,        "SPUSTAT" },
+        { UART_SRA,           "UART_SRA" },
+        { UART_THRA,          "UART_THRA" },
+        { UART_ACR,           "UART_ACR" },
+        { UART_IMR,           "UART_IMR" },
+        { UART_OPCR,          "UART_OPCR" },
+        { EXP2_PSX_POST,      "EXP2_POST" },
+};
+#define NUM_MMIO_NAMES (sizeof(mmio_names) / sizeof(mmio_names[0]))
+
+static const char* mmio_name(u32 address) {
+    for (int i = 0; i < NUM_MMIO_NAMES; i++) {
+        if (mmio_names[i].address == address) {
+            return mmio_names[i].name;
+        }
+    }
+    if (address >= SREGION_TIMERS && address < SREGION_TIMERS + 0x40) {
+        return "TIMERS";
+    }
+    if (address >= SREGION_SPU && address < SREGION_SPU + 0x400) {
+        return "SPU";
+    }
+    return "";
+}
+
+// Region targets are stored above the MMIO address space so they never collide with register addresses
+#define REGION_TARGET(region) (0xFFFFFF00 | (region))
+#define IS_REGION_TARGET(target) (((target) & 0xFFFFFF00) == 0xFFFFFF00)
+
+static void target_name(u32 target, char* buf, size_t buflen) {
+    if (IS_REGION_TARGET(target)) {
+        snprintf(buf, buflen, "%s", region_names[target & 0xFF]);
+    } else {
+        snprintf(buf, buflen, "%08X %s", target, mmio_name(target));
+    }
+}
+
+INLINE bus_stats_region_t classify(u32 phys) {
+    if (phys < 0x200000) {
+        return BUS_REGION_RAM;
+    } else if (phys >= SREGION_BIOS_ROM && phys < SREGION_BIOS_ROM + 0x80000) {
+        return BUS_REGION_BIOS;
+    } else if (phys >= 0x1F800000 && phys < 0x1F800400) {
+        return BUS_REGION_SCRATCHPAD;
+    } else if (phys >= BUS_MMIO_BASE && phys < BUS_MMIO_BASE + BUS_MMIO_SIZE) {
+        return BUS_REGION_MMIO;
+    } else if (phys >= SREGION_EXP1 && phys < SREGION_EXP1 + 0x800000) {
+        return BUS_REGION_EXP1;
+    } else {
+        return BUS_REGION_OTHER;
+    }
+}
+
+static void report_atexit() {
+    bus_stats_report(stderr);
+    if (csv_path != NULL) {
+        bus_stats_write_csv(csv_path);
+    }
+}
+
+void bus_stats_set_csv_path(const char* path) {
+    csv_path = path;
+}
+
+void bus_stats_init() {
+    // Every ps1_system_init_with_bios() calls this, the counts cover all of them and are reported once
+    if (bus_stats != NULL) {
+        return;
+    }
+    bus_stats = calloc(1, sizeof(bus_stats_t));
+    atexit(report_atexit);
+}
+
+void bus_stats_record(u32 virt, u32 phys, int width, bus_stats_kind_t kind) {
+    if (unlikely(bus_stats == NULL)) {
+        return;
+    }
+    if (kind == BUS_READ && width == 32 && virt == PS1CPU.pc) {
+        kind = BUS_FETCH;
+    }
+    int w = BUS_WIDTH_INDEX(width);
+    bus_stats_region_t region = classify(phys);
+    bus_stats->region[region][w][kind]++;
+
+    u32 target;
+    if (region == BUS_REGION_MMIO) {
+        bus_stats->mmio[phys - BUS_MMIO_BASE][w][kind]++;
+        target = phys;
+    } else {
+        target = REGION_TARGET(region);
+    }
+
+    // Instruction fetches are attributed to the PC they fetch, which says nothing new
+    if (kind == BUS_FETCH) {
+        return;
+    }
+
+    // The instruction issuing the access is the one that was just fetched
+    u32 pc = PS1CPU.prev_pc;
+    u32 hash = (target * 0x9E3779B1u) ^ (pc * 0x85EBCA77u) ^ (w << 2 | kind);
+    for (int probe = 0; probe < 32; probe++) {
+        bus_stats_pc_slot_t* slot = &bus_stats->by_pc[(hash + probe) % BUS_STATS_PC_SLOTS];
+        if (!slot->used) {
+            slot->used = true;
+            slot->target = target;
+            slot->pc = pc;
+            slot->width = w;
+            slot->kind = kind;
+        } else if (slot->target != target || slot->pc != pc || slot->width != w || slot->kind != kind) {
+            continue;
+        }
+        slot->count++;
+        return;
+    }
+    bus_stats->by_pc_dropped++;
+}
+
+typedef struct mmio_total {
+    u32 address;
+    u64 total;
+} mmio_total_t;
+
+static int compare_mmio_totals(const void* a, const void* b) {
+    u64 x = ((const mmio_total_t*)a)->total, y = ((const mmio_total_t*)b)->total;
+    return x < y ? 1 : (x > y ? -1 : 0);
+}
+
+static int compare_pc_slots(const void* a, const void* b) {
+    u64 x = ((const bus_stats_pc_slot_t*)a)->count, y = ((const bus_stats_pc_slot_t*)b)->count;
+    return x < y ? 1 : (x > y ? -1 : 0);
+}
+
+// Returns the used PC slots sorted by count, the caller frees them
+static bus_stats_pc_slot_t* sorted_pc_slots(int* count) {
+    bus_stats_pc_slot_t* slots = malloc(sizeof(bus_stats_pc_slot_t) * BUS_STATS_PC_SLOTS);
+    int n = 0;
+    for (int i = 0; i < BUS_STATS_PC_SLOTS; i++) {
+        if (bus_stats->by_pc[i].used) {
+            slots[n++] = bus_stats->by_pc[i];
+        }
+    }
+    qsort(slots, n, sizeof(bus_stats_pc_slot_t), compare_pc_slots);
+    *count = n;
+    return slots;
+}
+
+void bus_stats_report(FILE* fp) {
+    if (bus_stats == NULL) {
+        return;
+    }
+    fprintf(fp, "======== BUS ACCESSES ========\n");
+    fprintf(fp, "%-12s %-6s %14s %14s %14s\n", "region", "kind", "8 bit", "16 bit", "32 bit");
+    for (int region = 0; region < BUS_REGION_COUNT; region++) {
+        for (int kind = 0; kind < BUS_KIND_COUNT; kind++) {
+            u64* counts = (u64[]){ bus_stats->region[region][0][kind], bus_stats->region[region][1][kind], bus_stats->region[region][2][kind] };
+            if (counts[0] + counts[1] + counts[2] > 0) {
+                fprintf(fp, "%-12s %-6s %14" PRIu64 " %14" PRIu64 " %14" PRIu64 "\n", region_names[region], kind_names[kind], counts[0], counts[1], counts[2]);
+            }
+        }
+    }
+
+    mmio_total_t* totals = malloc(sizeof(mmio_total_t) * BUS_MMIO_SIZE);
+    for (u32 i = 0; i < BUS_MMIO_SIZE; i++) {
+        totals[i].address = BUS_MMIO_BASE + i;
+        totals[i].total = 0;
+        for (int w = 0; w < BUS_WIDTH_COUNT; w++) {
+            for (int kind = 0; kind < BUS_KIND_COUNT; kind++) {
+                totals[i].total += bus_stats->mmio[i][w][kind];
+            }
+        }
+    }
+    qsort(totals, BUS_MMIO_SIZE, sizeof(mmio_total_t), compare_mmio_totals);
+    fprintf(fp, "-- MMIO registers --\n");
+    fprintf(fp, "%-8s %-18s %12s %12s %12s %12s %12s %12s\n", "address", "name", "r8", "r16", "r32", "w8", "w16", "w32");
+    for (int i = 0; i < REPORT_TOP_MMIO && totals[i].total > 0; i++) {
+        u64 (*c)[BUS_KIND_COUNT] = bus_stats->mmio[totals[i].address - BUS_MMIO_BASE];
+        fprintf(fp, "%08X %-18s %12" PRIu64 " %12" PRIu64 " %12" PRIu64 " %12" PRIu64 " %12" PRIu64 " %12" PRIu64 "\n",
+                totals[i].address, mmio_name(totals[i].address),
+                c[0][BUS_READ], c[1][BUS_READ], c[2][BUS_READ], c[0][BUS_WRITE], c[1][BUS_WRITE], c[2][BUS_WRITE]);
+    }
+    free(totals);
+
+    int n;
+    bus_stats_pc_slot_t* slots = sorted_pc_slots(&n);
+    fprintf(fp, "-- Hottest accesses by guest PC --\n");
+    for (int i = 0; i < n && i < REPORT_TOP_PCS; i++) {
+        char name[40];
+        target_name(slots[i].target, name, sizeof(name));
+        fprintf(fp, "pc %08X %-5s %2d %-30s %14" PRIu64 "\n", slots[i].pc, kind_names[slots[i].kind], widths[slots[i].width], name, slots[i].count);
+    }
+    if (bus_stats->by_pc_dropped > 0) {
+        fprintf(fp, "%" PRIu64 " accesses not attributed to a PC, the table was full\n", bus_stats->by_pc_dropped);
+    }
+    free(slots);
+}
+
+void bus_stats_write_csv(const char* path) {
+    if (bus_stats == NULL) {
+        return;
+    }
+    FILE* fp = fopen(path, "w");
+    if (fp == NULL) {
+        logfatal("Unable to open %s for writing bus statistics", path);
+    }
+
+    fprintf(fp, "target,name,pc,width,kind,count\n");
+    for (int region = 0; region < BUS_REGION_COUNT; region++) {
+        for (int w = 0; w < BUS_WIDTH_COUNT; w++) {
+            for (int kind = 0; kind < BUS_KIND_COUNT; kind++) {
+                if (bus_stats->region[region][w][kind] > 0) {
+                    fprintf(fp, "region,%s,,%d,%s,%" PRIu64 "\n", region_names[region], widths[w], kind_names[kind], bus_stats->region[region][w][kind]);
+                }
+            }
+        }
+    }
+    for (u32 i = 0; i < BUS_MMIO_SIZE; i++) {
+        for (int w = 0; w < BUS_WIDTH_COUNT; w++) {
+            for (int kind = 0; kind < BUS_KIND_COUNT; kind++) {
+                if (bus_stats->mmio[i][w][kind] > 0) {
+                    fprintf(fp, "%08X,%s,,%d,%s,%" PRIu64 "\n", BUS_MMIO_BASE + i, mmio_name(BUS_MMIO_BASE + i), widths[w], kind_names[kind], bus_stats->mmio[i][w][kind]);
+                }
+            }
+        }
+    }
+
+    int n;
+    bus_stats_pc_slot_t* slots = sorted_pc_slots(&n);
+    for (int i = 0; i < n; i++) {
+        u32 target = slots[i].target;
+        if (IS_REGION_TARGET(target)) {
+            fprintf(fp, "region,%s,", region_names[target & 0xFF]);
+        } else {
+            fprintf(fp, "%08X,%s,", target, mmio_name(target));
+        }
+        fprintf(fp, "%08X,%d,%s,%" PRIu64 "\n", slots[i].pc, widths[slots[i].width], kind_names[slots[i].kind], slots[i].count);
+    }
+    free(slots);
+    fclose(fp);
+}
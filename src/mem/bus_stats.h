@@ -0,0 +1,75 @@
+#ifndef PS1_BUS_STATS_H
+#define PS1_BUS_STATS_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <util.h>
+
+/*
+ * Bus access statistics, only compiled in when PS1_BUS_STATS is defined (cmake -DPS1_BUS_STATS=ON).
+ * Counts accesses per region and per MMIO register, by width and by the guest PC that issued them.
+ * Otherwise BUS_STATS_RECORD expands to nothing.
+ */
+
+#ifdef PS1_BUS_STATS
+
+typedef enum bus_stats_region {
+    BUS_REGION_RAM,
+    BUS_REGION_BIOS,
+    BUS_REGION_SCRATCHPAD,
+    BUS_REGION_MMIO,
+    BUS_REGION_EXP1,
+    BUS_REGION_OTHER,
+    BUS_REGION_COUNT
+} bus_stats_region_t;
+
+typedef enum bus_stats_kind {
+    BUS_READ,
+    BUS_WRITE,
+    BUS_FETCH, // 32 bit read of the instruction at the current PC
+    BUS_KIND_COUNT
+} bus_stats_kind_t;
+
+// Widths are indexed as 8 -> 0, 16 -> 1, 32 -> 2
+#define BUS_WIDTH_INDEX(width) ((width) == 8 ? 0 : ((width) == 16 ? 1 : 2))
+#define BUS_WIDTH_COUNT 3
+
+#define BUS_MMIO_BASE 0x1F801000
+#define BUS_MMIO_SIZE 0x2000
+
+// (target, pc, width, kind) tuples, target is the MMIO address or the region
+#define BUS_STATS_PC_SLOTS 65536
+
+typedef struct bus_stats_pc_slot {
+    u32 target;
+    u32 pc;
+    u8 width;
+    u8 kind;
+    bool used;
+    u64 count;
+} bus_stats_pc_slot_t;
+
+typedef struct bus_stats {
+    u64 region[BUS_REGION_COUNT][BUS_WIDTH_COUNT][BUS_KIND_COUNT];
+    u64 mmio[BUS_MMIO_SIZE][BUS_WIDTH_COUNT][BUS_KIND_COUNT];
+    bus_stats_pc_slot_t by_pc[BUS_STATS_PC_SLOTS];
+    u64 by_pc_dropped;
+} bus_stats_t;
+
+void bus_stats_record(u32 virt, u32 phys, int width, bus_stats_kind_t kind);
+// Starts counting on the first call, later calls keep the counts. The report is printed at exit and also written as
+// CSV if a path was set.
+void bus_stats_init();
+void bus_stats_set_csv_path(const char* path);
+void bus_stats_report(FILE* fp);
+void bus_stats_write_csv(const char* path);
+
+#define BUS_STATS_RECORD(virt, phys, width, kind) bus_stats_record(virt, phys, width, kind)
+
+#else
+
+#define BUS_STATS_RECORD(virt, phys, width, kind) do {} while(0)
+
+#endif
+
+#endif //PS1_BUS_STATS_H
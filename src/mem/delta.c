@@ -0,0 +1,333 @@
+#include "delta.h"
+
+#include <fcntl.h>
+#include <inttypes.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <log.h>
+#include <mem/ps1system.h>
+#include <mem/dirty.h>
+
+#define DELTA_MAX_PAGES (DIRTY_RAM_PAGES + DIRTY_VRAM_PAGES)
+// Header, register sections, page table and one entry per page in the worst case, well under IOV_MAX
+#define DELTA_MAX_IOV (2 + STATE_MAX_SECTIONS + DELTA_MAX_PAGES)
+
+void dirty_reset(u64 base_cycles) {
+    memset(dirty_pages.ram, 0x00, sizeof(dirty_pages.ram));
+    memset(dirty_pages.vram, 0x00, sizeof(dirty_pages.vram));
+    dirty_pages.base_cycles = base_cycles;
+}
+
+INLINE bool is_paged_section(u32 id) {
+    return id == STATE_SECTION_RAM || id == STATE_SECTION_VRAM || id == STATE_SECTION_BIOS;
+}
+
+// The sections stored in full in every delta
+static int register_sections(state_section_t* sections) {
+    state_section_t live[STATE_MAX_SECTIONS];
+    int num_live = state_sections(live);
+    int n = 0;
+    for (int i = 0; i < num_live; i++) {
+        if (!is_paged_section(live[i].id)) {
+            sections[n++] = live[i];
+        }
+    }
+    return n;
+}
+
+static u8* page_data(u32 region, u32 page) {
+    u8* base = region == STATE_SECTION_RAM ? PS1SYS.mem.ram : (u8*)PS1GPU.vram;
+    return base + ((size_t)page << DIRTY_PAGE_SHIFT);
+}
+
+// Appends a buffer, growing the previous entry instead when it's contiguous with it
+INLINE void iov_append(struct iovec* iov, int* iovcnt, void* data, size_t size) {
+    if (*iovcnt > 0 && (u8*)iov[*iovcnt - 1].iov_base + iov[*iovcnt - 1].iov_len == data) {
+        iov[*iovcnt - 1].iov_len += size;
+    } else {
+        iov[(*iovcnt)++] = (struct iovec) { data, size };
+    }
+}
+
+static bool delta_validate(const delta_file_header_t* header, u64 size) {
+    if (size < sizeof(delta_file_header_t) || memcmp(header->magic, DELTA_MAGIC, sizeof(header->magic)) != 0) {
+        logwarn("Not a delta snapshot");
+        return false;
+    }
+    if (header->version != DELTA_VERSION || header->state_version != STATE_VERSION) {
+        logwarn("Delta snapshot is version %u/%u, this build reads version %d/%d",
+                header->version, header->state_version, DELTA_VERSION, STATE_VERSION);
+        return false;
+    }
+    if (header->num_sections > STATE_MAX_SECTIONS || header->num_pages > DELTA_MAX_PAGES) {
+        logwarn("Delta snapshot has too many sections or pages");
+        return false;
+    }
+    state_section_t live[STATE_MAX_SECTIONS];
+    int num_live = register_sections(live);
+    for (int i = 0; i < header->num_sections; i++) {
+        const state_section_header_t* section = &header->sections[i];
+        if (section->offset + section->size > size) {
+            logwarn("Delta snapshot section %s is truncated", state_section_name(section->id));
+            return false;
+        }
+        for (int j = 0; j < num_live; j++) {
+            if (live[j].id == section->id && live[j].size != section->size) {
+                logwarn("Delta snapshot section %s is %" PRIu64 " bytes, expected %zu", state_section_name(section->id), section->size, live[j].size);
+                return false;
+            }
+        }
+    }
+    u64 table_size = header->num_pages * sizeof(delta_page_t);
+    if (header->pages_offset + table_size + ((u64)header->num_pages << DIRTY_PAGE_SHIFT) > size) {
+        logwarn("Delta snapshot pages are truncated");
+        return false;
+    }
+    return true;
+}
+
+static bool delta_page_valid(const delta_page_t* page) {
+    switch (page->region) {
+        case STATE_SECTION_RAM:
+            return page->page < DIRTY_RAM_PAGES;
+        case STATE_SECTION_VRAM:
+            return page->page < DIRTY_VRAM_PAGES;
+        default:
+            return false;
+    }
+}
+
+static void collect_dirty(const u64* bitmap, u32 num_pages, u16 region, delta_page_t* table, u32* num_entries) {
+    for (u32 word = 0; word < num_pages / 64; word++) {
+        u64 bits = bitmap[word];
+        while (bits) {
+            u32 page = word * 64 + __builtin_ctzll(bits);
+            bits &= bits - 1;
+            table[(*num_entries)++] = (delta_page_t) { region, page };
+        }
+    }
+}
+
+bool delta_save(const char* path) {
+    delta_page_t table[DELTA_MAX_PAGES];
+    struct iovec iov[DELTA_MAX_IOV];
+    int iovcnt = 0;
+
+    delta_file_header_t header = {0};
+    memcpy(header.magic, DELTA_MAGIC, sizeof(header.magic));
+    header.version = DELTA_VERSION;
+    header.state_version = STATE_VERSION;
+    header.base_cycles = dirty_pages.base_cycles;
+    header.cycles = PS1SYS.cycles;
+
+    iov[iovcnt++] = (struct iovec) { &header, sizeof(header) };
+    u64 offset = sizeof(header);
+
+    state_section_t sections[STATE_MAX_SECTIONS];
+    header.num_sections = register_sections(sections);
+    for (int i = 0; i < header.num_sections; i++) {
+        header.sections[i] = (state_section_header_t) { .id = sections[i].id, .offset = offset, .size = sections[i].size };
+        iov[iovcnt++] = (struct iovec) { sections[i].data, sections[i].size };
+        offset += sections[i].size;
+    }
+
+    header.pages_offset = offset;
+    header.num_pages = 0;
+    collect_dirty(dirty_pages.ram, DIRTY_RAM_PAGES, STATE_SECTION_RAM, table, &header.num_pages);
+    collect_dirty(dirty_pages.vram, DIRTY_VRAM_PAGES, STATE_SECTION_VRAM, table, &header.num_pages);
+    if (header.num_pages > 0) {
+        iov[iovcnt++] = (struct iovec) { table, header.num_pages * sizeof(delta_page_t) };
+        for (u32 i = 0; i < header.num_pages; i++) {
+            iov_append(iov, &iovcnt, page_data(table[i].region, table[i].page), DIRTY_PAGE_SIZE);
+        }
+    }
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        logwarn("Unable to open %s for writing", path);
+        return false;
+    }
+    bool ok = state_writev(fd, iov, iovcnt);
+    close(fd);
+    if (!ok) {
+        logwarn("Unable to write delta snapshot to %s", path);
+        return false;
+    }
+    dirty_reset(PS1SYS.cycles);
+    return true;
+}
+
+bool delta_load(const char* path) {
+    delta_page_t table[DELTA_MAX_PAGES];
+    struct iovec iov[DELTA_MAX_IOV];
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        logwarn("Unable to open delta snapshot %s", path);
+        return false;
+    }
+    struct stat st;
+    delta_file_header_t header;
+    struct iovec header_iov = { &header, sizeof(header) };
+    if (fstat(fd, &st) != 0 || st.st_size < sizeof(header) || !state_preadv(fd, &header_iov, 1, 0) || !delta_validate(&header, st.st_size)) {
+        close(fd);
+        return false;
+    }
+    if (header.base_cycles != PS1SYS.cycles) {
+        logwarn("%s applies on top of the snapshot at cycle %" PRIu64 ", the machine is at cycle %" PRIu64, path, header.base_cycles, PS1SYS.cycles);
+        close(fd);
+        return false;
+    }
+    struct iovec table_iov = { table, header.num_pages * sizeof(delta_page_t) };
+    if (!state_preadv(fd, &table_iov, 1, header.pages_offset)) {
+        close(fd);
+        return false;
+    }
+    for (u32 i = 0; i < header.num_pages; i++) {
+        if (!delta_page_valid(&table[i])) {
+            logwarn("%s has an invalid page table", path);
+            close(fd);
+            return false;
+        }
+    }
+
+    // Everything is validated, from here on the live machine is overwritten
+    int iovcnt = 0;
+    state_section_t live[STATE_MAX_SECTIONS];
+    int num_live = register_sections(live);
+    for (int i = 0; i < header.num_sections; i++) {
+        for (int j = 0; j < num_live; j++) {
+            if (live[j].id == header.sections[i].id) {
+                struct iovec section_iov = { live[j].data, live[j].size };
+                if (!state_preadv(fd, &section_iov, 1, header.sections[i].offset)) {
+                    logfatal("Read error loading %s, the machine state is now inconsistent", path);
+                }
+            }
+        }
+    }
+    for (u32 i = 0; i < header.num_pages; i++) {
+        iov_append(iov, &iovcnt, page_data(table[i].region, table[i].page), DIRTY_PAGE_SIZE);
+    }
+    if (!state_preadv(fd, iov, iovcnt, header.pages_offset + table_iov.iov_len)) {
+        logfatal("Read error loading %s, the machine state is now inconsistent", path);
+    }
+    close(fd);
+    dirty_reset(header.cycles);
+    return true;
+}
+
+typedef struct mapped_delta {
+    const delta_file_header_t* header;
+    size_t size;
+} mapped_delta_t;
+
+static bool map_delta(const char* path, mapped_delta_t* delta) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        logwarn("Unable to open delta snapshot %s", path);
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < sizeof(delta_file_header_t)) {
+        close(fd);
+        logwarn("%s is not a delta snapshot", path);
+        return false;
+    }
+    void* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return false;
+    }
+    delta->header = data;
+    delta->size = st.st_size;
+    return delta_validate(delta->header, delta->size);
+}
+
+bool delta_merge(const char* out_path, const char** in_paths, int num_inputs) {
+    const u8* sources[DELTA_MAX_PAGES];
+    delta_page_t table[DELTA_MAX_PAGES];
+    struct iovec iov[DELTA_MAX_IOV];
+    if (num_inputs < 1) {
+        return false;
+    }
+    mapped_delta_t inputs[num_inputs];
+    memset(inputs, 0x00, sizeof(inputs));
+    memset(sources, 0x00, sizeof(sources));
+    bool ok = false;
+
+    for (int i = 0; i < num_inputs; i++) {
+        if (!map_delta(in_paths[i], &inputs[i])) {
+            goto done;
+        }
+        const delta_file_header_t* header = inputs[i].header;
+        if (i > 0 && header->base_cycles != inputs[i - 1].header->cycles) {
+            logwarn("%s doesn't follow %s, the chain is broken", in_paths[i], in_paths[i - 1]);
+            goto done;
+        }
+        const delta_page_t* pages = (const delta_page_t*)((const u8*)header + header->pages_offset);
+        const u8* data = (const u8*)(pages + header->num_pages);
+        for (u32 p = 0; p < header->num_pages; p++) {
+            if (!delta_page_valid(&pages[p])) {
+                logwarn("%s has an invalid page table", in_paths[i]);
+                goto done;
+            }
+            // RAM pages first, then VRAM, same order delta_save writes them in
+            u32 index = pages[p].region == STATE_SECTION_RAM ? pages[p].page : DIRTY_RAM_PAGES + pages[p].page;
+            sources[index] = data + ((size_t)p << DIRTY_PAGE_SHIFT);
+        }
+    }
+
+    const delta_file_header_t* first = inputs[0].header;
+    const delta_file_header_t* last = inputs[num_inputs - 1].header;
+    delta_file_header_t header = *last;
+    header.base_cycles = first->base_cycles;
+
+    int iovcnt = 0;
+    iov[iovcnt++] = (struct iovec) { &header, sizeof(header) };
+    u64 offset = sizeof(header);
+    for (int i = 0; i < header.num_sections; i++) {
+        iov[iovcnt++] = (struct iovec) { (u8*)last + last->sections[i].offset, last->sections[i].size };
+        header.sections[i].offset = offset;
+        offset += last->sections[i].size;
+    }
+    header.pages_offset = offset;
+    header.num_pages = 0;
+    for (u32 index = 0; index < DELTA_MAX_PAGES; index++) {
+        if (sources[index] != NULL) {
+            table[header.num_pages++] = index < DIRTY_RAM_PAGES
+                    ? (delta_page_t) { STATE_SECTION_RAM, index }
+                    : (delta_page_t) { STATE_SECTION_VRAM, index - DIRTY_RAM_PAGES };
+        }
+    }
+    if (header.num_pages > 0) {
+        iov[iovcnt++] = (struct iovec) { table, header.num_pages * sizeof(delta_page_t) };
+        for (u32 index = 0; index < DELTA_MAX_PAGES; index++) {
+            if (sources[index] != NULL) {
+                iov_append(iov, &iovcnt, (void*)sources[index], DIRTY_PAGE_SIZE);
+            }
+        }
+    }
+
+    int fd = open(out_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        logwarn("Unable to open %s for writing", out_path);
+        goto done;
+    }
+    ok = state_writev(fd, iov, iovcnt);
+    close(fd);
+    if (!ok) {
+        logwarn("Unable to write merged delta snapshot to %s", out_path);
+    }
+
+done:
+    for (int i = 0; i < num_inputs; i++) {
+        if (inputs[i].header != NULL) {
+            munmap((void*)inputs[i].header, inputs[i].size);
+        }
+    }
+    return ok;
+}
@@ -0,0 +1,43 @@
+#ifndef PS1_DELTA_H
+#define PS1_DELTA_H
+
+#include <stdbool.h>
+#include <util.h>
+#include <mem/state.h>
+
+/*
+ * Delta snapshots: the small register sections in full plus only the RAM and VRAM pages written since the previous
+ * snapshot (full or delta). A chain is a full state followed by deltas, each one applying on top of the one before it.
+ * Consecutive deltas can be merged into one.
+ *
+ * Layout: header, register sections, page table, then the page data in page table order.
+ */
+
+#define DELTA_MAGIC "PS1DELTA"
+#define DELTA_VERSION 1
+
+typedef struct delta_page {
+    u16 region; // STATE_SECTION_RAM or STATE_SECTION_VRAM
+    u16 page;
+} delta_page_t;
+
+typedef struct delta_file_header {
+    char magic[8];
+    u32 version;
+    u32 state_version; // Register sections use the STATE_VERSION layout
+    u64 base_cycles;   // Cycle count of the snapshot this applies on top of
+    u64 cycles;
+    u32 num_sections;
+    u32 num_pages;
+    u64 pages_offset;  // Page table, the page data follows it
+    state_section_header_t sections[STATE_MAX_SECTIONS];
+} delta_file_header_t;
+
+// Writes the changes since the last snapshot and starts tracking from now. Returns false on failure.
+bool delta_save(const char* path);
+// Applies a delta on top of the live machine, which must be at the delta's base snapshot
+bool delta_load(const char* path);
+// Merges consecutive deltas into one, later pages replace earlier ones
+bool delta_merge(const char* out_path, const char** in_paths, int num_inputs);
+
+#endif //PS1_DELTA_H
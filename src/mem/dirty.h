@@ -0,0 +1,55 @@
+#ifndef PS1_DIRTY_H
+#define PS1_DIRTY_H
+
+#include <util.h>
+#include <gpu/gpu.h>
+
+/*
+ * Pages of RAM and VRAM written since the last snapshot, one bit per 4KiB page. Marked by every path that writes
+ * them (CPU stores, DMA, GPU transfers) so delta snapshots only need to save what changed.
+ */
+
+#define DIRTY_PAGE_SHIFT 12
+#define DIRTY_PAGE_SIZE (1 << DIRTY_PAGE_SHIFT)
+#define DIRTY_RAM_PAGES (0x200000 >> DIRTY_PAGE_SHIFT)
+#define DIRTY_VRAM_PAGES ((VRAM_WIDTH * VRAM_HEIGHT * 2) >> DIRTY_PAGE_SHIFT)
+
+typedef struct dirty_pages {
+    u64 ram[DIRTY_RAM_PAGES / 64];
+    u64 vram[DIRTY_VRAM_PAGES / 64];
+    // Cycle count of the snapshot the dirty bits are relative to
+    u64 base_cycles;
+} dirty_pages_t;
+
+// Dirty pages of the current instance, see ps1_instance_select
+extern _Thread_local dirty_pages_t* ps1_dirty;
+#define dirty_pages (*ps1_dirty)
+
+INLINE void dirty_mark_ram(u32 address) {
+    u32 page = (address & 0x1FFFFF) >> DIRTY_PAGE_SHIFT;
+    dirty_pages.ram[page >> 6] |= 1ull << (page & 63);
+}
+
+INLINE void dirty_mark_ram_range(u32 address, u32 size) {
+    for (u32 offset = 0; offset < size; offset += DIRTY_PAGE_SIZE) {
+        dirty_mark_ram(address + offset);
+    }
+    if (size > 0) {
+        dirty_mark_ram(address + size - 1);
+    }
+}
+
+// index is in pixels
+INLINE void dirty_mark_vram(u32 index) {
+    u32 page = (index * 2) >> DIRTY_PAGE_SHIFT;
+    dirty_pages.vram[page >> 6] |= 1ull << (page & 63);
+}
+
+INLINE bool dirty_page_test(const u64* bitmap, u32 page) {
+    return (bitmap[page >> 6] >> (page & 63)) & 1;
+}
+
+// Called whenever a full snapshot is taken or loaded, the next delta is relative to it
+void dirty_reset(u64 base_cycles);
+
+#endif //PS1_DIRTY_H
@@ -3,6 +3,147 @@
 #include <log.h>
 #include <mem/addresses.h>
 #include <mem/ps1system.h>
+#include <mem/mem_util.h>
+#include <gpu/gpu.h>
+#include <mem/dirty.h>
+#include <cdrom/cdrom.h>
+
+#define DMA_ADDR_MASK 0x1FFFFC
+#define DMA_CHANNEL_GPU 2
+#define DMA_CHANNEL_CDROM 3
+#define DMA_CHANNEL_OTC 6
+
+#define SYNCMODE_MANUAL 0
+#define SYNCMODE_REQUEST 1
+#define SYNCMODE_LINKED_LIST 2
+
+// More nodes than fit in RAM, a list this long loops or is missing its end marker
+#define DMA_MAX_LIST_NODES 0x100000
+
+#define DMA_IRQ (1 << 3)
+#define DICR_FORCE_IRQ (1 << 15)
+#define DICR_MASTER_ENABLE (1 << 23)
+#define DICR_FLAGS 0x7F000000
+#define DICR_MASTER_FLAG (1u << 31)
+// Read/write bits, the flags are written 1 to clear and the master flag is read-only
+#define DICR_WRITABLE 0x00FF803F
+
+INLINE bool dma_channel_enabled(int channel) {
+    return (PS1SYS.dma.dpcr >> (channel * 4 + 3)) & 1;
+}
+
+INLINE u32 dma_transfer_words(int channel) {
+    dma_block_ctrl_t block = PS1SYS.dma.block_ctrl[channel];
+    if (PS1SYS.dma.dma_channel_ctrl[channel].syncmode == SYNCMODE_MANUAL) {
+        return block.bc == 0 ? 0x10000 : block.bc;
+    } else {
+        return block.bs * block.ba;
+    }
+}
+
+// Straight from the sector in the disc image to RAM, in as few copies as the RAM wrapping around allows
+void dma_cdrom_transfer(u32 addr, u32 words) {
+    u32 bytes = words * 4;
+    while (bytes > 0) {
+        u32 current = addr & DMA_ADDR_MASK;
+        u32 chunk = PS1_RAM_SIZE - current < bytes ? PS1_RAM_SIZE - current : bytes;
+        cdrom_dma_read(PS1SYS.mem.ram + current, chunk);
+        dirty_mark_ram_range(current, chunk);
+        addr += chunk;
+        bytes -= chunk;
+    }
+}
+
+void dma_block_transfer(int channel) {
+    dma_channel_ctrl_t ctrl = PS1SYS.dma.dma_channel_ctrl[channel];
+    u32 addr = PS1SYS.dma.base_addr[channel];
+    s32 step = ctrl.reverse ? -4 : 4;
+    u32 words = dma_transfer_words(channel);
+
+    if (channel == DMA_CHANNEL_CDROM) {
+        unimplemented(ctrl.direction != 0 || ctrl.reverse, "DMA3 from RAM or in reverse");
+        dma_cdrom_transfer(addr, words);
+        return;
+    }
+
+    for (u32 i = 0; i < words; i++) {
+        u32 current = addr & DMA_ADDR_MASK;
+        if (ctrl.direction == 0) { // to main ram
+            u32 value;
+            switch (channel) {
+                case DMA_CHANNEL_OTC:
+                    // Each entry points at the previous one, the last is the end marker
+                    value = i == words - 1 ? 0x00FFFFFF : ((addr - 4) & 0x1FFFFF);
+                    break;
+                default:
+                    logfatal("DMA%d block transfer to RAM", channel);
+            }
+            u32_to_byte_array(PS1SYS.mem.ram, current, value);
+            dirty_mark_ram(current);
+        } else {
+            u32 value = u32_from_byte_array(PS1SYS.mem.ram, current);
+            switch (channel) {
+                case DMA_CHANNEL_GPU:
+                    gpu_gp0_write(value);
+                    break;
+                default:
+                    logfatal("DMA%d block transfer from RAM", channel);
+            }
+        }
+        addr += step;
+    }
+}
+
+void dma_linked_list_transfer(int channel) {
+    unimplemented(channel != DMA_CHANNEL_GPU, "DMA%d linked list transfer", channel);
+    unimplemented(PS1SYS.dma.dma_channel_ctrl[channel].direction == 0, "DMA linked list transfer to RAM");
+
+    u32 addr = PS1SYS.dma.base_addr[channel] & DMA_ADDR_MASK;
+    for (int nodes = 0; nodes < DMA_MAX_LIST_NODES; nodes++) {
+        u32 header = u32_from_byte_array(PS1SYS.mem.ram, addr);
+        u32 words = header >> 24;
+        for (u32 i = 0; i < words; i++) {
+            addr = (addr + 4) & DMA_ADDR_MASK;
+            gpu_gp0_write(u32_from_byte_array(PS1SYS.mem.ram, addr));
+        }
+        if (header & 0x800000) {
+            break;
+        }
+        addr = header & DMA_ADDR_MASK;
+    }
+}
+
+// The master flag is set by the force bit, or by any enabled channel's flag while the master enable is set. IRQ3 is
+// raised when it goes from 0 to 1.
+static void dma_update_master_flag() {
+    u32 dicr = PS1SYS.dma.dicr;
+    bool flag = (dicr & DICR_FORCE_IRQ) || ((dicr & DICR_MASTER_ENABLE) && ((dicr >> 16) & (dicr >> 24) & 0x7F));
+    if (flag && !(dicr & DICR_MASTER_FLAG)) {
+        PS1SYS.i_stat |= DMA_IRQ;
+    }
+    PS1SYS.dma.dicr = flag ? dicr | DICR_MASTER_FLAG : dicr & ~DICR_MASTER_FLAG;
+}
+
+void dma_run(int channel) {
+    switch (PS1SYS.dma.dma_channel_ctrl[channel].syncmode) {
+        case SYNCMODE_MANUAL:
+        case SYNCMODE_REQUEST:
+            dma_block_transfer(channel);
+            break;
+        case SYNCMODE_LINKED_LIST:
+            dma_linked_list_transfer(channel);
+            break;
+        default:
+            logfatal("DMA%d: unknown sync mode %d", channel, PS1SYS.dma.dma_channel_ctrl[channel].syncmode);
+    }
+
+    PS1SYS.dma.dma_channel_ctrl[channel].start_busy = 0;
+    PS1SYS.dma.dma_channel_ctrl[channel].start_trigger = 0;
+    if ((PS1SYS.dma.dicr >> (16 + channel)) & 1) {
+        PS1SYS.dma.dicr |= 1 << (24 + channel);
+        dma_update_master_flag();
+    }
+}
 
 void write_dma_channel_ctrl(int channel, u32 value) {
     PS1SYS.dma.dma_channel_ctrl[channel].raw = value;
@@ -17,8 +158,11 @@ void write_dma_channel_ctrl(int channel, u32 value) {
     logwarn("DMA%d_CHANNEL_CTRL.start_busy: %d", channel, ctrl.start_busy);
     logwarn("DMA%d_CHANNEL_CTRL.start_trigger: %d", channel, ctrl.start_trigger);
 
-    unimplemented(ctrl.start_busy != 0, "DMA%d_CHANNEL_CTRL: start_busy = %d", channel, ctrl.start_busy);
-    unimplemented(ctrl.start_trigger != 0, "DMA%d_CHANNEL_CTRL: start_trigger = %d", channel, ctrl.start_trigger);
+    // Manual sync mode waits for the trigger bit, the others start as soon as the channel is busy
+    bool start = ctrl.syncmode == SYNCMODE_MANUAL ? ctrl.start_trigger : ctrl.start_busy;
+    if (start && dma_channel_enabled(channel)) {
+        dma_run(channel);
+    }
 }
 
 void dma_register_write(u32 address, u32 value) {
@@ -27,7 +171,9 @@ void dma_register_write(u32 address, u32 value) {
             PS1SYS.dma.dpcr = value;
             break;
         case DMA_DICR:
-            PS1SYS.dma.dicr = value;
+            PS1SYS.dma.dicr = (value & DICR_WRITABLE) | (PS1SYS.dma.dicr & ~value & DICR_FLAGS)
+                    | (PS1SYS.dma.dicr & DICR_MASTER_FLAG);
+            dma_update_master_flag();
             break;
         case DMA0_BASE_ADDR:
             logfatal("DMA0_BASE_ADDR = %08X", value);
@@ -42,19 +188,29 @@ void dma_register_write(u32 address, u32 value) {
         case DMA1_CHANNEL_CTRL:
             logfatal("DMA1_CHANNEL_CTRL = %08X", value);
         case DMA2_BASE_ADDR:
-            logfatal("DMA2_BASE_ADDR = %08X", value);
+            logwarn("DMA2_BASE_ADDR = %08X", value);
+            PS1SYS.dma.base_addr[2] = value;
+            break;
         case DMA2_BLOCK_CTRL:
-            logfatal("DMA2_BLOCK_CTRL = %08X", value);
+            logwarn("DMA2_BLOCK_CTRL = %08X", value);
+            PS1SYS.dma.block_ctrl[2].raw = value;
+            break;
         case DMA2_CHANNEL_CTRL:
             logwarn("DMA2_CHANNEL_CTRL = %08X", value);
             write_dma_channel_ctrl(2, value);
             break;
         case DMA3_BASE_ADDR:
-            logfatal("DMA3_BASE_ADDR = %08X", value);
+            logwarn("DMA3_BASE_ADDR = %08X", value);
+            PS1SYS.dma.base_addr[3] = value;
+            break;
         case DMA3_BLOCK_CTRL:
-            logfatal("DMA3_BLOCK_CTRL = %08X", value);
+            logwarn("DMA3_BLOCK_CTRL = %08X", value);
+            PS1SYS.dma.block_ctrl[3].raw = value;
+            break;
         case DMA3_CHANNEL_CTRL:
-            logfatal("DMA3_CHANNEL_CTRL = %08X", value);
+            logwarn("DMA3_CHANNEL_CTRL = %08X", value);
+            write_dma_channel_ctrl(3, value);
+            break;
         case DMA4_BASE_ADDR:
             logfatal("DMA4_BASE_ADDR = %08X", value);
         case DMA4_BLOCK_CTRL:
@@ -103,17 +259,17 @@ u32 dma_register_read(u32 address) {
         case DMA1_CHANNEL_CTRL:
             logfatal("read DMA1_CHANNEL_CTRL");
         case DMA2_BASE_ADDR:
-            logfatal("read DMA2_BASE_ADDR");
+            return PS1SYS.dma.base_addr[2];
         case DMA2_BLOCK_CTRL:
-            logfatal("read DMA2_BLOCK_CTRL");
+            return PS1SYS.dma.block_ctrl[2].raw;
         case DMA2_CHANNEL_CTRL:
-            logfatal("read DMA2_CHANNEL_CTRL");
+            return PS1SYS.dma.dma_channel_ctrl[2].raw;
         case DMA3_BASE_ADDR:
-            logfatal("read DMA3_BASE_ADDR");
+            return PS1SYS.dma.base_addr[3];
         case DMA3_BLOCK_CTRL:
-            logfatal("read DMA3_BLOCK_CTRL");
+            return PS1SYS.dma.block_ctrl[3].raw;
         case DMA3_CHANNEL_CTRL:
-            logfatal("read DMA3_CHANNEL_CTRL");
+            return PS1SYS.dma.dma_channel_ctrl[3].raw;
         case DMA4_BASE_ADDR:
             logfatal("read DMA4_BASE_ADDR");
         case DMA4_BLOCK_CTRL:
@@ -25,7 +25,7 @@ typedef union dma_channel_ctrl {
 } dma_channel_ctrl_t;
 ASSERT32(dma_channel_ctrl_t);
 
-typedef struct dma_block_ctrl {
+typedef union dma_block_ctrl {
     u32 raw;
     struct {
         unsigned bc:16;
@@ -36,6 +36,7 @@ typedef struct dma_block_ctrl {
         unsigned ba:16;
     };
 } dma_block_ctrl_t;
+ASSERT32(dma_block_ctrl_t);
 
 typedef struct dma_state {
     u32 dpcr;
@@ -0,0 +1,94 @@
+#include "exe.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <log.h>
+#include <cpu/cpu.h>
+#include <mem/ps1system.h>
+#include <mem/dirty.h>
+#include <mem/mem_util.h>
+
+#define EXE_MAGIC "PS-X EXE"
+
+INLINE bool in_ram(u32 address, u32 size) {
+    u32 phys = address & 0x1FFFFFFF;
+    return phys < PS1_RAM_SIZE && size <= PS1_RAM_SIZE - phys;
+}
+
+ps1_exe_t* exe_load(const char* path) {
+    FILE* fp = fopen(path, "rb");
+    if (fp == NULL) {
+        logwarn("Unable to open %s", path);
+        return NULL;
+    }
+    u8 header[EXE_HEADER_SIZE];
+    if (fread(header, sizeof(header), 1, fp) != 1 || memcmp(header, EXE_MAGIC, strlen(EXE_MAGIC)) != 0) {
+        logwarn("%s is not a PS-X EXE", path);
+        fclose(fp);
+        return NULL;
+    }
+
+    ps1_exe_t* exe = calloc(1, sizeof(ps1_exe_t));
+    exe->pc = u32_from_byte_array(header, 0x10);
+    exe->gp = u32_from_byte_array(header, 0x14);
+    exe->load_address = u32_from_byte_array(header, 0x18);
+    exe->size = u32_from_byte_array(header, 0x1C);
+    exe->bss_address = u32_from_byte_array(header, 0x28);
+    exe->bss_size = u32_from_byte_array(header, 0x2C);
+    u32 sp_base = u32_from_byte_array(header, 0x30);
+    exe->sp = sp_base != 0 ? sp_base + u32_from_byte_array(header, 0x34) : 0;
+
+    if (!in_ram(exe->load_address, exe->size) || (exe->bss_size > 0 && !in_ram(exe->bss_address, exe->bss_size))) {
+        logwarn("%s doesn't fit in RAM: %u bytes at 0x%08X, %u bytes of BSS at 0x%08X", path, exe->size,
+                exe->load_address, exe->bss_size, exe->bss_address);
+        exe_free(exe);
+        fclose(fp);
+        return NULL;
+    }
+    exe->text = malloc(exe->size);
+    if (fread(exe->text, 1, exe->size, fp) != exe->size) {
+        logwarn("%s is truncated, the header says it has %u bytes of text", path, exe->size);
+        exe_free(exe);
+        fclose(fp);
+        return NULL;
+    }
+    fclose(fp);
+    logalways("Loaded %s: %u bytes at 0x%08X, entry point 0x%08X", path, exe->size, exe->load_address, exe->pc);
+    return exe;
+}
+
+void exe_free(ps1_exe_t* exe) {
+    if (exe != NULL) {
+        free(exe->text);
+        free(exe);
+    }
+}
+
+static void copy_to_ram(u32 address, const u8* data, u32 size) {
+    u32 phys = address & 0x1FFFFF;
+    if (data != NULL) {
+        memcpy(PS1SYS.mem.ram + phys, data, size);
+    } else {
+        memset(PS1SYS.mem.ram + phys, 0x00, size);
+    }
+    for (u32 page = phys & ~(DIRTY_PAGE_SIZE - 1); page < phys + size; page += DIRTY_PAGE_SIZE) {
+        dirty_mark_ram(page);
+    }
+}
+
+void exe_boot(const ps1_exe_t* exe) {
+    copy_to_ram(exe->load_address, exe->text, exe->size);
+    if (exe->bss_size > 0) {
+        copy_to_ram(exe->bss_address, NULL, exe->bss_size);
+    }
+    PS1CPU.gpr[28] = exe->gp;
+    // Direct and HLE boots have no BIOS stack to keep, SP is still 0 from reset
+    u32 sp = exe->sp != 0 ? exe->sp : EXE_DEFAULT_SP;
+    PS1CPU.gpr[29] = sp;
+    PS1CPU.gpr[30] = sp;
+    PS1CPU.branch = false;
+    cpu_set_pc(exe->pc);
+    loginfo("Booting the EXE at 0x%08X", exe->pc);
+}
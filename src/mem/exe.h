@@ -0,0 +1,32 @@
+#ifndef PS1_EXE_H
+#define PS1_EXE_H
+
+#include <util.h>
+#include <stdbool.h>
+
+// Where the BIOS jumps to the shell once the kernel is set up, PS-X EXEs are side-loaded here to skip the boot animation
+#define EXE_SHELL_ENTRY 0x80030000
+
+#define EXE_HEADER_SIZE 0x800
+// Stack for EXEs whose header doesn't set one, the same one the BIOS starts them with
+#define EXE_DEFAULT_SP 0x801FFF00
+
+// A PS-X EXE, the header fields that matter for booting and the text segment that follows it
+typedef struct ps1_exe {
+    u32 pc;
+    u32 gp;
+    u32 load_address;
+    u32 size;
+    u32 bss_address;
+    u32 bss_size;
+    u32 sp; // 0 for the default stack, EXE_DEFAULT_SP
+    u8* text;
+} ps1_exe_t;
+
+// Reads and validates `path`, returns NULL after logging a warning when it isn't a usable PS-X EXE
+ps1_exe_t* exe_load(const char* path);
+void exe_free(ps1_exe_t* exe);
+// Copies the EXE into RAM and jumps to its entry point with GP and SP set up
+void exe_boot(const ps1_exe_t* exe);
+
+#endif //PS1_EXE_H
@@ -0,0 +1,169 @@
+#include "footprint.h"
+
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <log.h>
+#include <mem/ps1system.h>
+
+static footprint_mode_t mode = FOOTPRINT_DEFAULT;
+
+void footprint_set_mode(footprint_mode_t new_mode) {
+    mode = new_mode;
+}
+
+footprint_mode_t footprint_get_mode() {
+    return mode;
+}
+
+// Zeroes [p, p + size), handing whole pages back to the kernel instead of writing to them
+static void drop_pages(void* p, size_t size) {
+    uintptr_t page_size = sysconf(_SC_PAGESIZE);
+    uintptr_t start = (uintptr_t)p;
+    uintptr_t end = start + size;
+    uintptr_t first_page = (start + page_size - 1) & ~(page_size - 1);
+    uintptr_t last_page = end & ~(page_size - 1);
+    if (first_page >= last_page) {
+        memset(p, 0x00, size);
+        return;
+    }
+    memset(p, 0x00, first_page - start);
+    memset((void*)last_page, 0x00, end - last_page);
+    // Private anonymous pages read back as zero after this
+    if (madvise((void*)first_page, last_page - first_page, MADV_DONTNEED) != 0) {
+        memset((void*)first_page, 0x00, last_page - first_page);
+    }
+}
+
+static u8* map_anonymous(size_t size, int flags) {
+    void* p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | flags, -1, 0);
+    return p == MAP_FAILED ? NULL : p;
+}
+
+// Maps `size` bytes starting on a huge page boundary, trimming the slack from an oversized mapping
+static u8* map_huge_aligned(size_t size) {
+    u8* p = map_anonymous(size + HUGE_PAGE_SIZE, 0);
+    if (p == NULL) {
+        return NULL;
+    }
+    u8* aligned = (u8*)(((uintptr_t)p + HUGE_PAGE_SIZE - 1) & ~((uintptr_t)HUGE_PAGE_SIZE - 1));
+    if (aligned > p) {
+        munmap(p, aligned - p);
+    }
+    munmap(aligned + size, (p + size + HUGE_PAGE_SIZE) - (aligned + size));
+    return aligned;
+}
+
+void guest_memory_alloc(guest_memory_t* memory, size_t size) {
+    memory->size = size;
+    if (mode == FOOTPRINT_COMPACT) {
+        memory->mapped_size = size;
+        memory->base = map_anonymous(size, MAP_NORESERVE);
+        memory->backing = GUEST_MEMORY_COMPACT;
+    } else {
+        // Whole huge pages, so the last one can be huge too
+        memory->mapped_size = (size + HUGE_PAGE_SIZE - 1) & ~((size_t)HUGE_PAGE_SIZE - 1);
+        memory->base = map_anonymous(memory->mapped_size, MAP_HUGETLB);
+        memory->backing = GUEST_MEMORY_HUGETLB;
+        if (memory->base == NULL) {
+            memory->base = map_huge_aligned(memory->mapped_size);
+            memory->backing = GUEST_MEMORY_THP;
+            if (memory->base != NULL && madvise(memory->base, memory->mapped_size, MADV_HUGEPAGE) != 0) {
+                memory->backing = GUEST_MEMORY_PAGES;
+            }
+        }
+    }
+    if (memory->base == NULL) {
+        logfatal("Unable to map %zu bytes of guest memory", size);
+    }
+    loginfo("Guest memory: %zu KiB on %s", memory->mapped_size / 1024, guest_memory_backing_name(memory->backing));
+}
+
+void guest_memory_free(guest_memory_t* memory) {
+    if (memory->base != NULL) {
+        munmap(memory->base, memory->mapped_size);
+    }
+    memset(memory, 0x00, sizeof(guest_memory_t));
+}
+
+void guest_memory_clear(guest_memory_t* memory) {
+    if (memory->backing == GUEST_MEMORY_COMPACT) {
+        drop_pages(memory->base, memory->size);
+    } else {
+        // Dropping huge pages would only get them faulted back in one at a time
+        memset(memory->base, 0x00, memory->size);
+    }
+}
+
+const char* guest_memory_backing_name(guest_memory_backing_t backing) {
+    switch (backing) {
+        case GUEST_MEMORY_PAGES:   return "normal pages";
+        case GUEST_MEMORY_THP:     return "transparent huge pages";
+        case GUEST_MEMORY_HUGETLB: return "hugetlbfs pages";
+        case GUEST_MEMORY_COMPACT: return "lazily committed pages";
+    }
+    return "?";
+}
+
+// Bytes of [p, p + size) backed by a resident page
+static size_t resident_bytes(const void* p, size_t size) {
+    uintptr_t page_size = sysconf(_SC_PAGESIZE);
+    uintptr_t start = (uintptr_t)p;
+    uintptr_t end = start + size;
+    uintptr_t base = start & ~(page_size - 1);
+    size_t num_pages = (end - base + page_size - 1) / page_size;
+    unsigned char vec[num_pages];
+    if (size == 0 || mincore((void*)base, end - base, vec) != 0) {
+        return 0;
+    }
+    size_t resident = 0;
+    for (size_t i = 0; i < num_pages; i++) {
+        if (vec[i] & 1) {
+            uintptr_t page_start = base + i * page_size;
+            uintptr_t page_end = page_start + page_size;
+            resident += (page_end < end ? page_end : end) - (page_start > start ? page_start : start);
+        }
+    }
+    return resident;
+}
+
+static void add_region(footprint_t* footprint, const char* name, const void* p, size_t size, bool shared) {
+    footprint->regions[footprint->num_regions++] = (footprint_region_t) {
+            .name = name,
+            .size = size,
+            .resident = resident_bytes(p, size),
+            .shared = shared
+    };
+}
+
+void footprint_measure(footprint_t* footprint) {
+    ps1_instance_t* instance = ps1_instance_current();
+    footprint->num_regions = 0;
+    footprint->backing = instance->memory.backing;
+    add_region(footprint, "ram", PS1SYS.mem.ram, PS1_RAM_SIZE, false);
+    add_region(footprint, "vram", PS1GPU.vram, VRAM_SIZE, false);
+    add_region(footprint, "devices", &PS1SYS, sizeof(PS1SYS), false);
+    add_region(footprint, "cpu", &instance->cpu, sizeof(instance->cpu), false);
+    add_region(footprint, "dirty", &instance->dirty, sizeof(instance->dirty), false);
+    if (PS1SYS.mem.bios != NULL) {
+        add_region(footprint, "bios", PS1SYS.mem.bios, PS1SYS.mem.bios_size, true);
+    }
+}
+
+void footprint_print(const footprint_t* footprint) {
+    size_t size = 0;
+    size_t resident = 0;
+    logalways("======== FOOTPRINT ========");
+    for (int i = 0; i < footprint->num_regions; i++) {
+        const footprint_region_t* region = &footprint->regions[i];
+        logalways("%-8s %9.1f KiB resident of %9.1f KiB%s", region->name, region->resident / 1024.0, region->size / 1024.0,
+                  region->shared ? " (shared)" : "");
+        if (!region->shared) {
+            size += region->size;
+            resident += region->resident;
+        }
+    }
+    logalways("%-8s %9.1f KiB resident of %9.1f KiB", "total", resident / 1024.0, size / 1024.0);
+    logalways("RAM and VRAM are on %s", guest_memory_backing_name(footprint->backing));
+}
@@ -0,0 +1,69 @@
+#ifndef PS1_FOOTPRINT_H
+#define PS1_FOOTPRINT_H
+
+#include <util.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+/*
+ * Host memory used per instance. Guest RAM and VRAM live in one block per instance, allocated on 2MiB boundaries and
+ * put on huge pages when the host has them: hugetlbfs pages if any are reserved, otherwise transparent huge pages,
+ * otherwise normal pages. RAM fills the first huge page and VRAM starts the second, so guest memory accesses need two
+ * TLB entries instead of up to 768.
+ *
+ * In the compact mode the block is mapped with MAP_NORESERVE on normal pages and cleared by dropping its pages instead
+ * of writing zeroes, so RAM and VRAM only take up host memory once the guest touches them.
+ */
+
+#define HUGE_PAGE_SIZE 0x200000
+
+typedef enum footprint_mode {
+    FOOTPRINT_DEFAULT,
+    FOOTPRINT_COMPACT,
+} footprint_mode_t;
+
+// Applies to guest memory allocated afterwards
+void footprint_set_mode(footprint_mode_t mode);
+footprint_mode_t footprint_get_mode();
+
+typedef enum guest_memory_backing {
+    GUEST_MEMORY_PAGES,
+    GUEST_MEMORY_THP,      // madvise(MADV_HUGEPAGE), the kernel uses huge pages when it can
+    GUEST_MEMORY_HUGETLB,  // MAP_HUGETLB, always huge pages
+    GUEST_MEMORY_COMPACT,  // MAP_NORESERVE, committed on first touch
+} guest_memory_backing_t;
+
+typedef struct guest_memory {
+    u8* base;
+    size_t size;
+    size_t mapped_size;
+    guest_memory_backing_t backing;
+} guest_memory_t;
+
+// Zero filled
+void guest_memory_alloc(guest_memory_t* memory, size_t size);
+void guest_memory_free(guest_memory_t* memory);
+void guest_memory_clear(guest_memory_t* memory);
+const char* guest_memory_backing_name(guest_memory_backing_t backing);
+
+#define FOOTPRINT_MAX_REGIONS 8
+
+typedef struct footprint_region {
+    const char* name;
+    size_t size;
+    size_t resident;
+    bool shared; // Shared with other instances, don't add it to each instance's total
+} footprint_region_t;
+
+typedef struct footprint {
+    footprint_region_t regions[FOOTPRINT_MAX_REGIONS];
+    int num_regions;
+    guest_memory_backing_t backing;
+} footprint_t;
+
+// Resident bytes of each part of the current instance. Pages the guest only read from count too, even though the
+// kernel backs them all with the same zero page.
+void footprint_measure(footprint_t* footprint);
+void footprint_print(const footprint_t* footprint);
+
+#endif //PS1_FOOTPRINT_H
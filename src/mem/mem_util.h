@@ -8,7 +8,7 @@ INLINE void u16_to_byte_array(u8* arr, u32 index, u16 value) {
     memcpy(arr + index, &value, sizeof(u16));
 }
 
-INLINE u16 u16_from_byte_array(u8* arr, u32 index) {
+INLINE u16 u16_from_byte_array(const u8* arr, u32 index) {
     u16 val;
     memcpy(&val, arr + index, sizeof(u16));
     return val;
@@ -18,7 +18,7 @@ INLINE void u32_to_byte_array(u8* arr, u32 index, u32 value) {
     memcpy(arr + index, &value, sizeof(u32));
 }
 
-INLINE u32 u32_from_byte_array(u8* arr, u32 index) {
+INLINE u32 u32_from_byte_array(const u8* arr, u32 index) {
     u32 val;
     memcpy(&val, arr + index, sizeof(u32));
     return val;
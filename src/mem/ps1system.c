@@ -1,43 +1,152 @@
 #include "ps1system.h"
 
 #include <log.h>
+#include <inttypes.h>
+#include <timing.h>
 #include <cpu/cpu.h>
+#include <mem/bus_stats.h>
+#include <cpu/sampler.h>
+#include <mem/state.h>
+#include <mem/delta.h>
+#include <mem/dirty.h>
+#include <mem/rewind.h>
+#include <mem/footprint.h>
+#include <hle/hle.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
 
-ps1_system_t ps1_system;
+#ifdef PS1_PROFILE
+#include <cpu/profiler.h>
+#endif
 
-void load_bios(const char* bios_path) {
-    FILE *fp = fopen(bios_path, "rb");
+static ps1_instance_t default_instance;
 
-    if (fp == NULL) {
-        logfatal("Error opening the BIOS file at %s! Are you sure this is a correct path?", bios_path);
+_Thread_local ps1_system_t* ps1_system = &default_instance.system;
+_Thread_local r3000a_t* ps1cpu = &default_instance.cpu;
+_Thread_local dirty_pages_t* ps1_dirty = &default_instance.dirty;
+static _Thread_local ps1_instance_t* current_instance = &default_instance;
+
+ps1_instance_t* ps1_instance_create() {
+    ps1_instance_t* instance = calloc(1, sizeof(ps1_instance_t));
+    if (instance == NULL) {
+        logfatal("Unable to allocate a %zu byte instance", sizeof(ps1_instance_t));
     }
+    return instance;
+}
+
+void ps1_instance_destroy(ps1_instance_t* instance) {
+    if (instance == current_instance) {
+        // Also moves the log's cycle counter off the instance
+        ps1_instance_select(&default_instance);
+    }
+    bios_release(instance->system.mem.bios_image);
+    exe_free(instance->system.pending_exe);
+    disc_close(instance->system.disc);
+    guest_memory_free(&instance->memory);
+    free(instance);
+}
+
+void ps1_instance_select(ps1_instance_t* instance) {
+    current_instance = instance;
+    ps1_system = &instance->system;
+    ps1cpu = &instance->cpu;
+    ps1_dirty = &instance->dirty;
+    // The log's cycle counter follows the instance, it must never be left pointing at a destroyed one
+    log_set_cycle_counter(&instance->system.cycles);
+}
+
+ps1_instance_t* ps1_instance_current() {
+    return current_instance;
+}
 
-    fseek(fp, 0, SEEK_END);
-    size_t size = ftell(fp);
+void ps1_instance_request_stop(ps1_instance_t* instance) {
+    atomic_store(&instance->stop, true);
+}
 
-    fseek(fp, 0, SEEK_SET);
-    u8 *buf = malloc(size);
-    fread(buf, size, 1, fp);
+bool ps1_system_stop_requested() {
+    return atomic_load_explicit(&current_instance->stop, memory_order_relaxed);
+}
 
-    PS1SYS.mem.bios = buf;
-    PS1SYS.mem.bios_size = size;
+void ps1_system_tty_putchar(u8 c) {
+    if (PS1SYS.speculative) {
+        // Rolled back, it will be printed again when the frame runs for real
+    } else if (PS1SYS.tty_handler != NULL) {
+        PS1SYS.tty_handler(c);
+    } else {
+        log_enqueue("%c", c); // Through the log queue so it stays in order with log messages
+    }
+}
 
-    logalways("Loaded the BIOS, it's %ld bytes.", PS1SYS.mem.bios_size);
+void ps1_system_set_vblank_handler(void (*handler)()) {
+    PS1SYS.vblank_handler = handler;
+}
+
+void ps1_system_set_bios(bios_image_t* image) {
+    bios_release(PS1SYS.mem.bios_image);
+    PS1SYS.mem.bios_image = image;
+    PS1SYS.mem.bios = image->data;
+    PS1SYS.mem.bios_size = image->size;
 }
 
 void ps1_system_init() {
+    ps1_system_init_with_bios("SCPH1001.BIN");
+}
+
+// RAM takes up the first huge page of the guest memory, VRAM starts the next one
+#define GUEST_MEMORY_VRAM_OFFSET PS1_RAM_SIZE
+#define GUEST_MEMORY_SIZE (GUEST_MEMORY_VRAM_OFFSET + VRAM_SIZE)
+
+void ps1_system_reset() {
+    guest_memory_t* memory = &current_instance->memory;
+    if (memory->base == NULL) {
+        guest_memory_alloc(memory, GUEST_MEMORY_SIZE);
+    } else {
+        guest_memory_clear(memory);
+    }
+    // The drive comes up empty and there's no BIOS until one is set
+    bios_release(PS1SYS.mem.bios_image);
+    exe_free(PS1SYS.pending_exe);
+    disc_close(PS1SYS.disc);
     memset(&PS1SYS, 0x00, sizeof(PS1SYS));
-    load_bios("SCPH1001.BIN");
+    memset(&PS1CPU, 0x00, sizeof(PS1CPU));
+    PS1SYS.mem.ram = memory->base;
+    PS1GPU.vram = (u16*)(memory->base + GUEST_MEMORY_VRAM_OFFSET);
+    PS1SYS.video_enabled = true;
+    cdrom_reset();
+    dirty_reset(0);
+}
+
+void ps1_system_init_with_bios(const char* bios_path) {
+    bool hle = strcmp(bios_path, HLE_BIOS_NAME) == 0;
+    // Opened before the old one is released, so re-initializing with the same BIOS keeps the mapping
+    bios_image_t* bios = hle ? bios_blank(0x80000) : bios_open(bios_path);
+    ps1_system_reset();
+    log_set_cycle_counter(&PS1SYS.cycles);
+    ps1_system_set_bios(bios);
     cpu_set_pc(0xBFC00000);
 
     PS1SYS.dma.dpcr = 0x07654321;
 
-//#ifdef PSX_FORCE_TTY /* Patch BIOS to enable TTY output */
-    ((uint32_t *)PS1SYS.mem.bios)[0x1bc3] = 0x24010001; /* ADDIU $at, $zero, 0x1 */
-    ((uint32_t *)PS1SYS.mem.bios)[0x1bc5] = 0xaf81a9c0; /* SW $at, -0x5640($gp) */
-//#endif
+#ifdef PS1_PROFILE
+    profiler_init();
+#endif
+#ifdef PS1_BUS_STATS
+    bus_stats_init();
+#endif
+
+    // Equivalent to GP1(08h) = 0
+    PS1GPU.display_width = 256;
+    PS1GPU.display_height = 240;
+
+    if (hle) {
+        PS1SYS.hle_bios = true;
+        hle_init();
+    }
 }
 
+static const char* crash_dump_path = "ps1_crash.state";
+
 void ps1_create_crash_dump() {
     unsigned int old_verbosity = log_get_verbosity();
 
@@ -47,13 +156,158 @@ void ps1_create_crash_dump() {
     for (int i = 0; i < 32; i++) {
         logdebug("r%-2d $%-4s: 0x%08X", i, register_names[i], PS1CPU.gpr[i]);
     }
-    printf("TODO: dump ram to disk\n");
+    if (state_write_mapped(crash_dump_path)) {
+        logdebug("Machine state written to %s, inspect it with ps1_state_info", crash_dump_path);
+    } else {
+        logdebug("Unable to write the machine state to %s", crash_dump_path);
+    }
 
    log_set_verbosity(old_verbosity);
 }
 
-_Noreturn void ps1_system_loop() {
-    while (1) {
-        cpu_step();
+static void crash_signal_handler(int sig) {
+    // Only async-signal-safe calls in here, no logging
+    static const char message[] = "Fatal signal, writing machine state\n";
+    write(STDERR_FILENO, message, sizeof(message) - 1);
+    state_write_mapped(crash_dump_path);
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+
+void ps1_enable_crash_dumps(const char* path) {
+    if (path != NULL) {
+        crash_dump_path = path;
+    }
+    log_set_fatal_handler(ps1_create_crash_dump);
+    signal(SIGSEGV, crash_signal_handler);
+    signal(SIGBUS, crash_signal_handler);
+    signal(SIGILL, crash_signal_handler);
+    signal(SIGFPE, crash_signal_handler);
+}
+
+void ps1_system_load_exe(const char* path, bool direct) {
+    ps1_exe_t* exe = exe_load(path);
+    if (exe == NULL) {
+        logfatal("Unable to load %s", path);
+    }
+    exe_free(PS1SYS.pending_exe);
+    PS1SYS.pending_exe = NULL;
+    // The HLE BIOS has no shell to wait for
+    if (direct || PS1SYS.hle_bios || PS1CPU.pc == EXE_SHELL_ENTRY) {
+        exe_boot(exe);
+        exe_free(exe);
+    } else {
+        PS1SYS.pending_exe = exe;
+    }
+}
+
+void ps1_system_insert_disc(const char* path) {
+    disc_t* disc = disc_open(path);
+    if (disc == NULL) {
+        logfatal("Unable to load the disc %s", path);
+    }
+    disc_close(PS1SYS.disc);
+    PS1SYS.disc = disc;
+}
+
+static void boot_pending_exe() {
+    exe_boot(PS1SYS.pending_exe);
+    exe_free(PS1SYS.pending_exe);
+    PS1SYS.pending_exe = NULL;
+}
+
+void ps1_system_load_state(const char* path) {
+    if (!state_load(path)) {
+        logfatal("Unable to load machine state from %s", path);
+    }
+    logalways("Resumed from %s at PC 0x%08X, cycle %" PRIu64, path, PS1CPU.pc, PS1SYS.cycles);
+}
+
+void ps1_system_save_state(const char* path) {
+    if (!state_save(path)) {
+        logfatal("Unable to save machine state to %s", path);
+    }
+}
+
+void ps1_system_load_delta(const char* path) {
+    if (!delta_load(path)) {
+        logfatal("Unable to apply delta snapshot %s", path);
+    }
+}
+
+void ps1_system_save_delta(const char* path) {
+    if (!delta_save(path)) {
+        logfatal("Unable to save delta snapshot to %s", path);
+    }
+}
+
+void ps1_system_vblank() {
+    u64 start = timing_now_ns();
+    gpu_vblank(PS1SYS.video_enabled);
+    if (PS1SYS.hle_bios) {
+        hle_vblank();
+    }
+    if (PS1SYS.vblank_handler != NULL && PS1SYS.video_enabled) {
+        PS1SYS.vblank_handler();
+    }
+#ifdef PS1_PROFILE
+    profiler_check_signal();
+#endif
+    if (unlikely(rewind_enabled) && !PS1SYS.speculative) {
+        rewind_capture();
+    }
+    if (PS1SYS.speculative) {
+        PS1SYS.stats.speculative_frames++;
+        PS1SYS.stats.speculative_vblank_ns += timing_now_ns() - start;
+    } else {
+        PS1SYS.stats.frames++;
+        PS1SYS.stats.vblank_ns += timing_now_ns() - start;
+    }
+}
+
+void ps1_system_step() {
+    // Not while speculating, rolling back would lose the EXE
+    if (unlikely(PS1SYS.pending_exe != NULL) && PS1CPU.pc == EXE_SHELL_ENTRY && !PS1SYS.speculative) {
+        boot_pending_exe();
+    }
+    if (unlikely(PS1SYS.hle_bios)) {
+        hle_check_pc();
+    }
+    cpu_step();
+    PS1SYS.cycles += CYCLES_PER_INSTR;
+    if (unlikely(PS1SYS.cycles >= sampler_next_cycle)) {
+        sampler_sample();
+    }
+    if (unlikely(PS1SYS.cycles >= PS1SYS.cdrom.next_event_cycle)) {
+        cdrom_event();
+    }
+    PS1SYS.frame_cycles += CYCLES_PER_INSTR;
+    if (unlikely(PS1SYS.frame_cycles >= CPU_CYCLES_PER_FRAME)) {
+        PS1SYS.frame_cycles -= CPU_CYCLES_PER_FRAME;
+        ps1_system_vblank();
+    }
+}
+
+void ps1_system_run_frame() {
+    u64 frame = PS1SYS.stats.frames + PS1SYS.stats.speculative_frames;
+    while (PS1SYS.stats.frames + PS1SYS.stats.speculative_frames == frame) {
+        ps1_system_step();
+    }
+}
+
+void ps1_system_run_cycles(u64 cycles) {
+    u64 target = PS1SYS.cycles + cycles;
+    // A frame at a time, so a stop request is seen without checking for one every instruction
+    while (PS1SYS.cycles < target && !ps1_system_stop_requested()) {
+        u64 chunk_end = PS1SYS.cycles + CPU_CYCLES_PER_FRAME < target ? PS1SYS.cycles + CPU_CYCLES_PER_FRAME : target;
+        while (PS1SYS.cycles < chunk_end) {
+            ps1_system_step();
+        }
+    }
+}
+
+void ps1_system_loop() {
+    while (!ps1_system_stop_requested()) {
+        ps1_system_run_frame();
     }
 }
@@ -3,33 +3,136 @@
 
 #include <util.h>
 #include <stdlib.h>
+#include <stdatomic.h>
 #include <gpu/gpu.h>
 #include <mem/dma.h>
+#include <mem/dirty.h>
+#include <mem/bios.h>
+#include <mem/footprint.h>
+#include <mem/exe.h>
+#include <cdrom/cdrom.h>
+#include <cdrom/disc.h>
+#include <cpu/cpu.h>
+
+// NTSC, 33.8688MHz / 60Hz
+#define CPU_CYCLES_PER_FRAME (33868800 / 60)
+#define CYCLES_PER_INSTR 2
+
+#define PS1_RAM_SIZE 0x200000
 
 void ps1_system_init();
+void ps1_system_init_with_bios(const char* bios_path);
+// Clears the current instance to its power-on state without loading a BIOS, allocating its guest memory on first use.
+// The BIOS, the disc and any EXE waiting to boot are released.
+void ps1_system_reset();
+// Replaces the current instance's BIOS, taking over the reference to `image`
+void ps1_system_set_bios(bios_image_t* image);
 void ps1_create_crash_dump();
+// Writes the machine state to `path` (or ps1_crash.state when NULL) on a fatal error or crash signal
+void ps1_enable_crash_dumps(const char* path);
+/*
+ * Side-loads a PS-X EXE. With `direct` it starts right away, without any BIOS code having run. Otherwise the BIOS boots
+ * as usual until it's about to start the shell, and the EXE starts there instead of the boot animation.
+ */
+void ps1_system_load_exe(const char* path, bool direct);
+// Puts a disc image (.cue or .bin) in the drive, replacing any disc already there
+void ps1_system_insert_disc(const char* path);
+// Resumes from a save state or crash dump
+void ps1_system_load_state(const char* path);
+void ps1_system_save_state(const char* path);
+// Delta snapshots, relative to the previous full or delta snapshot
+void ps1_system_load_delta(const char* path);
+void ps1_system_save_delta(const char* path);
+void ps1_system_step();
+void ps1_system_run_frame();
+void ps1_system_run_cycles(u64 cycles);
+void ps1_system_set_vblank_handler(void (*handler)());
+// TTY output from the guest, to the tty_handler or the log
+void ps1_system_tty_putchar(u8 c);
 
-_Noreturn void ps1_system_loop();
+// Runs one frame, then `frames_ahead` more whose output is presented before rolling them back, see runahead.c
+void ps1_system_run_frame_ahead(int frames_ahead);
+
+// Runs until ps1_instance_request_stop() is called for the current instance
+void ps1_system_loop();
+// Whether ps1_instance_request_stop() was called for the current instance
+bool ps1_system_stop_requested();
 
 typedef struct ps1_mem {
-    u8* bios;
+    // Shared and read-only, see bios.h
+    const u8* bios;
     size_t bios_size;
+    bios_image_t* bios_image;
 
-    u8 ram[0x200000];
+    // PS1_RAM_SIZE bytes, part of the instance's guest memory
+    u8* ram;
 } ps1_mem_t;
 
+// Host side counters, not part of the emulated machine
+typedef struct ps1_system_stats {
+    u64 frames;
+    u64 vblank_ns; // Scanout and frontend handoff
+    // Run-ahead frames that were rolled back, kept out of the counts above
+    u64 speculative_frames;
+    u64 speculative_vblank_ns;
+} ps1_system_stats_t;
+
 typedef struct ps1_system {
     ps1_mem_t mem;
 
+    u64 cycles;
+    u32 frame_cycles;
+
     u16 i_mask;
     u16 i_stat;
     ps1_gpu_t gpu;
     dma_state_t dma;
+    cdrom_state_t cdrom;
+
+    // Host side, not part of the emulated machine
+    ps1_system_stats_t stats;
+    void (*vblank_handler)();
+    // Booted once the BIOS reaches EXE_SHELL_ENTRY, see ps1_system_load_exe()
+    ps1_exe_t* pending_exe;
+    // Receives TTY output instead of the log when set
+    void (*tty_handler)(u8 c);
+    // Set while running frames that will be rolled back: no TTY output, rewind captures or presentation
+    bool speculative;
+    // Cleared to skip scanout and the vblank handler for frames nobody will see
+    bool video_enabled;
+    // Kernel calls are handled by hle.c, see ps1_system_init_with_bios()
+    bool hle_bios;
+    // The disc in the drive, NULL when it's empty
+    disc_t* disc;
 } ps1_system_t;
 
-extern struct ps1_system ps1_system;
-#define PS1SYS ps1_system
+/*
+ * Everything one emulated PS1 needs. Any number can exist, each thread works on the instance it selected last and
+ * PS1SYS/PS1CPU refer to it. Threads that never select one use the default instance, which is what the single
+ * instance frontend runs on. The debugging features (trace, profilers, rewind, run-ahead) are process wide and
+ * follow whichever instance is current on the thread using them.
+ */
+typedef struct ps1_instance {
+    ps1_system_t system;
+    r3000a_t cpu;
+    dirty_pages_t dirty;
+    // RAM and VRAM, kept apart from the rest so they can go on huge pages, see footprint.h
+    guest_memory_t memory;
+    // Set from any thread to make the thread running the instance return, see ps1_system_loop()
+    atomic_bool stop;
+} ps1_instance_t;
+
+extern _Thread_local ps1_system_t* ps1_system;
+#define PS1SYS (*ps1_system)
+
+#define PS1GPU PS1SYS.gpu
 
-#define PS1GPU ps1_system.gpu
+ps1_instance_t* ps1_instance_create();
+void ps1_instance_destroy(ps1_instance_t* instance);
+// Makes `instance` the one PS1SYS/PS1CPU and the log's cycle counter refer to on the calling thread
+void ps1_instance_select(ps1_instance_t* instance);
+ps1_instance_t* ps1_instance_current();
+// Makes ps1_system_loop() and ps1_system_run_cycles() return at the end of the current frame, from any thread
+void ps1_instance_request_stop(ps1_instance_t* instance);
 
 #endif //PS1_PS1SYSTEM_H
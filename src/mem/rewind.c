@@ -0,0 +1,207 @@
+#include "rewind.h"
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <log.h>
+#include <lz.h>
+#include <timing.h>
+#include <mem/state.h>
+#include <mem/dirty.h>
+
+#define REWIND_PAGE_SIZE STATE_ALIGNMENT
+
+typedef struct rewind_entry {
+    size_t offset; // In the ring
+    size_t size;
+} rewind_entry_t;
+
+bool rewind_enabled = false;
+
+static u8* current = NULL;  // Image of the newest captured frame
+static u8* delta = NULL;    // Changed pages, XORed with their previous contents and packed together
+static u8* compressed = NULL;
+static size_t image_size = 0;
+static size_t num_pages = 0;
+static size_t bitmap_size = 0;
+
+static u8* ring = NULL;
+static size_t ring_size = 0;
+static size_t ring_head = 0;
+static rewind_entry_t entries[REWIND_MAX_ENTRIES];
+static u32 first_entry = 0;
+static u32 num_entries = 0;
+
+static rewind_stats_t stats;
+
+void rewind_init(size_t budget_bytes) {
+    image_size = state_image_size();
+    num_pages = image_size / REWIND_PAGE_SIZE;
+    bitmap_size = (num_pages + 7) / 8;
+    current = calloc(1, image_size);
+    delta = malloc(image_size);
+    compressed = malloc(bitmap_size + LZ_COMPRESS_BOUND(image_size));
+    ring_size = budget_bytes;
+    ring = malloc(ring_size);
+    if (current == NULL || delta == NULL || compressed == NULL || ring == NULL) {
+        logfatal("Unable to allocate %zu bytes for rewind", ring_size + 3 * image_size);
+    }
+    state_image_capture(current);
+    rewind_enabled = true;
+}
+
+INLINE rewind_entry_t* entry_at(u32 i) {
+    return &entries[(first_entry + i) % REWIND_MAX_ENTRIES];
+}
+
+INLINE bool ranges_overlap(size_t a, size_t a_size, size_t b, size_t b_size) {
+    return a < b + b_size && b < a + a_size;
+}
+
+static void drop_oldest() {
+    first_entry = (first_entry + 1) % REWIND_MAX_ENTRIES;
+    num_entries--;
+}
+
+static void store_entry(const u8* data, size_t size) {
+    if (size > ring_size) {
+        logwarn("Rewind frame of %zu bytes doesn't fit in the %zu byte budget, dropping history", size, ring_size);
+        num_entries = 0;
+        return;
+    }
+    if (ring_head + size > ring_size) {
+        ring_head = 0;
+    }
+    // Entries are laid out in order, so the ones a new entry overwrites are always the oldest
+    while (num_entries > 0 && ranges_overlap(ring_head, size, entry_at(0)->offset, entry_at(0)->size)) {
+        drop_oldest();
+    }
+    if (num_entries == REWIND_MAX_ENTRIES) {
+        drop_oldest();
+    }
+    memcpy(ring + ring_head, data, size);
+    *entry_at(num_entries) = (rewind_entry_t) { ring_head, size };
+    num_entries++;
+    ring_head += size;
+}
+
+INLINE void xor_page(u8* dst, const u8* a, const u8* b, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        dst[i] = a[i] ^ b[i];
+    }
+}
+
+void rewind_capture() {
+    u64 start = timing_now_ns();
+    u8* bitmap = compressed;
+    memset(bitmap, 0x00, bitmap_size);
+
+    // Compare the live machine with the previous image page by page, keeping only what changed
+    state_section_t sections[STATE_MAX_SECTIONS];
+    int num_sections = state_image_sections(sections);
+    size_t packed = 0;
+    size_t page = 0;
+    u8* image = current;
+    for (int i = 0; i < num_sections; i++) {
+        const u8* live = sections[i].data;
+        for (size_t offset = 0; offset < sections[i].size; offset += REWIND_PAGE_SIZE, page++) {
+            size_t len = sections[i].size - offset < REWIND_PAGE_SIZE ? sections[i].size - offset : REWIND_PAGE_SIZE;
+            u8* previous = image + offset;
+            if (memcmp(live + offset, previous, len) != 0) {
+                u8* out = delta + packed;
+                xor_page(out, live + offset, previous, len);
+                memset(out + len, 0x00, REWIND_PAGE_SIZE - len);
+                memcpy(previous, live + offset, len);
+                bitmap[page >> 3] |= 1 << (page & 7);
+                packed += REWIND_PAGE_SIZE;
+            }
+        }
+        image += (sections[i].size + REWIND_PAGE_SIZE - 1) & ~(size_t)(REWIND_PAGE_SIZE - 1);
+    }
+
+    size_t size = bitmap_size + lz_compress(delta, packed, compressed + bitmap_size);
+    store_entry(compressed, size);
+
+    stats.captures++;
+    stats.changed_pages += packed / REWIND_PAGE_SIZE;
+    stats.compressed_bytes += size;
+    stats.capture_ns += timing_now_ns() - start;
+}
+
+/*
+ * Restoring rewrites RAM and VRAM behind the dirty page tracking, so the pages the entry changed are marked like any
+ * other write. The next delta snapshot then includes them, whichever side of its base the frame we went back to is on.
+ */
+static void mark_restored_pages(const u8* bitmap) {
+    state_section_t sections[STATE_MAX_SECTIONS];
+    int num_sections = state_image_sections(sections);
+    size_t page = 0;
+    for (int i = 0; i < num_sections; i++) {
+        size_t section_pages = (sections[i].size + REWIND_PAGE_SIZE - 1) / REWIND_PAGE_SIZE;
+        for (size_t p = 0; p < section_pages; p++, page++) {
+            if (!(bitmap[page >> 3] & (1 << (page & 7)))) {
+                continue;
+            }
+            u32 offset = p * REWIND_PAGE_SIZE;
+            if (sections[i].id == STATE_SECTION_RAM) {
+                dirty_mark_ram_range(offset, REWIND_PAGE_SIZE);
+            } else if (sections[i].id == STATE_SECTION_VRAM) {
+                for (u32 byte = 0; byte < REWIND_PAGE_SIZE; byte += DIRTY_PAGE_SIZE) {
+                    dirty_mark_vram((offset + byte) / 2);
+                }
+            }
+        }
+    }
+}
+
+bool rewind_step_back() {
+    if (num_entries == 0) {
+        return false;
+    }
+    rewind_entry_t* entry = entry_at(num_entries - 1);
+    const u8* bitmap = ring + entry->offset;
+    size_t packed = lz_decompress(bitmap + bitmap_size, entry->size - bitmap_size, delta, image_size);
+
+    // XOR is its own inverse, applying the delta again turns the newest image back into the one before it
+    size_t next = 0;
+    for (size_t page = 0; page < num_pages; page++) {
+        if (bitmap[page >> 3] & (1 << (page & 7))) {
+            if (next + REWIND_PAGE_SIZE > packed) {
+                logfatal("Corrupt rewind entry");
+            }
+            u8* image = current + page * REWIND_PAGE_SIZE;
+            xor_page(image, image, delta + next, REWIND_PAGE_SIZE);
+            next += REWIND_PAGE_SIZE;
+        }
+    }
+    state_image_restore(current);
+    mark_restored_pages(bitmap);
+
+    ring_head = entry->offset;
+    num_entries--;
+    return true;
+}
+
+u32 rewind_frames_available() {
+    return num_entries;
+}
+
+size_t rewind_bytes_used() {
+    size_t size = 0;
+    for (u32 i = 0; i < num_entries; i++) {
+        size += entry_at(i)->size;
+    }
+    return size;
+}
+
+void rewind_print_stats() {
+    if (stats.captures == 0) {
+        return;
+    }
+    logalways("======== REWIND ========");
+    logalways("Frames held:      %u, %.2f MiB of %.2f MiB", num_entries, rewind_bytes_used() / 1048576.0, ring_size / 1048576.0);
+    logalways("Captures:         %" PRIu64 ", %.3f ms each", stats.captures, stats.capture_ns / 1e6 / stats.captures);
+    logalways("Changed pages:    %.1f per frame of %zu", (double)stats.changed_pages / stats.captures, num_pages);
+    logalways("Compressed size:  %.1f KiB per frame", stats.compressed_bytes / 1024.0 / stats.captures);
+}
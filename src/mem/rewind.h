@@ -0,0 +1,36 @@
+#ifndef PS1_REWIND_H
+#define PS1_REWIND_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <util.h>
+
+/*
+ * Rewind: a state image is captured at every vblank and stored as the pages that changed since the previous frame,
+ * XORed with their previous contents and LZ compressed, in a ring with a fixed memory budget. The newest full image
+ * is kept uncompressed, stepping back XORs the newest entry into it. The oldest frames are dropped when the budget
+ * runs out.
+ */
+
+#define REWIND_DEFAULT_BUDGET_MB 64
+// Upper bound on the frames held regardless of budget, 5 minutes at 60Hz
+#define REWIND_MAX_ENTRIES (60 * 60 * 5)
+
+typedef struct rewind_stats {
+    u64 captures;
+    u64 capture_ns;
+    u64 compressed_bytes;
+    u64 changed_pages;
+} rewind_stats_t;
+
+extern bool rewind_enabled;
+
+void rewind_init(size_t budget_bytes);
+void rewind_capture();
+// Restores the previous frame, returns false when there's nothing left to rewind to
+bool rewind_step_back();
+u32 rewind_frames_available();
+size_t rewind_bytes_used();
+void rewind_print_stats();
+
+#endif //PS1_REWIND_H
@@ -0,0 +1,143 @@
+#include "runahead.h"
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <log.h>
+#include <timing.h>
+#include <mem/ps1system.h>
+#include <mem/state.h>
+#include <mem/dirty.h>
+
+/*
+ * Run-ahead: each displayed frame is emulated once for real without being shown, then the state is saved, the next
+ * frames are emulated with the current input and the last of them is presented, and the state is rolled back.
+ *
+ * The saved state is an in-memory image that is kept in sync instead of recaptured: the dirty page bitmaps say which
+ * RAM and VRAM pages the real frame touched, only those get copied into the image, and only the pages touched by the
+ * speculative frames get copied back. The small register sections are always copied in full.
+ */
+
+runahead_stats_t runahead_stats;
+
+static u8* image = NULL;
+static u8* image_ram = NULL;
+static u8* image_vram = NULL;
+// Cycle count the image was last synced at, anything else means the machine was changed behind our back
+static u64 image_cycles = UINT64_MAX;
+
+static void runahead_init() {
+    image = calloc(1, state_image_size());
+    if (image == NULL) {
+        logfatal("Unable to allocate %zu bytes for run-ahead", state_image_size());
+    }
+    state_section_t sections[STATE_MAX_SECTIONS];
+    int num_sections = state_image_sections(sections);
+    u8* p = image;
+    for (int i = 0; i < num_sections; i++) {
+        if (sections[i].id == STATE_SECTION_RAM) {
+            image_ram = p;
+        } else if (sections[i].id == STATE_SECTION_VRAM) {
+            image_vram = p;
+        }
+        p += (sections[i].size + STATE_ALIGNMENT - 1) & ~(size_t)(STATE_ALIGNMENT - 1);
+    }
+}
+
+static u64 copy_pages(const u64* bitmap, u32 num_pages, u8* dst, const u8* src) {
+    u64 copied = 0;
+    for (u32 word = 0; word < num_pages / 64; word++) {
+        u64 bits = bitmap[word];
+        while (bits) {
+            size_t offset = (size_t)(word * 64 + __builtin_ctzll(bits)) << DIRTY_PAGE_SHIFT;
+            bits &= bits - 1;
+            memcpy(dst + offset, src + offset, DIRTY_PAGE_SIZE);
+            copied++;
+        }
+    }
+    return copied;
+}
+
+// Copies the register sections between the image and the live machine
+static void copy_registers(bool to_image) {
+    state_section_t sections[STATE_MAX_SECTIONS];
+    int num_sections = state_image_sections(sections);
+    u8* p = image;
+    for (int i = 0; i < num_sections; i++) {
+        if (sections[i].id != STATE_SECTION_RAM && sections[i].id != STATE_SECTION_VRAM) {
+            if (to_image) {
+                memcpy(p, sections[i].data, sections[i].size);
+            } else {
+                memcpy(sections[i].data, p, sections[i].size);
+            }
+        }
+        p += (sections[i].size + STATE_ALIGNMENT - 1) & ~(size_t)(STATE_ALIGNMENT - 1);
+    }
+}
+
+void ps1_system_run_frame_ahead(int frames_ahead) {
+    if (frames_ahead <= 0) {
+        ps1_system_run_frame();
+        return;
+    }
+    if (image == NULL) {
+        runahead_init();
+    }
+
+    // Track the pages touched by each phase separately, then put back what delta snapshots expect to see
+    dirty_pages_t saved = dirty_pages;
+    dirty_reset(saved.base_cycles);
+    bool image_valid = image_cycles == PS1SYS.cycles;
+
+    PS1SYS.video_enabled = false;
+    ps1_system_run_frame();
+    dirty_pages_t real = dirty_pages;
+
+    u64 start = timing_now_ns();
+    if (image_valid) {
+        runahead_stats.sync_pages += copy_pages(real.ram, DIRTY_RAM_PAGES, image_ram, PS1SYS.mem.ram);
+        runahead_stats.sync_pages += copy_pages(real.vram, DIRTY_VRAM_PAGES, image_vram, (u8*)PS1GPU.vram);
+        copy_registers(true);
+    } else {
+        state_image_capture(image);
+    }
+    image_cycles = PS1SYS.cycles;
+    dirty_reset(saved.base_cycles);
+    runahead_stats.save_restore_ns += timing_now_ns() - start;
+
+    PS1SYS.speculative = true;
+    for (int i = 0; i < frames_ahead; i++) {
+        PS1SYS.video_enabled = i == frames_ahead - 1;
+        ps1_system_run_frame();
+    }
+    PS1SYS.speculative = false;
+    PS1SYS.video_enabled = true;
+
+    start = timing_now_ns();
+    runahead_stats.restore_pages += copy_pages(dirty_pages.ram, DIRTY_RAM_PAGES, PS1SYS.mem.ram, image_ram);
+    runahead_stats.restore_pages += copy_pages(dirty_pages.vram, DIRTY_VRAM_PAGES, (u8*)PS1GPU.vram, image_vram);
+    copy_registers(false);
+    runahead_stats.save_restore_ns += timing_now_ns() - start;
+
+    for (int i = 0; i < DIRTY_RAM_PAGES / 64; i++) {
+        dirty_pages.ram[i] = saved.ram[i] | real.ram[i];
+    }
+    for (int i = 0; i < DIRTY_VRAM_PAGES / 64; i++) {
+        dirty_pages.vram[i] = saved.vram[i] | real.vram[i];
+    }
+    runahead_stats.frames++;
+    runahead_stats.speculative_frames += frames_ahead;
+}
+
+void runahead_print_stats() {
+    if (runahead_stats.frames == 0) {
+        return;
+    }
+    double frames = runahead_stats.frames;
+    logalways("======== RUN-AHEAD ========");
+    logalways("Frames:           %" PRIu64 " real, %" PRIu64 " speculative", runahead_stats.frames, runahead_stats.speculative_frames);
+    logalways("Pages synced:     %.1f per frame", runahead_stats.sync_pages / frames);
+    logalways("Pages rolled back:%.1f per frame", runahead_stats.restore_pages / frames);
+    logalways("Save + restore:   %.3f ms per frame", runahead_stats.save_restore_ns / 1e6 / frames);
+}
@@ -0,0 +1,18 @@
+#ifndef PS1_RUNAHEAD_H
+#define PS1_RUNAHEAD_H
+
+#include <util.h>
+
+typedef struct runahead_stats {
+    u64 frames;
+    u64 speculative_frames;
+    u64 sync_pages;    // Pages copied into the saved image after real frames
+    u64 restore_pages; // Pages rolled back after speculative frames
+    u64 save_restore_ns;
+} runahead_stats_t;
+
+extern runahead_stats_t runahead_stats;
+
+void runahead_print_stats();
+
+#endif //PS1_RUNAHEAD_H
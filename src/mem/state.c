@@ -0,0 +1,369 @@
+#include "state.h"
+
+#include <fcntl.h>
+#include <inttypes.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <log.h>
+#include <cpu/cpu.h>
+#include <mem/ps1system.h>
+#include <mem/dirty.h>
+
+#define ALIGN_UP(x, a) (((x) + (a) - 1) & ~((u64)(a) - 1))
+
+int state_sections(state_section_t* sections) {
+    int n = 0;
+    sections[n++] = (state_section_t) { STATE_SECTION_CPU, &PS1CPU, sizeof(PS1CPU) };
+    // Everything from the cycle counter up to the GPU, the RAM and BIOS pointer before it are saved separately
+    sections[n++] = (state_section_t) { STATE_SECTION_SYSTEM, &PS1SYS.cycles, offsetof(ps1_system_t, gpu) - offsetof(ps1_system_t, cycles) };
+    sections[n++] = (state_section_t) { STATE_SECTION_DMA, &PS1SYS.dma, sizeof(PS1SYS.dma) };
+    sections[n++] = (state_section_t) { STATE_SECTION_CDROM, &PS1SYS.cdrom, sizeof(PS1SYS.cdrom) };
+    // The GPU registers come before the host scanout pointer and VRAM
+    sections[n++] = (state_section_t) { STATE_SECTION_GPU, &PS1GPU, offsetof(ps1_gpu_t, scanout_buffer) };
+    sections[n++] = (state_section_t) { STATE_SECTION_RAM, PS1SYS.mem.ram, PS1_RAM_SIZE };
+    sections[n++] = (state_section_t) { STATE_SECTION_VRAM, PS1GPU.vram, VRAM_SIZE };
+    if (PS1SYS.mem.bios != NULL) {
+        // Only ever read through here, state_load() replaces the BIOS instead of writing to it
+        sections[n++] = (state_section_t) { STATE_SECTION_BIOS, (void*)PS1SYS.mem.bios, PS1SYS.mem.bios_size };
+    }
+    return n;
+}
+
+const char* state_section_name(u32 id) {
+    switch (id) {
+        case STATE_SECTION_CPU:    return "CPU";
+        case STATE_SECTION_SYSTEM: return "SYSTEM";
+        case STATE_SECTION_DMA:    return "DMA";
+        case STATE_SECTION_GPU:    return "GPU";
+        case STATE_SECTION_RAM:    return "RAM";
+        case STATE_SECTION_VRAM:   return "VRAM";
+        case STATE_SECTION_BIOS:   return "BIOS";
+        case STATE_SECTION_CDROM:  return "CDROM";
+        default:                   return "UNKNOWN";
+    }
+}
+
+// Sections that make up an in-memory image, the BIOS never changes so it's left out
+int state_image_sections(state_section_t* sections) {
+    state_section_t live[STATE_MAX_SECTIONS];
+    int num_live = state_sections(live);
+    int n = 0;
+    for (int i = 0; i < num_live; i++) {
+        if (live[i].id != STATE_SECTION_BIOS) {
+            sections[n++] = live[i];
+        }
+    }
+    return n;
+}
+
+size_t state_image_size() {
+    state_section_t sections[STATE_MAX_SECTIONS];
+    int num_sections = state_image_sections(sections);
+    size_t size = 0;
+    for (int i = 0; i < num_sections; i++) {
+        size += ALIGN_UP(sections[i].size, STATE_ALIGNMENT);
+    }
+    return size;
+}
+
+void state_image_capture(u8* image) {
+    state_section_t sections[STATE_MAX_SECTIONS];
+    int num_sections = state_image_sections(sections);
+    for (int i = 0; i < num_sections; i++) {
+        memcpy(image, sections[i].data, sections[i].size);
+        image += ALIGN_UP(sections[i].size, STATE_ALIGNMENT);
+    }
+}
+
+void state_image_restore(const u8* image) {
+    state_section_t sections[STATE_MAX_SECTIONS];
+    int num_sections = state_image_sections(sections);
+    for (int i = 0; i < num_sections; i++) {
+        memcpy(sections[i].data, image, sections[i].size);
+        image += ALIGN_UP(sections[i].size, STATE_ALIGNMENT);
+    }
+}
+
+u64 state_hash() {
+    state_section_t sections[STATE_MAX_SECTIONS];
+    int num_sections = state_image_sections(sections);
+    u64 hash = 0xCBF29CE484222325ull;
+    for (int i = 0; i < num_sections; i++) {
+        const u8* data = sections[i].data;
+        size_t size = sections[i].size;
+        // A word at a time, the sections are large
+        for (; size >= 8; size -= 8, data += 8) {
+            u64 word;
+            memcpy(&word, data, sizeof(word));
+            hash = (hash ^ word) * 0x100000001B3ull;
+        }
+        for (; size > 0; size--, data++) {
+            hash = (hash ^ *data) * 0x100000001B3ull;
+        }
+    }
+    return hash;
+}
+
+// Fills in the header for the given sections and returns the total file size
+static u64 state_layout(state_file_header_t* header, const state_section_t* sections, int num_sections) {
+    memcpy(header->magic, STATE_MAGIC, sizeof(header->magic));
+    header->version = STATE_VERSION;
+    header->num_sections = num_sections;
+    header->cycles = PS1SYS.cycles;
+    header->pc = PS1CPU.pc;
+
+    u64 offset = ALIGN_UP(sizeof(state_file_header_t), STATE_ALIGNMENT);
+    for (int i = 0; i < num_sections; i++) {
+        header->sections[i].id = sections[i].id;
+        header->sections[i].offset = offset;
+        header->sections[i].size = sections[i].size;
+        offset = ALIGN_UP(offset + sections[i].size, STATE_ALIGNMENT);
+    }
+    return offset;
+}
+
+bool state_write_mapped(const char* path) {
+    state_section_t sections[STATE_MAX_SECTIONS];
+    int num_sections = state_sections(sections);
+    state_file_header_t layout = {0};
+    u64 size = state_layout(&layout, sections, num_sections);
+
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        return false;
+    }
+    if (ftruncate(fd, size) != 0) {
+        close(fd);
+        return false;
+    }
+    u8* mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        return false;
+    }
+
+    memcpy(mapping, &layout, sizeof(layout));
+    for (int i = 0; i < num_sections; i++) {
+        memcpy(mapping + layout.sections[i].offset, sections[i].data, sections[i].size);
+    }
+
+    // The pages belong to the file now, they reach the disk even if the process dies right after this
+    munmap(mapping, size);
+    return true;
+}
+
+static const u8 state_padding[STATE_ALIGNMENT];
+
+// Drops the first `n` bytes of an iovec array after a short read or write, returns how many entries are left
+static int iov_advance(struct iovec** iov, int iovcnt, size_t n) {
+    while (iovcnt > 0 && n >= (*iov)->iov_len) {
+        n -= (*iov)->iov_len;
+        (*iov)++;
+        iovcnt--;
+    }
+    if (iovcnt > 0) {
+        (*iov)->iov_base = (u8*)(*iov)->iov_base + n;
+        (*iov)->iov_len -= n;
+    }
+    return iovcnt;
+}
+
+bool state_writev(int fd, struct iovec* iov, int iovcnt) {
+    // A single writev almost always takes everything, only loop for the rare short write
+    while (iovcnt > 0) {
+        ssize_t written = writev(fd, iov, iovcnt);
+        if (written <= 0) {
+            return false;
+        }
+        iovcnt = iov_advance(&iov, iovcnt, written);
+    }
+    return true;
+}
+
+bool state_preadv(int fd, struct iovec* iov, int iovcnt, u64 offset) {
+    while (iovcnt > 0) {
+        ssize_t n = preadv(fd, iov, iovcnt, offset);
+        if (n <= 0) {
+            return false;
+        }
+        offset += n;
+        iovcnt = iov_advance(&iov, iovcnt, n);
+    }
+    return true;
+}
+
+bool state_save(const char* path) {
+    state_section_t sections[STATE_MAX_SECTIONS];
+    int num_sections = state_sections(sections);
+    state_file_header_t header = {0};
+    u64 size = state_layout(&header, sections, num_sections);
+
+    // Header, sections and the zero padding between them in file order
+    struct iovec iov[2 * (STATE_MAX_SECTIONS + 1)];
+    int iovcnt = 0;
+    u64 offset = 0;
+    iov[iovcnt++] = (struct iovec) { &header, sizeof(header) };
+    offset += sizeof(header);
+    for (int i = 0; i < num_sections; i++) {
+        if (header.sections[i].offset > offset) {
+            iov[iovcnt++] = (struct iovec) { (void*)state_padding, header.sections[i].offset - offset };
+        }
+        iov[iovcnt++] = (struct iovec) { sections[i].data, sections[i].size };
+        offset = header.sections[i].offset + sections[i].size;
+    }
+    if (size > offset) {
+        iov[iovcnt++] = (struct iovec) { (void*)state_padding, size - offset };
+    }
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        logwarn("Unable to open %s for writing", path);
+        return false;
+    }
+    bool ok = state_writev(fd, iov, iovcnt);
+    close(fd);
+    if (!ok) {
+        logwarn("Unable to write save state to %s", path);
+        return false;
+    }
+    dirty_reset(PS1SYS.cycles);
+    return true;
+}
+
+static bool state_validate(const state_file_header_t* header, size_t size) {
+    if (size < sizeof(state_file_header_t) || memcmp(header->magic, STATE_MAGIC, sizeof(header->magic)) != 0) {
+        logwarn("Not a state file");
+        return false;
+    }
+    if (header->version != STATE_VERSION) {
+        logwarn("State file is version %u, this build reads version %d", header->version, STATE_VERSION);
+        return false;
+    }
+    if (header->num_sections > STATE_MAX_SECTIONS) {
+        logwarn("State file has %u sections, at most %d are supported", header->num_sections, STATE_MAX_SECTIONS);
+        return false;
+    }
+
+    state_section_t live[STATE_MAX_SECTIONS];
+    int num_live = state_sections(live);
+    for (int i = 0; i < header->num_sections; i++) {
+        const state_section_header_t* section = &header->sections[i];
+        if (section->offset + section->size > size) {
+            logwarn("State file section %s is truncated", state_section_name(section->id));
+            return false;
+        }
+        for (int j = 0; j < num_live; j++) {
+            if (live[j].id == section->id && live[j].size != section->size) {
+                logwarn("State file section %s is %" PRIu64 " bytes, expected %zu", state_section_name(section->id), section->size, live[j].size);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+static bool pread_all(int fd, void* data, size_t size, u64 offset) {
+    struct iovec iov = { data, size };
+    return state_preadv(fd, &iov, 1, offset);
+}
+
+// The BIOS is shared and read-only, it's only replaced (with a private copy) when the state has a different one
+static void state_load_bios(int fd, const state_section_header_t* section, const char* path) {
+    u8* bios = malloc(section->size);
+    if (!pread_all(fd, bios, section->size, section->offset)) {
+        logfatal("Read error loading BIOS from %s, the machine state is now inconsistent", path);
+    }
+    if (section->size != PS1SYS.mem.bios_size || memcmp(bios, PS1SYS.mem.bios, section->size) != 0) {
+        logwarn("%s was saved with a different BIOS, switching to it", path);
+        ps1_system_set_bios(bios_from_memory(bios, section->size));
+    }
+    free(bios);
+}
+
+bool state_load(const char* path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        logwarn("Unable to open state file %s", path);
+        return false;
+    }
+    struct stat st;
+    state_file_header_t header;
+    if (fstat(fd, &st) != 0 || !pread_all(fd, &header, sizeof(header), 0) || !state_validate(&header, st.st_size)) {
+        close(fd);
+        return false;
+    }
+
+    state_section_t live[STATE_MAX_SECTIONS];
+    int num_live = state_sections(live);
+    for (int i = 0; i < num_live; i++) {
+        const state_section_header_t* section = NULL;
+        for (int j = 0; j < header.num_sections; j++) {
+            if (header.sections[j].id == live[i].id) {
+                section = &header.sections[j];
+            }
+        }
+        if (section == NULL) {
+            logwarn("State file has no %s section, leaving it as is", state_section_name(live[i].id));
+            continue;
+        }
+        if (live[i].id == STATE_SECTION_BIOS) {
+            state_load_bios(fd, section, path);
+        } else if (!pread_all(fd, live[i].data, section->size, section->offset)) {
+            logfatal("Read error loading %s from %s, the machine state is now inconsistent", state_section_name(section->id), path);
+        }
+    }
+    close(fd);
+    dirty_reset(header.cycles);
+    return true;
+}
+
+bool state_map(const char* path, state_mapping_t* mapping) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        logwarn("Unable to open state file %s", path);
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return false;
+    }
+    void* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        logwarn("Unable to map state file %s", path);
+        return false;
+    }
+    if (!state_validate(data, st.st_size)) {
+        munmap(data, st.st_size);
+        return false;
+    }
+    mapping->header = data;
+    mapping->size = st.st_size;
+    return true;
+}
+
+void state_unmap(state_mapping_t* mapping) {
+    if (mapping->header != NULL) {
+        munmap((void*)mapping->header, mapping->size);
+        mapping->header = NULL;
+        mapping->size = 0;
+    }
+}
+
+const void* state_mapping_section(const state_mapping_t* mapping, state_section_id_t id, size_t* size) {
+    for (int i = 0; i < mapping->header->num_sections; i++) {
+        const state_section_header_t* section = &mapping->header->sections[i];
+        if (section->id == id) {
+            if (size != NULL) {
+                *size = section->size;
+            }
+            return (const u8*)mapping->header + section->offset;
+        }
+    }
+    return NULL;
+}
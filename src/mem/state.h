@@ -0,0 +1,94 @@
+#ifndef PS1_STATE_H
+#define PS1_STATE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <util.h>
+
+/*
+ * Machine state file: a header with a section table followed by the sections, each starting on a page boundary
+ * so a mapped file can be inspected in place. Sections point straight at the live emulator state, the writer copies
+ * them into a MAP_SHARED mapping of the output file so there's no buffering or write() per section, which keeps
+ * crash dumps cheap enough to take from a signal handler. Save states use the same layout but are written with a single
+ * writev straight from the live state and read back with one pread per section into it, without intermediate copies.
+ */
+
+#define STATE_MAGIC "PS1STATE"
+// Bump whenever the layout of any section changes, old files are rejected rather than misread
+#define STATE_VERSION 1
+#define STATE_ALIGNMENT 4096
+#define STATE_MAX_SECTIONS 16
+
+typedef enum state_section_id {
+    STATE_SECTION_CPU = 1,    // r3000a_t, GPRs, hi/lo, pc and CP0
+    STATE_SECTION_SYSTEM = 2, // cycle counters and interrupt controller
+    STATE_SECTION_DMA = 3,    // dma_state_t
+    STATE_SECTION_GPU = 4,    // ps1_gpu_t registers, without VRAM
+    STATE_SECTION_RAM = 5,
+    STATE_SECTION_VRAM = 6,
+    STATE_SECTION_BIOS = 7,   // As patched in memory
+    STATE_SECTION_CDROM = 8,  // cdrom_state_t, the disc itself isn't saved
+} state_section_id_t;
+
+typedef struct state_section_header {
+    u32 id;
+    u32 reserved;
+    u64 offset; // From the start of the file
+    u64 size;
+} state_section_header_t;
+
+typedef struct state_file_header {
+    char magic[8];
+    u32 version;
+    u32 num_sections;
+    u64 cycles; // Emulated cycle count when the state was taken
+    u32 pc;
+    u32 reserved;
+    state_section_header_t sections[STATE_MAX_SECTIONS];
+} state_file_header_t;
+
+// A section of the live machine state
+typedef struct state_section {
+    state_section_id_t id;
+    void* data;
+    size_t size;
+} state_section_t;
+
+typedef struct state_mapping {
+    const state_file_header_t* header;
+    size_t size;
+} state_mapping_t;
+
+// Fills `sections` with the live state and returns how many there are, at most STATE_MAX_SECTIONS
+int state_sections(state_section_t* sections);
+const char* state_section_name(u32 id);
+
+// Writes the whole machine through a shared mapping of `path`. Only uses async-signal-safe calls. Returns false on failure.
+bool state_write_mapped(const char* path);
+
+// Save state, gathered from the live machine with one writev. Returns false on failure.
+bool state_save(const char* path);
+// Reads a state file directly into the live machine. The header is validated before anything is overwritten.
+bool state_load(const char* path);
+
+// In-memory image of every section except the BIOS, each padded to STATE_ALIGNMENT so images can be compared page by page
+int state_image_sections(state_section_t* sections);
+size_t state_image_size();
+void state_image_capture(u8* image);
+void state_image_restore(const u8* image);
+
+// 64 bit FNV-1a hash of every section except the BIOS, identical machines hash the same
+u64 state_hash();
+
+// Loop over short writes/reads, shared with the delta snapshots
+struct iovec;
+bool state_writev(int fd, struct iovec* iov, int iovcnt);
+bool state_preadv(int fd, struct iovec* iov, int iovcnt, u64 offset);
+
+// Maps a state file read-only and validates its header and section sizes. Returns false if it isn't a usable state file.
+bool state_map(const char* path, state_mapping_t* mapping);
+void state_unmap(state_mapping_t* mapping);
+// Pointer to a section inside a mapping or NULL if the file doesn't have it
+const void* state_mapping_section(const state_mapping_t* mapping, state_section_id_t id, size_t* size);
+
+#endif //PS1_STATE_H
@@ -0,0 +1,202 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include <cflags.h>
+#include <log.h>
+#include <timing.h>
+#include <mem/ps1system.h>
+#include <hle/hle.h>
+#include "job.h"
+
+/*
+ * Boots (or resumes) the machine once, then forks a child per job. Each child starts from a copy-on-write image of the
+ * warmed up machine, runs the job and writes its result back, so a job costs a fork instead of a BIOS boot.
+ *
+ * Jobs use the same one line format as ps1_runner, see job.h, except bios= since every child shares the parent's BIOS.
+ * With --warm-to-shell the server stops the BIOS right before its shell, so exe= jobs start their EXE immediately.
+ * They're read from stdin with results going to stdout, or with --socket from each connection to a UNIX socket with
+ * results written back on the same connection. The client shuts down its side when it's done sending and the
+ * connection closes once every job on it finished.
+ */
+
+#define MAX_LINE 4096
+// Ten seconds of guest time
+#define WARM_TO_SHELL_LIMIT (CPU_CYCLES_PER_FRAME * 600)
+
+static int max_children = 1;
+static int num_children = 0;
+
+static void reap_children(int keep) {
+    while (num_children > keep) {
+        if (waitpid(-1, NULL, 0) < 0 && errno != EINTR) {
+            num_children = 0;
+            break;
+        }
+        num_children--;
+    }
+    while (num_children > 0 && waitpid(-1, NULL, WNOHANG) > 0) {
+        num_children--;
+    }
+}
+
+static void send_result(int fd, const job_t* job) {
+    char* buf = NULL;
+    size_t size = 0;
+    FILE* fp = open_memstream(&buf, &size);
+    job_write_result(fp, job);
+    fclose(fp);
+    // One write per result, so lines from concurrent children don't interleave
+    for (size_t written = 0; written < size; ) {
+        ssize_t n = write(fd, buf + written, size - written);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        written += n;
+    }
+    free(buf);
+}
+
+static void serve(int in_fd, int out_fd) {
+    FILE* in = fdopen(dup(in_fd), "r");
+    if (in == NULL) {
+        logfatal("Unable to read jobs: %s", strerror(errno));
+    }
+    char line[MAX_LINE];
+    while (fgets(line, sizeof(line), in) != NULL) {
+        job_t job;
+        char error[256];
+        if (!job_parse(line, &job, error, sizeof(error)) || job.bios != NULL) {
+            if (job.name == NULL) {
+                job.name = strdup("");
+            }
+            job.status = JOB_ERROR;
+            job.error = job.bios != NULL ? "bios= can't be used, children run on the BIOS the server booted" : error;
+            send_result(out_fd, &job);
+            job_free(&job);
+            continue;
+        }
+        if (job.name == NULL) {
+            continue;
+        }
+
+        reap_children(max_children - 1);
+        log_flush();
+        fflush(stdout);
+        pid_t pid = fork();
+        if (pid == 0) {
+            job_run(&job, false, NULL);
+            send_result(out_fd, &job);
+            log_flush();
+            _exit(job.status == JOB_OK ? 0 : 1);
+        } else if (pid < 0) {
+            job.status = JOB_ERROR;
+            job.error = strerror(errno);
+            send_result(out_fd, &job);
+        } else {
+            num_children++;
+        }
+        job_free(&job);
+    }
+    fclose(in);
+}
+
+static int listen_socket(const char* path) {
+    struct sockaddr_un addr;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        logfatal("Socket path %s is too long", path);
+    }
+    memset(&addr, 0x00, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        logfatal("Unable to create a socket: %s", strerror(errno));
+    }
+    unlink(path);
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(fd, 64) < 0) {
+        logfatal("Unable to listen on %s: %s", path, strerror(errno));
+    }
+    return fd;
+}
+
+int main(int argc, char** argv) {
+    cflags_t* flags = cflags_init();
+    const char* bios = "SCPH1001.BIN";
+    cflags_add_string(flags, 'b', "bios", &bios, "BIOS to boot, default SCPH1001.BIN, \"" HLE_BIOS_NAME "\" for the built-in one");
+    const char* load_state = NULL;
+    cflags_add_string(flags, '\0', "load-state", &load_state, "resume from a save state instead of booting");
+    int warm_frames = 0;
+    cflags_add_int(flags, '\0', "warm-frames", &warm_frames, "run this many frames before taking jobs");
+    bool warm_to_shell = false;
+    cflags_add_bool(flags, '\0', "warm-to-shell", &warm_to_shell, "boot until the BIOS is about to start its shell, for exe= jobs");
+    const char* socket_path = NULL;
+    cflags_add_string(flags, 's', "socket", &socket_path, "take jobs from connections to this UNIX socket instead of stdin");
+    cflags_add_int(flags, 'j', "jobs", &max_children, "run up to this many children at once, default 1");
+    bool help = false;
+    cflags_add_bool(flags, 'h', "help", &help, "Display this help message");
+    cflags_parse(flags, argc, argv);
+
+    if (help || flags->argc != 0) {
+        cflags_print_usage(flags, "[OPTION]...", "Forks dgb-ps1 jobs off a machine booted once", "https://github.com/Dillonb/ps1");
+        return help ? 0 : 1;
+    }
+    cflags_free(flags);
+    if (max_children < 1) {
+        max_children = 1;
+    }
+    log_set_verbosity(0);
+
+    u64 start = timing_now_ns();
+    ps1_system_init_with_bios(bios);
+    if (load_state != NULL) {
+        ps1_system_load_state(load_state);
+    }
+    for (int i = 0; i < warm_frames; i++) {
+        ps1_system_run_frame();
+    }
+    // The HLE BIOS has no shell, EXEs start straight away anyway
+    if (warm_to_shell && !PS1SYS.hle_bios) {
+        u64 limit = PS1SYS.cycles + WARM_TO_SHELL_LIMIT;
+        while (PS1CPU.pc != EXE_SHELL_ENTRY) {
+            if (PS1SYS.cycles >= limit) {
+                logfatal("The BIOS didn't reach its shell at 0x%08X within %d cycles", EXE_SHELL_ENTRY, WARM_TO_SHELL_LIMIT);
+            }
+            ps1_system_step();
+        }
+    }
+    log_flush();
+    fprintf(stderr, "Ready after %.3f s\n", (timing_now_ns() - start) / 1e9);
+    log_set_fatal_handler(job_fatal_handler);
+    // A client going away shouldn't take the server down with it
+    signal(SIGPIPE, SIG_IGN);
+
+    if (socket_path == NULL) {
+        serve(STDIN_FILENO, STDOUT_FILENO);
+        reap_children(0);
+        return 0;
+    }
+
+    int listen_fd = listen_socket(socket_path);
+    while (true) {
+        int fd = accept(listen_fd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            logfatal("accept() failed: %s", strerror(errno));
+        }
+        serve(fd, fd);
+        close(fd);
+    }
+}
@@ -0,0 +1,225 @@
+#include "job.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <setjmp.h>
+
+#include <log.h>
+#include <timing.h>
+#include <mem/ps1system.h>
+#include <mem/state.h>
+#include <gpu/scanout.h>
+
+static _Thread_local job_t* current_job = NULL;
+static _Thread_local jmp_buf* job_escape = NULL;
+
+bool job_parse(char* line, job_t* job, char* error, size_t error_size) {
+    memset(job, 0x00, sizeof(job_t));
+    char* comment = strchr(line, '#');
+    if (comment != NULL) {
+        *comment = '\0';
+    }
+    char* save = NULL;
+    char* name = strtok_r(line, " \t\r\n", &save);
+    if (name == NULL) {
+        return true;
+    }
+    job->name = strdup(name);
+
+    char* token;
+    while ((token = strtok_r(NULL, " \t\r\n", &save)) != NULL) {
+        char* value = strchr(token, '=');
+        if (value == NULL) {
+            snprintf(error, error_size, "expected KEY=VALUE, got %s", token);
+            return false;
+        }
+        *value++ = '\0';
+        if (strcmp(token, "bios") == 0) {
+            free(job->bios);
+            job->bios = strdup(value);
+        } else if (strcmp(token, "state") == 0) {
+            free(job->state);
+            job->state = strdup(value);
+        } else if (strcmp(token, "exe") == 0) {
+            free(job->exe);
+            job->exe = strdup(value);
+        } else if (strcmp(token, "disc") == 0) {
+            free(job->disc);
+            job->disc = strdup(value);
+        } else if (strcmp(token, "capture") == 0) {
+            free(job->capture);
+            job->capture = strdup(value);
+        } else if (strcmp(token, "frames") == 0) {
+            job->frames = strtoull(value, NULL, 0);
+        } else if (strcmp(token, "cycles") == 0) {
+            job->cycles = strtoull(value, NULL, 0);
+        } else {
+            snprintf(error, error_size, "unsupported job key %s", token);
+            return false;
+        }
+    }
+    if (job->frames == 0 && job->cycles == 0) {
+        snprintf(error, error_size, "job %s needs a frames= or cycles= budget", job->name);
+        return false;
+    }
+    return true;
+}
+
+void job_fatal_handler() {
+    if (job_escape != NULL) {
+        longjmp(*job_escape, 1);
+    }
+}
+
+static void job_tty(u8 c) {
+    job_t* job = current_job;
+    if (job->tty_size + 1 >= job->tty_capacity) {
+        job->tty_capacity = job->tty_capacity ? job->tty_capacity * 2 : 256;
+        job->tty = realloc(job->tty, job->tty_capacity);
+    }
+    job->tty[job->tty_size++] = c;
+    job->tty[job->tty_size] = '\0';
+}
+
+static void write_capture(const char* path, const u32* buffer) {
+    FILE* fp = fopen(path, "wb");
+    if (fp == NULL) {
+        logwarn("Unable to open %s for writing", path);
+        return;
+    }
+    int width = PS1GPU.display_width;
+    int height = PS1GPU.display_height;
+    fprintf(fp, "P6\n%d %d\n255\n", width, height);
+    u8 row[SCANOUT_MAX_WIDTH * 3];
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            u32 pixel = buffer[y * SCANOUT_MAX_WIDTH + x];
+            row[x * 3 + 0] = pixel;
+            row[x * 3 + 1] = pixel >> 8;
+            row[x * 3 + 2] = pixel >> 16;
+        }
+        fwrite(row, 3, width, fp);
+    }
+    fclose(fp);
+}
+
+void job_run(job_t* job, bool boot, const char* bios) {
+    u32* volatile scanout_buffer = NULL;
+    u64 start = timing_now_ns();
+
+    jmp_buf escape;
+    current_job = job;
+    job_escape = &escape;
+    if (setjmp(escape) == 0) {
+        if (boot) {
+            ps1_system_init_with_bios(bios);
+        }
+        PS1SYS.tty_handler = job_tty;
+        if (job->capture != NULL) {
+            scanout_buffer = calloc(SCANOUT_MAX_WIDTH * SCANOUT_MAX_HEIGHT, sizeof(u32));
+            gpu_set_scanout_buffer(scanout_buffer);
+        }
+        if (job->state != NULL) {
+            ps1_system_load_state(job->state);
+        }
+        if (job->disc != NULL) {
+            ps1_system_insert_disc(job->disc);
+        }
+        if (job->exe != NULL) {
+            ps1_system_load_exe(job->exe, false);
+        }
+        if (job->cycles > 0) {
+            ps1_system_run_cycles(job->cycles);
+        }
+        for (u64 i = 0; i < job->frames; i++) {
+            ps1_system_run_frame();
+        }
+        // Before hashing, which reads every page
+        if (job->measure_footprint) {
+            footprint_measure(&job->footprint);
+        }
+        if (job->capture != NULL) {
+            write_capture(job->capture, scanout_buffer);
+        }
+        job->hash = state_hash();
+        job->status = JOB_OK;
+    } else {
+        job->status = JOB_FATAL;
+        if (job->measure_footprint) {
+            footprint_measure(&job->footprint);
+        }
+    }
+    job_escape = NULL;
+    current_job = NULL;
+
+    PS1SYS.tty_handler = NULL;
+    gpu_set_scanout_buffer(NULL);
+    free(scanout_buffer);
+    job->emulated_cycles = PS1SYS.cycles;
+    job->pc = PS1CPU.pc;
+    job->host_ns = timing_now_ns() - start;
+}
+
+static void write_json_string(FILE* fp, const char* s, size_t size) {
+    fputc('"', fp);
+    for (size_t i = 0; i < size; i++) {
+        u8 c = s[i];
+        switch (c) {
+            case '"':  fputs("\\\"", fp); break;
+            case '\\': fputs("\\\\", fp); break;
+            case '\n': fputs("\\n", fp); break;
+            case '\r': fputs("\\r", fp); break;
+            case '\t': fputs("\\t", fp); break;
+            default:
+                if (c < 0x20 || c >= 0x7F) {
+                    fprintf(fp, "\\u%04x", c);
+                } else {
+                    fputc(c, fp);
+                }
+        }
+    }
+    fputc('"', fp);
+}
+
+void job_write_result(FILE* fp, const job_t* job) {
+    static const char* status_names[] = { "pending", "ok", "fatal", "error" };
+    fprintf(fp, "{\"name\": ");
+    write_json_string(fp, job->name, strlen(job->name));
+    fprintf(fp, ", \"status\": \"%s\"", status_names[job->status]);
+    if (job->status == JOB_ERROR) {
+        fprintf(fp, ", \"error\": ");
+        write_json_string(fp, job->error, strlen(job->error));
+        fprintf(fp, "}\n");
+        return;
+    }
+    fprintf(fp, ", \"cycles\": %" PRIu64 ", \"pc\": \"0x%08X\"", job->emulated_cycles, job->pc);
+    if (job->status == JOB_OK) {
+        fprintf(fp, ", \"state_hash\": \"%016" PRIx64 "\"", job->hash);
+        if (job->capture != NULL) {
+            fprintf(fp, ", \"capture\": ");
+            write_json_string(fp, job->capture, strlen(job->capture));
+        }
+    }
+    if (job->measure_footprint) {
+        fprintf(fp, ", \"resident\": {");
+        for (int i = 0; i < job->footprint.num_regions; i++) {
+            fprintf(fp, "%s\"%s\": %zu", i > 0 ? ", " : "", job->footprint.regions[i].name, job->footprint.regions[i].resident);
+        }
+        fprintf(fp, "}");
+    }
+    fprintf(fp, ", \"host_ms\": %.3f, \"tty\": ", job->host_ns / 1e6);
+    write_json_string(fp, job->tty != NULL ? job->tty : "", job->tty_size);
+    fprintf(fp, "}\n");
+}
+
+void job_free(job_t* job) {
+    free(job->name);
+    free(job->bios);
+    free(job->state);
+    free(job->exe);
+    free(job->disc);
+    free(job->capture);
+    free(job->tty);
+    memset(job, 0x00, sizeof(job_t));
+}
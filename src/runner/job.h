@@ -0,0 +1,65 @@
+#ifndef PS1_JOB_H
+#define PS1_JOB_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <util.h>
+#include <mem/footprint.h>
+
+/*
+ * A job is one line of text: NAME followed by KEY=VALUE pairs.
+ *   bios=PATH     boot this BIOS instead of the runner's default
+ *   state=PATH    resume from a save state before running
+ *   exe=PATH      side-load a PS-X EXE, started in place of the BIOS shell
+ *   disc=PATH     put a disc image (.cue or .bin) in the drive
+ *   frames=N      run N frames
+ *   cycles=N      run N cycles, before any frames
+ *   capture=PATH  write the last frame to PATH as a PPM
+ */
+
+typedef enum job_status {
+    JOB_PENDING,
+    JOB_OK,
+    JOB_FATAL,
+    JOB_ERROR,
+} job_status_t;
+
+typedef struct job {
+    char* name;
+    char* bios;
+    char* state;
+    char* exe;
+    char* disc;
+    char* capture;
+    u64 frames;
+    u64 cycles;
+
+    job_status_t status;
+    const char* error;
+    u64 hash;
+    u64 emulated_cycles;
+    u32 pc;
+    u64 host_ns;
+    char* tty;
+    size_t tty_size;
+    size_t tty_capacity;
+    // Set before running to report the instance's resident memory at the end of the job
+    bool measure_footprint;
+    footprint_t footprint;
+} job_t;
+
+// Parses one line into `job`, which is left with a NULL name for blank and comment lines. On errors returns false
+// and describes the problem in `error`.
+bool job_parse(char* line, job_t* job, char* error, size_t error_size);
+// Fatal errors inside job_run() fail the job instead of exiting, install this before running any
+void job_fatal_handler();
+/*
+ * Runs the job on the current instance. With `boot` the instance is initialized from `bios` first, otherwise the job
+ * continues from whatever state the instance is in.
+ */
+void job_run(job_t* job, bool boot, const char* bios);
+// Writes the result as one line of JSON
+void job_write_result(FILE* fp, const job_t* job);
+void job_free(job_t* job);
+
+#endif //PS1_JOB_H
@@ -0,0 +1,196 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include <cflags.h>
+#include <log.h>
+#include <timing.h>
+#include <mem/ps1system.h>
+#include <hle/hle.h>
+#include "job.h"
+
+/*
+ * Runs a list of jobs on a pool of threads, each job on its own instance. Every worker owns a deque of jobs: it takes
+ * from the back of its own and, once that's empty, steals from the front of the others'. A fatal error in the core
+ * only fails the job it happened in.
+ *
+ * The job file has one job per line, see job.h, and '#' starts a comment.
+ */
+
+#define MAX_LINE 4096
+
+typedef struct worker {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    int* queue;
+    int head; // Thieves take from here
+    int tail; // The owner takes from here
+    int id;
+    int jobs_run;
+    int jobs_stolen;
+} worker_t;
+
+static job_t* jobs = NULL;
+static int num_jobs = 0;
+static worker_t* workers = NULL;
+static int num_workers = 0;
+
+static const char* default_bios = "SCPH1001.BIN";
+
+static void run_job(job_t* job) {
+    ps1_instance_t* instance = ps1_instance_create();
+    ps1_instance_select(instance);
+    job_run(job, true, job->bios != NULL ? job->bios : default_bios);
+    ps1_instance_destroy(instance);
+}
+
+static int take_own(worker_t* worker) {
+    int job = -1;
+    pthread_mutex_lock(&worker->lock);
+    if (worker->tail > worker->head) {
+        job = worker->queue[--worker->tail];
+    }
+    pthread_mutex_unlock(&worker->lock);
+    return job;
+}
+
+static int steal(worker_t* thief) {
+    for (int i = 1; i < num_workers; i++) {
+        worker_t* victim = &workers[(thief->id + i) % num_workers];
+        int job = -1;
+        pthread_mutex_lock(&victim->lock);
+        if (victim->tail > victim->head) {
+            job = victim->queue[victim->head++];
+        }
+        pthread_mutex_unlock(&victim->lock);
+        if (job >= 0) {
+            thief->jobs_stolen++;
+            return job;
+        }
+    }
+    return -1;
+}
+
+static void* worker_main(void* arg) {
+    worker_t* worker = arg;
+    // Jobs never create more jobs, so once every queue is empty the worker is done
+    while (true) {
+        int job = take_own(worker);
+        if (job < 0) {
+            job = steal(worker);
+        }
+        if (job < 0) {
+            break;
+        }
+        run_job(&jobs[job]);
+        worker->jobs_run++;
+    }
+    return NULL;
+}
+
+static void parse_jobs(const char* path) {
+    FILE* fp = fopen(path, "r");
+    if (fp == NULL) {
+        logfatal("Unable to open job file %s", path);
+    }
+    char line[MAX_LINE];
+    int line_number = 0;
+    int capacity = 0;
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        line_number++;
+        job_t job;
+        char error[256];
+        if (!job_parse(line, &job, error, sizeof(error))) {
+            logfatal("%s:%d: %s", path, line_number, error);
+        }
+        if (job.name == NULL) {
+            continue;
+        }
+        if (num_jobs == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            jobs = realloc(jobs, capacity * sizeof(job_t));
+        }
+        jobs[num_jobs++] = job;
+    }
+    fclose(fp);
+}
+
+int main(int argc, char** argv) {
+    cflags_t* flags = cflags_init();
+    int threads = 0;
+    cflags_add_int(flags, 'j', "threads", &threads, "worker threads, default one per online CPU");
+    const char* results_path = NULL;
+    cflags_add_string(flags, 'o', "results", &results_path, "write results to this file instead of stdout");
+    cflags_add_string(flags, 'b', "bios", &default_bios, "BIOS for jobs that don't set bios=, default SCPH1001.BIN, \"" HLE_BIOS_NAME "\" for the built-in one");
+    bool compact = false;
+    cflags_add_bool(flags, '\0', "compact", &compact, "only commit instance memory the guest touches, see footprint.h");
+    bool footprint = false;
+    cflags_add_bool(flags, '\0', "footprint", &footprint, "report each job's resident memory per subsystem");
+    bool help = false;
+    cflags_add_bool(flags, 'h', "help", &help, "Display this help message");
+    cflags_parse(flags, argc, argv);
+
+    if (help || flags->argc != 1) {
+        cflags_print_usage(flags, "[OPTION]... JOBFILE", "Runs dgb-ps1 jobs in parallel, one instance per job", "https://github.com/Dillonb/ps1");
+        return help ? 0 : 1;
+    }
+    log_set_verbosity(0);
+    log_set_fatal_handler(job_fatal_handler);
+    parse_jobs(flags->argv[0]);
+    footprint_set_mode(compact ? FOOTPRINT_COMPACT : FOOTPRINT_DEFAULT);
+    for (int i = 0; i < num_jobs; i++) {
+        jobs[i].measure_footprint = footprint;
+    }
+
+    num_workers = threads > 0 ? threads : sysconf(_SC_NPROCESSORS_ONLN);
+    if (num_workers > num_jobs) {
+        num_workers = num_jobs > 0 ? num_jobs : 1;
+    }
+    workers = calloc(num_workers, sizeof(worker_t));
+    for (int i = 0; i < num_workers; i++) {
+        workers[i].id = i;
+        workers[i].queue = malloc(num_jobs * sizeof(int));
+        pthread_mutex_init(&workers[i].lock, NULL);
+    }
+    // Round robin to start with, stealing evens out jobs of different lengths
+    for (int i = 0; i < num_jobs; i++) {
+        worker_t* worker = &workers[i % num_workers];
+        worker->queue[worker->tail++] = i;
+    }
+
+    u64 start = timing_now_ns();
+    for (int i = 0; i < num_workers; i++) {
+        pthread_create(&workers[i].thread, NULL, worker_main, &workers[i]);
+    }
+    int stolen = 0;
+    for (int i = 0; i < num_workers; i++) {
+        pthread_join(workers[i].thread, NULL);
+        stolen += workers[i].jobs_stolen;
+    }
+    u64 elapsed = timing_now_ns() - start;
+
+    FILE* results = stdout;
+    if (results_path != NULL) {
+        results = fopen(results_path, "w");
+        if (results == NULL) {
+            logfatal("Unable to open %s for writing", results_path);
+        }
+    }
+    // One JSON object per line, in job file order
+    for (int i = 0; i < num_jobs; i++) {
+        job_write_result(results, &jobs[i]);
+    }
+    if (results != stdout) {
+        fclose(results);
+    }
+
+    int failed = 0;
+    for (int i = 0; i < num_jobs; i++) {
+        failed += jobs[i].status != JOB_OK;
+    }
+    log_flush();
+    fprintf(stderr, "%d jobs, %d failed, %d threads, %d stolen, %.3f s\n", num_jobs, failed, num_workers, stolen, elapsed / 1e9);
+    cflags_free(flags);
+    return failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,33 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <cflags.h>
+#include <log.h>
+#include <cdrom/disc.h>
+#include <cdrom/cdz.h>
+
+int main(int argc, char** argv) {
+    cflags_t* flags = cflags_init();
+    const char* hunk_sectors_str = NULL;
+    cflags_add_string(flags, '\0', "hunk-sectors", &hunk_sectors_str, "sectors per independently compressed hunk, default 8");
+    bool help = false;
+    cflags_add_bool(flags, 'h', "help", &help, "Display this help message");
+    cflags_parse(flags, argc, argv);
+
+    if (help || flags->argc != 2) {
+        cflags_print_usage(flags, "INPUT OUTPUT", "Compresses a disc image (.cue or .bin) into a dgb-ps1 .cdz", "https://github.com/Dillonb/ps1");
+        return help ? 0 : 1;
+    }
+    log_set_verbosity(LOG_VERBOSITY_WARN);
+
+    u32 hunk_sectors = hunk_sectors_str != NULL ? strtoul(hunk_sectors_str, NULL, 0) : CDZ_DEFAULT_HUNK_SECTORS;
+    if (hunk_sectors == 0) {
+        logfatal("--hunk-sectors must be at least 1");
+    }
+    disc_t* disc = disc_open(flags->argv[0]);
+    bool ok = disc != NULL && cdz_write(disc, flags->argv[1], hunk_sectors);
+    disc_close(disc);
+    log_flush();
+    cflags_free(flags);
+    return ok ? 0 : 1;
+}
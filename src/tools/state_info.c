@@ -0,0 +1,90 @@
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include <cflags.h>
+#include <log.h>
+#include <cpu/cpu.h>
+#include <cpu/disassemble.h>
+#include <mem/ps1system.h>
+#include <mem/state.h>
+
+// Prints the contents of a machine state file (crash dump or save state) without running anything
+
+static const u8* state_memory(const state_mapping_t* mapping, u32 address) {
+    size_t size;
+    u32 phys = address & 0x1FFFFFFF;
+    if (phys < 0x00800000) {
+        const u8* ram = state_mapping_section(mapping, STATE_SECTION_RAM, &size);
+        phys &= 0x1FFFFF;
+        return ram != NULL && phys + 4 <= size ? ram + phys : NULL;
+    } else if (phys >= 0x1FC00000) {
+        const u8* bios = state_mapping_section(mapping, STATE_SECTION_BIOS, &size);
+        phys -= 0x1FC00000;
+        return bios != NULL && phys + 4 <= size ? bios + phys : NULL;
+    }
+    return NULL;
+}
+
+static void print_cpu(const state_mapping_t* mapping, int context) {
+    const r3000a_t* cpu = state_mapping_section(mapping, STATE_SECTION_CPU, NULL);
+    if (cpu == NULL) {
+        return;
+    }
+    printf("PC: 0x%08X next: 0x%08X prev: 0x%08X%s\n", cpu->pc, cpu->next_pc, cpu->prev_pc, cpu->branch ? " (in delay slot)" : "");
+    for (int i = 0; i < 32; i += 4) {
+        for (int j = i; j < i + 4; j++) {
+            printf("$%-4s 0x%08X  ", register_names[j], cpu->gpr[j]);
+        }
+        printf("\n");
+    }
+    printf("$hi   0x%08X  $lo   0x%08X\n", cpu->mult_hi, cpu->mult_lo);
+    printf("$SR   0x%08X  $CAUSE 0x%08X  $EPC 0x%08X\n", cpu->cp0.status.raw, cpu->cp0.cause.raw, cpu->cp0.EPC);
+
+    printf("\n");
+    for (int i = -context; i <= context; i++) {
+        u32 address = cpu->pc + i * 4;
+        const u8* word = state_memory(mapping, address);
+        if (word == NULL) {
+            continue;
+        }
+        u32 raw;
+        memcpy(&raw, word, sizeof(raw));
+        char buf[64];
+        disassemble(address, raw, buf, sizeof(buf));
+        printf("%s %08X: %08X  %s\n", i == 0 ? ">" : " ", address, raw, buf);
+    }
+}
+
+int main(int argc, char** argv) {
+    cflags_t* flags = cflags_init();
+    int context = 8;
+    cflags_add_int(flags, 'c', "context", &context, "instructions to disassemble around the PC, default 8");
+    bool help = false;
+    cflags_add_bool(flags, 'h', "help", &help, "Display this help message");
+    cflags_parse(flags, argc, argv);
+
+    if (help || flags->argc != 1) {
+        cflags_print_usage(flags, "[OPTION]... STATEFILE", "Prints a dgb-ps1 machine state file", "https://github.com/Dillonb/ps1");
+        return help ? 0 : 1;
+    }
+    log_set_verbosity(LOG_VERBOSITY_WARN);
+
+    state_mapping_t mapping;
+    if (!state_map(flags->argv[0], &mapping)) {
+        log_flush();
+        return 1;
+    }
+    printf("Version %u, taken at cycle %" PRIu64 " (frame %" PRIu64 ")\n", mapping.header->version, mapping.header->cycles,
+           mapping.header->cycles / CPU_CYCLES_PER_FRAME);
+    for (int i = 0; i < mapping.header->num_sections; i++) {
+        const state_section_header_t* section = &mapping.header->sections[i];
+        printf("  %-8s %10" PRIu64 " bytes at 0x%08" PRIX64 "\n", state_section_name(section->id), section->size, section->offset);
+    }
+    printf("\n");
+    print_cpu(&mapping, context);
+
+    state_unmap(&mapping);
+    cflags_free(flags);
+    return 0;
+}
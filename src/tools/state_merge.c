@@ -0,0 +1,25 @@
+#include <stdio.h>
+
+#include <cflags.h>
+#include <log.h>
+#include <mem/delta.h>
+
+// Merges a chain of consecutive delta snapshots into one
+
+int main(int argc, char** argv) {
+    cflags_t* flags = cflags_init();
+    bool help = false;
+    cflags_add_bool(flags, 'h', "help", &help, "Display this help message");
+    cflags_parse(flags, argc, argv);
+
+    if (help || flags->argc < 2) {
+        cflags_print_usage(flags, "OUTPUT DELTA...", "Merges consecutive dgb-ps1 delta snapshots, oldest first", "https://github.com/Dillonb/ps1");
+        return help ? 0 : 1;
+    }
+    log_set_verbosity(LOG_VERBOSITY_WARN);
+
+    bool ok = delta_merge(flags->argv[0], (const char**)&flags->argv[1], flags->argc - 1);
+    log_flush();
+    cflags_free(flags);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,99 @@
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cflags.h>
+#include <cpu/trace.h>
+#include <cpu/disassemble.h>
+
+// Offline decoder for traces written by --trace, prints one disassembled line per record, oldest first
+
+static void print_record(const trace_record_t* record) {
+    char disasm[64];
+    disassemble(record->pc, record->instruction, disasm, sizeof(disasm));
+    printf("%08X: %08X  %-32s", record->pc, record->instruction, disasm);
+    if (record->reg == TRACE_REG_HI || record->reg == TRACE_REG_LO) {
+        printf(" $%s=%08X", record->reg == TRACE_REG_HI ? "hi" : "lo", record->reg_value);
+    } else if (record->reg != TRACE_REG_NONE) {
+        printf(" $%s=%08X", register_names[record->reg], record->reg_value);
+    }
+    if (record->mem_flags != TRACE_MEM_NONE) {
+        int width = record->mem_flags & TRACE_MEM_WIDTH_MASK;
+        if (record->mem_flags & TRACE_MEM_WRITE) {
+            printf(" [%08X]<-%0*X", record->mem_address, width * 2, record->mem_value);
+        } else {
+            printf(" [%08X]->%08X", record->mem_address, record->mem_value);
+        }
+    }
+    printf("\n");
+}
+
+int main(int argc, char** argv) {
+    cflags_t* flags = cflags_init();
+    const char* last_str = NULL;
+    cflags_add_string(flags, 'n', "last", &last_str, "only print the last N records");
+    bool help = false;
+    cflags_add_bool(flags, 'h', "help", &help, "Display this help message");
+    cflags_parse(flags, argc, argv);
+
+    if (help || flags->argc != 1) {
+        cflags_print_usage(flags, "[OPTION]... TRACEFILE", "Decodes dgb-ps1 execution traces", "https://github.com/Dillonb/ps1");
+        return help ? 0 : 1;
+    }
+
+    const char* path = flags->argv[0];
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Unable to open %s\n", path);
+        return 1;
+    }
+    struct stat st;
+    fstat(fd, &st);
+    if (st.st_size < sizeof(trace_header_t)) {
+        fprintf(stderr, "%s is too small to be a trace\n", path);
+        return 1;
+    }
+    const u8* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        fprintf(stderr, "Unable to map %s\n", path);
+        return 1;
+    }
+
+    const trace_header_t* header = (const trace_header_t*)data;
+    if (memcmp(header->magic, TRACE_MAGIC, sizeof(header->magic)) != 0
+            || header->version != TRACE_VERSION || header->record_size != sizeof(trace_record_t)) {
+        fprintf(stderr, "%s is not a version %d trace\n", path, TRACE_VERSION);
+        return 1;
+    }
+    if (header->capacity == 0) {
+        fprintf(stderr, "%s has no room for records\n", path);
+        return 1;
+    }
+    // Divided rather than multiplied, so a corrupt capacity can't overflow past the check
+    if (header->capacity > (st.st_size - sizeof(trace_header_t)) / sizeof(trace_record_t)) {
+        fprintf(stderr, "%s is truncated\n", path);
+        return 1;
+    }
+
+    const trace_record_t* records = (const trace_record_t*)(header + 1);
+    u64 available = header->written < header->capacity ? header->written : header->capacity;
+    u64 count = available;
+    if (last_str != NULL) {
+        u64 last = strtoull(last_str, NULL, 0);
+        if (last < count) {
+            count = last;
+        }
+    }
+    fprintf(stderr, "%" PRIu64 " records written, printing %" PRIu64 "\n", header->written, count);
+
+    for (u64 i = header->written - count; i < header->written; i++) {
+        print_record(&records[i % header->capacity]);
+    }
+    cflags_free(flags);
+    return 0;
+}